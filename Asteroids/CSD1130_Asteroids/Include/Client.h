@@ -23,12 +23,29 @@
 #include <chrono>
 #include <fstream>
 
+#include "Protocol.h"
+#include "SimSnapshot.h"
+#include "SimPrediction.h"
+#include "SimInterpolation.h"
+#include "NetReliable.h"
+#include "NetBundle.h"
+#include "NetRate.h"
+#include "NetSpscQueue.h"
+#include "NetSocket.h"
+#include "NetStream.h"
+
 // Return code constants for different exit conditions
 constexpr int RETURN_CODE_1 = 1; // General failure
 constexpr int RETURN_CODE_2 = 2; // Unused in current implementation
 constexpr int RETURN_CODE_3 = 3; // Unused in current implementation
 constexpr int RETURN_CODE_4 = 4; // Command format error
 
+// Capacity of the queues between the game loop and the network thread
+constexpr size_t CLIENT_OUTBOUND_QUEUE = 256; // Messages for the server, several per frame
+constexpr size_t CLIENT_INBOUND_QUEUE = 64;   // Welcomes, snapshots and standings, about one per server tick
+// Times per second the client sends to the server by default, whatever the frame rate
+constexpr int CLIENT_SEND_RATE_DEFAULT = 30;
+
 // Command ID enumeration - protocol definition for client-server communication
 enum CMDID : unsigned char {
     UNKNOWN = 0x0,          // Unknown command
@@ -37,6 +54,14 @@ enum CMDID : unsigned char {
     RSP_ECHO = 0x3,         // Response to an echo request
     REQ_LISTUSERS = 0x4,    // Request to list connected users
     RSP_LISTUSERS = 0x5,    // Response with list of users
+    REQ_SHIP_STATE = NET_CMD_REQ_SHIP_STATE, // Binary ship state update (see Protocol.h)
+    RSP_SHIP_STATE = NET_CMD_RSP_SHIP_STATE, // Server acknowledgement of a ship state update
+    REQ_INPUT = NET_CMD_REQ_INPUT,           // Controls for the server's simulation
+    RSP_WELCOME = NET_CMD_RSP_WELCOME,       // Player ID assigned by the server
+    RSP_SNAPSHOT = NET_CMD_RSP_SNAPSHOT,     // One part of the server's world state
+    RELIABLE = NET_CMD_RELIABLE,             // Reliable, ordered messages and acknowledgements
+    RSP_GAME_EVENT = NET_CMD_RSP_GAME_EVENT, // Our score or lives changed (reliable)
+    BUNDLE = NET_CMD_BUNDLE,                 // Several of the above in one datagram
     CMD_TEST = 0x20,        // Test command
     ECHO_ERROR = 0x30       // Error in echo operation
 };
@@ -45,6 +70,38 @@ struct UdpClientData {
     char data[1024];  // Buffer for incoming data
     int dataSize;     // Size of the incoming data
 };
+
+// Something the game loop hands the network thread to send on its next send tick
+struct ClientOutbound {
+    enum Kind : uint8_t {
+        SHIP_STATE,         // ship, as REQ_SHIP_STATE number sequence; only the newest is sent
+        INPUT,              // input, as REQ_INPUT number sequence; the network thread adds the reliable ack
+        RELIABLE_MESSAGE,   // message, over the reliable channel
+        QUIT                // Sends REQ_QUIT at once and stops the network thread
+    } kind = SHIP_STATE;
+    uint16_t sequence = 0;
+    NetShipState ship{};
+    NetInput input{};
+    std::vector<char> message;
+};
+
+// Something the network thread received for the game loop
+struct ClientInbound {
+    enum Kind : uint8_t {
+        WELCOME,            // config from RSP_WELCOME
+        SNAPSHOT,           // A complete tick, with our ship in it if hasShip
+        STANDING            // Our new score and lives
+    } kind = SNAPSHOT;
+    SimConfig config;
+    uint32_t tick = 0;
+    double arrival = 0.0;                  // Local time the tick was complete, on the interpolation clock
+    std::vector<NetEntityState> entities;
+    bool hasShip = false;
+    NetEntityState ship{};
+    uint16_t shipInput = 0;                // Last of our commands the server had applied to ship
+    NetGameEvent standing{};
+};
+
 /**
  * Client class that encapsulates all client functionality.
  * Manages socket connection, network I/O, and user interaction.
@@ -58,15 +115,16 @@ public:
     ~Client() { cleanup(); }
 
     /**
-     * Initialize the client with server connection details
+     * Initialize the client with server connection details and start the network thread
      * @param serverIP The IP address of the server to connect to
      * @param serverPort The port number of the server
+     * @param sendRate Send ticks per second; each sends what the frames since the last one queued
      * @return true if initialization successful, false otherwise
      */
-    bool initialize(const std::string& serverIP, uint16_t serverPort);
+    bool initialize(const std::string& serverIP, uint16_t serverPort, int sendRate = CLIENT_SEND_RATE_DEFAULT);
 
     /**
-     * Run the client in interactive mode - handles user input and network operations
+     * Run the client in interactive mode - hands the ship's state to the network thread. Call once per frame.
      */
     void run();
 
@@ -76,12 +134,133 @@ public:
      */
     void runScript(const std::string& scriptPath);
     void getServerInfo(const std::string& scriptPath, std::string& IP, std::string& port);
+
+    /**
+     * Queue the ship's current state for the server as one binary REQ_SHIP_STATE message
+     */
     void sendToServerUdp();
+
+    /**
+     * Queue the newest input commands for the server as one binary REQ_INPUT message
+     */
+    void sendInputUdp();
+
+    /**
+     * Take in what the network thread received since the last frame. Call once per frame, first.
+     */
+    void pollNetwork();
+
+    /**
+     * Issue one input command per server tick of elapsed time and move the local ship with it,
+     * after correcting the ship from the newest server state. Call once per frame.
+     * @param frameTime Seconds since the previous frame
+     */
+    void updatePrediction(float frameTime);
+
+    /**
+     * Get the local ship as predicted, with any recent correction still being blended out
+     * @return false until the server has reported our ship
+     */
+    bool predictedShip(SimVec2& pos, SimVec2& vel, float& dir) const;
+
+    /**
+     * Copy the newest complete world snapshot received from the server
+     * @param entities Receives the snapshot's entities
+     * @param tick Receives the server tick the snapshot was taken at
+     * @return false if no complete snapshot has arrived yet
+     */
+    bool latestSnapshot(std::vector<NetEntityState>& entities, uint32_t& tick);
+
+    /**
+     * Set how far behind the server remote entities are shown
+     * @param seconds Delay of the interpolation buffer
+     */
+    void setInterpolationDelay(float seconds);
+
+    /**
+     * Sample the world from the interpolation buffer for the current frame
+     * @param entities Receives the entities, interpolated between snapshots
+     * @return false if no complete snapshot has arrived yet
+     */
+    bool interpolatedEntities(std::vector<NetEntityState>& entities);
+
+    /**
+     * Hand the interpolated entities of every other player and the world to the game state.
+     * Call once per frame.
+     */
+    void updateRemoteEntities();
+
+    /**
+     * Ask the server for the list of connected users over the reliable channel
+     */
+    void requestUserList();
+
+    /**
+     * @return The player ID the server assigned, or 0 before the welcome arrives
+     */
+    uint16_t getPlayerId() const { return playerId.load(); }
 private:
-    SOCKET clientSocket = INVALID_SOCKET;  // Socket handle for server connection
-    std::mutex mutex;                      // Mutex for thread synchronization
+    SOCKET clientSocket = INVALID_SOCKET;  // Socket handle for server connection, used only by the network thread
+    std::mutex mutex;                      // Keeps console output from the two threads apart
     std::string serverIP;                  // Server IP address
     uint16_t serverPort;                   // Server port number
+    sockaddr_in serverAddr{};              // Server address, resolved once in resolveAddress
+    std::thread networkThread;             // Owns the socket from initialize to cleanup
+    NetSocketWaiter receiveWaiter;         // Wakes the network thread for datagrams and for cleanup
+    double sendInterval = 1.0 / CLIENT_SEND_RATE_DEFAULT; // Seconds between send ticks, set before the thread starts
+    std::atomic<bool> networkRunning{ false };
+    NetSpscQueue<ClientOutbound> outbound{ CLIENT_OUTBOUND_QUEUE }; // Game loop to network thread
+    NetSpscQueue<ClientInbound> inbound{ CLIENT_INBOUND_QUEUE };    // Network thread to game loop
+    std::atomic<uint16_t> playerId{ 0 };   // Player ID from RSP_WELCOME, 0 until joined; set by the network thread
+
+    // Touched only by the network thread
+    uint16_t ackedSequence = 0;            // Newest ship state the server acknowledged
+    uint16_t serverTickRate = 0;           // Server simulation rate from RSP_WELCOME, 0 until joined
+    SimConfig worldConfig;                 // Server world settings from RSP_WELCOME, which coasting wraps by
+    SimSnapshotRing snapshots;             // Complete ticks, the baselines the server's deltas refer to
+    SimSnapshot pending;                   // Tick being assembled from its parts
+    uint64_t pendingParts = 0;             // Bit per part received so far
+    uint32_t decodedTick = 0;              // Newest complete tick, 0 before any
+    uint64_t decodedTickBits = 0;          // Bit i set if tick decodedTick - 1 - i was complete too
+    ClientInbound decoded;                 // Next item for the game loop; keeps the storage the game loop hands back
+    NetGameEvent heldStanding{};           // Newest standing the inbound queue had no room for
+    bool standingHeld = false;
+    NetReliableChannel reliable;           // Messages that must arrive, both ways
+    NetRateController rate;                // Upstream budget, fed the reliable channel's round trips and resends
+    NetStreamParser consoleStream;         // Echo and user-list messages, buffered until complete
+    // Command buffer: what the frames since the last send tick queued
+    ClientOutbound pendingShip;            // Newest ship state; older ones are stale by the time the tick comes
+    bool shipPending = false;
+    std::vector<ClientOutbound> pendingInputs; // Every input since the last tick, oldest first
+    ClientOutbound lastInput;              // Newest input sent, repeated while no new one comes so acks keep flowing
+    bool hasLastInput = false;
+    // Messages for the server this send tick; flushBundle sends them together
+    char outgoing[NET_BUNDLE_UPLINK_MTU];
+    NetBundleWriter outgoingBundle{ outgoing, sizeof(outgoing) };
+
+    // Touched only by the game loop
+    uint16_t sendSequence = 0;             // Sequence number of the last ship state sent
+    uint16_t inputSequence = 0;            // Sequence number of the newest input command
+    uint8_t recentButtons[NET_INPUT_REDUNDANCY]{}; // Newest commands first, resent with every input
+    uint8_t viewLag = 0;                   // Ticks the shown world trails snapshotTick, sent with every input
+    ClientInbound received;                // Last item taken from the network thread
+    std::vector<NetEntityState> snapshotEntities; // Newest complete snapshot
+    uint32_t snapshotTick = 0;
+    bool hasSnapshot = false;
+    NetEntityState latestShip{};           // Our ship in that snapshot
+    uint16_t latestShipInput = 0;          // Last of our commands the server had applied to it
+    bool shipUpdated = false;              // latestShip is newer than what the predictor has seen
+    SimConfig predictionConfig;            // World settings for the predictor from RSP_WELCOME
+    bool welcomed = false;                 // predictionConfig has arrived
+    SimInterpolationBuffer interpolation;  // Recent snapshots, sampled a little in the past for smooth motion
+
+    // Local ship prediction, touched only by the game loop
+    SimShipPredictor predictor;
+    float commandTime = 0.0f;              // Frame time not yet covered by a command
+    bool firePressed = false;              // Fire was pressed since the last command
+    SimVec2 renderOffset{ 0.0f, 0.0f };    // Correction still being blended out of the shown position
+    float dirOffset = 0.0f;                // Same for the direction
+    std::vector<NetEntityState> remoteEntities; // Entities sampled for the current frame
 
     /**
      * Initialize the Winsock library
@@ -98,7 +277,7 @@ private:
     bool resolveAddress(const std::string& serverIP, uint16_t serverPort);
 
     /**
-     * Create a TCP socket
+     * Create the UDP socket, bound to any local port so it can be waited on before the first send
      * @return true if socket creation successful, false otherwise
      */
     bool createSocket();
@@ -111,10 +290,70 @@ private:
 
     /**
      * Thread function to handle network operations
-     * Continuously receives and processes data from the server
+     * Sleeps until a datagram arrives or a send tick is due, until cleanup wakes it
      */
     void handleNetwork();
 
+    /**
+     * Handle one datagram from the server: a bundle, a single game message or console text
+     * @param data The whole datagram
+     * @param size Size of the datagram in bytes
+     */
+    void handleReceived(const char* data, int size);
+
+    /**
+     * Take one item from the game loop into the command buffer
+     */
+    void handleOutbound(ClientOutbound& item);
+
+    /**
+     * Send the command buffer and the reliable packets that are due, packed together. Called at the send rate.
+     */
+    void sendTick();
+
+    /**
+     * Add one REQ_INPUT message to the tick's bundle, with the newest reliable acknowledgement
+     */
+    void queueInput(ClientOutbound& item);
+
+    /**
+     * Hand an item to the game loop, dropping it if the game loop has fallen that far behind
+     * @return false if it was dropped
+     */
+    bool postInbound(ClientInbound& item);
+
+    /**
+     * Queue the reliable packets that are due, as far as the budget has room
+     */
+    void sendReliable();
+
+    /**
+     * Send the tick's bundle if the upstream budget allows
+     */
+    void flushBundle();
+
+    /**
+     * Apply one RSP_SNAPSHOT part to the tick being assembled and publish the tick once complete
+     * @param payload The message after the header
+     * @param size Size of the payload in bytes
+     */
+    void handleSnapshot(const char* payload, int size);
+
+    /**
+     * Handle one binary game message from the server, alone or from a bundle
+     * @param data The whole message, header included
+     * @param size Size of the message in bytes
+     * @return false if it is not a game message, e.g. text from the console commands
+     */
+    bool handleDatagram(const char* data, int size);
+
+    /**
+     * Take in a reliable packet and handle the messages now in order
+     * @param data The whole packet, header included
+     * @param size Size of the packet in bytes
+     */
+    void handleReliable(const char* data, int size);
+
     /**
      * Process commands from a script file
      * @param scriptPath Path to the script file
@@ -132,12 +371,35 @@ private:
      */
     void sendMessage(const std::vector<uint8_t>& message);
 
+    /**
+     * Hand an item to the network thread, dropping it if the network thread has fallen that far behind
+     */
+    void postOutbound(ClientOutbound& item);
+
+    /**
+     * Add a message to the tick's bundle, sending the bundle first when it is full
+     * @param data The whole message, header included
+     * @param size Size of the message in bytes
+     */
+    void queueOutgoing(const char* data, int size);
+
+    /**
+     * Send the tick's bundle whatever the budget, and charge the budget for it
+     */
+    void sendOutgoing();
+
+    /**
+     * Send one datagram to the server at the cached address
+     */
+    void sendDatagram(const char* data, int size);
+
     /**
      * Process received data from the server
-     * Handles different command types and updates the receive queue
-     * @param recvQueue Vector containing received data that needs processing
+     * Appends it to the console stream and handles every message now complete
+     * @param data Received bytes, which may hold several messages or part of one
+     * @param size Number of bytes
      */
-    void processReceivedData(std::vector<uint8_t>& recvQueue);
+    void processReceivedData(const char* data, int size);
 
     /**
      * Clean up resources (sockets, Winsock) on exit
@@ -32,6 +32,13 @@ void GameStateAsteroidsFree(void);
 void GameStateAsteroidsUnload(void);
 static AEVec2 finalPosition;
 AEVec2 returnPosition();
+AEVec2 returnVelocity();
+float returnDirection();
+void setPredictedShip(AEVec2 position, AEVec2 velocity, float direction);
+void beginRemoteEntities();
+void setRemoteEntity(unsigned int id, unsigned long type, AEVec2 scale, AEVec2 position, AEVec2 velocity, float direction);
+void endRemoteEntities();
+void setPlayerStanding(unsigned long score, long lives);
 // ---------------------------------------------------------------------------
 
 #endif // CSD1130_GAME_STATE_PLAY_H_
@@ -1,34 +1,55 @@
 #include "Client.h"
 #include "AEEngine.h"
 #include "GameState_Asteroids.h"
+#include <algorithm>
+#include <cmath>
+
+// How quickly a corrected prediction catches up with the server, as the time constant of the blend
+constexpr float PREDICTION_SMOOTHING_SECONDS = 0.1f;
+// Corrections further than this are respawns or wraps and jump rather than blend
+constexpr float PREDICTION_SNAP_DISTANCE = 100.0f;
+// Inputs the command buffer holds between send ticks; more than the server queues is of no use
+constexpr size_t PENDING_INPUTS_MAX = SIM_INPUT_QUEUE * NET_INPUT_REDUNDANCY;
+
+// Local clock the interpolation buffer measures snapshot arrivals and frames on, in seconds
+static double interpolationClock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 /**
- * Initialize the client with server connection details
+ * Initialize the client with server connection details and start the network thread
  * @param serverIP The IP address of the server to connect to
  * @param serverPort The port number of the server
+ * @param sendRate Send ticks per second; each sends what the frames since the last one queued
  * @return true if initialization successful, false otherwise
  */
-bool Client::initialize(const std::string& serverIP, uint16_t serverPort) {
+bool Client::initialize(const std::string& serverIP, uint16_t serverPort, int sendRate) {
     this->serverIP = serverIP;     // Store server IP
     this->serverPort = serverPort; // Store server port
+    sendInterval = 1.0 / std::max(1, sendRate);
 
     // Perform initialization steps in sequence
     if (!setupWinsock()) return false;
     if (!resolveAddress(serverIP, serverPort)) return false;
     if (!createSocket()) return false;
    // if (!connectToServer()) return false;
+    if (!receiveWaiter.open(clientSocket)) {
+        std::cerr << "Watching the socket for datagrams failed with error: " << WSAGetLastError() << std::endl;
+        return false;
+    }
+
+    reliable.setRateController(&rate); // Round trips and resends are what the upstream budget adapts to
 
+    // One thread owns the socket for the whole session; the game loop only touches the queues
+    networkRunning.store(true);
+    networkThread = std::thread(&Client::handleNetwork, this);
     return true;
 }
 
 /**
  * Run the client in interactive mode
- * Creates a separate thread for network operations and handles user input
+ * Hands the ship's state to the network thread, which initialize started
  */
 void Client::run() {
-    // Create and detach network handling thread
-    std::thread networkThread(&Client::handleNetwork, this);
-    networkThread.detach();
-
     // Process user input on the main thread
     //handleUserInput();
     sendToServerUdp();//sends a message to the server.
@@ -39,10 +60,6 @@ void Client::run() {
  * @param scriptPath Path to the script file containing commands
  */
 void Client::runScript(const std::string& scriptPath) {
-    // Create and detach network handling thread
-    std::thread networkThread(&Client::handleNetwork, this);
-    networkThread.detach();
-
     // Process script commands
     //handleScript(scriptPath);
     sendToServerUdp();
@@ -63,60 +80,354 @@ void Client::getServerInfo(const std::string& scriptPath,std::string& IP, std::s
     file.close();  // Close the file
 }
 
+/**
+ * Queue the ship's current state for the server as one binary REQ_SHIP_STATE message
+ */
 void Client::sendToServerUdp() {
-
-    ////get position of th ship.
+    // Get the ship's motion from the game state
     AEVec2 position = returnPosition();
+    AEVec2 velocity = returnVelocity();
+
+    // Leaves on the network thread's next send tick
+    ClientOutbound item;
+    item.kind = ClientOutbound::SHIP_STATE;
+    item.sequence = ++sendSequence;
+    item.ship = NetShipState{ position.x, position.y, velocity.x, velocity.y, returnDirection() };
+    postOutbound(item);
+}
 
-   // const std::string message = "Hello World";  // Message to send
-    std::string message = "ship position -> xCoord:" + std::to_string(position.x) + "yCoord: " + std::to_string(position.y);
-    //std::cout << positon_1.c_str() << std::endl;
-    // Prepare the UdpClientData structure
-    UdpClientData udpMessage;
-    ZeroMemory(&udpMessage, sizeof(udpMessage));  // Clear the struct to avoid leftover data
-
-    // Copy the message into the structure using strncpy_s
-    errno_t err = strncpy_s(udpMessage.data, sizeof(udpMessage.data), message.c_str(), message.length());
-    if (err != 0) {
-        std::cerr << "Error copying message to buffer." << std::endl;
-        return;
+/**
+ * Queue the newest input commands for the server as one binary REQ_INPUT message
+ */
+void Client::sendInputUdp() {
+    ClientOutbound item;
+    item.kind = ClientOutbound::INPUT;
+    item.sequence = inputSequence;
+    std::copy(std::begin(recentButtons), std::end(recentButtons), item.input.buttons);
+    item.input.ackTick = hasSnapshot ? snapshotTick : 0; // Lets the server send deltas against that tick
+    item.input.viewLag = viewLag;
+    postOutbound(item);
+}
+
+/**
+ * Hand an item to the network thread, dropping it if the network thread has fallen that far behind
+ */
+void Client::postOutbound(ClientOutbound& item) {
+    // A lost input or ship state is covered by the next one, as if the datagram had been lost
+    outbound.tryPush(item);
+}
+
+/**
+ * Take in what the network thread received since the last frame. Call once per frame, first.
+ */
+void Client::pollNetwork() {
+    while (inbound.tryPop(received)) {
+        if (received.kind == ClientInbound::WELCOME) {
+            predictionConfig = received.config;
+            welcomed = true;
+            predictor.reset(predictionConfig);
+            commandTime = 0.0f;
+            renderOffset = SimVec2{ 0.0f, 0.0f };
+            dirOffset = 0.0f;
+            interpolation.reset(predictionConfig);
+        }
+        else if (received.kind == ClientInbound::SNAPSHOT) {
+            // Swapped, so the old snapshot's storage goes back to the network thread for a later one
+            snapshotEntities.swap(received.entities);
+            snapshotTick = received.tick;
+            hasSnapshot = true;
+            interpolation.push(received.tick, snapshotEntities, received.arrival);
+            if (received.hasShip) {
+                // Our ship after the server applied shipInput; updatePrediction reconciles with it
+                latestShip = received.ship;
+                latestShipInput = received.shipInput;
+                shipUpdated = true;
+            }
+        }
+        else if (received.kind == ClientInbound::STANDING) {
+            setPlayerStanding(received.standing.score, received.standing.lives);
+        }
+    }
+}
+
+/**
+ * Issue one input command per server tick of elapsed time and move the local ship with it
+ * @param frameTime Seconds since the previous frame
+ */
+void Client::updatePrediction(float frameTime) {
+    // Fire is a press, so keep one that falls between two commands
+    if (AEInputCheckTriggered(AEVK_SPACE)) firePressed = true;
+
+    // How far the interpolated world trails the newest snapshot, for the server to rewind our shots by
+    double shown = 0.0;
+    viewLag = 0;
+    if (hasSnapshot && interpolation.shownTick(interpolationClock(), shown) && shown < snapshotTick) {
+        viewLag = static_cast<uint8_t>(std::min(255.0, std::ceil(snapshotTick - shown)));
     }
 
-    // Setup address hints structure
-    addrinfo hints{};
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_INET;        // IPv4
-    hints.ai_socktype = SOCK_DGRAM;  // UDP (use SOCK_DGRAM instead of SOCK_STREAM)
-    hints.ai_protocol = IPPROTO_UDP;  // UDP protocol
+    // Correct from the server's ship that pollNetwork took in, blending the difference out over the next frames
+    if (shipUpdated) {
+        shipUpdated = false;
+        const SimEntity before = predictor.ship();
+        const bool hadShip = predictor.hasShip();
+        float moved = predictor.reconcile(latestShipInput, latestShip);
+        if (hadShip && moved > 0.0f) {
+            const SimEntity& after = predictor.ship();
+            if (moved < PREDICTION_SNAP_DISTANCE) {
+                renderOffset.x += before.pos.x - after.pos.x;
+                renderOffset.y += before.pos.y - after.pos.y;
+                dirOffset = AEWrap(dirOffset + before.dir - after.dir, -PI, PI);
+            }
+            else {
+                renderOffset = SimVec2{ 0.0f, 0.0f };
+                dirOffset = 0.0f;
+            }
+        }
+    }
 
-    // Get address information for the server
-    addrinfo* result = nullptr;
-    if (getaddrinfo(serverIP.c_str(), std::to_string(serverPort).c_str(), &hints, &result) != 0) {
-        std::cerr << "getaddrinfo failed." << std::endl;
-        return;
+    // One command per server tick, at the server's rate whatever the frame rate
+    const float tickSeconds = SimTickSeconds(welcomed ? predictionConfig.tickRate : 60);
+    commandTime = std::min(commandTime + frameTime, tickSeconds * SIM_INPUT_QUEUE); // Do not flood after a stall
+    while (commandTime >= tickSeconds) {
+        commandTime -= tickSeconds;
+
+        uint8_t buttons = 0;
+        if (AEInputCheckCurr(AEVK_UP)) buttons |= SIM_INPUT_UP;
+        if (AEInputCheckCurr(AEVK_DOWN)) buttons |= SIM_INPUT_DOWN;
+        if (AEInputCheckCurr(AEVK_LEFT)) buttons |= SIM_INPUT_LEFT;
+        if (AEInputCheckCurr(AEVK_RIGHT)) buttons |= SIM_INPUT_RIGHT;
+        if (firePressed) buttons |= SIM_INPUT_FIRE;
+        firePressed = false;
+
+        std::copy_backward(std::begin(recentButtons), std::end(recentButtons) - 1, std::end(recentButtons));
+        recentButtons[0] = buttons;
+        predictor.apply(++inputSequence, buttons);
+        sendInputUdp();
     }
 
-    // Fill in the clientAddr in the structure
-    udpMessage.clientAddr = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    const float keep = std::exp(-frameTime / PREDICTION_SMOOTHING_SECONDS);
+    renderOffset.x *= keep;
+    renderOffset.y *= keep;
+    dirOffset *= keep;
+}
 
-    // Send message to the server using the pre-existing socket
-    int sendResult = sendto(clientSocket, udpMessage.data, strlen(udpMessage.data), 0,
-        reinterpret_cast<sockaddr*>(&udpMessage.clientAddr), sizeof(udpMessage.clientAddr));
+/**
+ * Get the local ship as predicted, with any recent correction still being blended out
+ * @return false until the server has reported our ship
+ */
+bool Client::predictedShip(SimVec2& pos, SimVec2& vel, float& dir) const {
+    if (!predictor.hasShip()) return false;
+    const SimEntity& ship = predictor.ship();
+    pos = SimVec2{ ship.pos.x + renderOffset.x, ship.pos.y + renderOffset.y };
+    vel = ship.vel;
+    dir = AEWrap(ship.dir + dirOffset, -PI, PI);
+    return true;
+}
 
-    if (sendResult == SOCKET_ERROR) {
-        std::cerr << "Send failed with error: " << WSAGetLastError() << std::endl;
+/**
+ * Copy the newest complete world snapshot received from the server
+ * @param entities Receives the snapshot's entities
+ * @param tick Receives the server tick the snapshot was taken at
+ * @return false if no complete snapshot has arrived yet
+ */
+bool Client::latestSnapshot(std::vector<NetEntityState>& entities, uint32_t& tick) {
+    if (!hasSnapshot) return false;
+    entities.assign(snapshotEntities.begin(), snapshotEntities.end());
+    tick = snapshotTick;
+    return true;
+}
+
+/**
+ * Set how far behind the server remote entities are shown
+ * @param seconds Delay of the interpolation buffer
+ */
+void Client::setInterpolationDelay(float seconds) {
+    interpolation.setDelay(seconds);
+}
+
+/**
+ * Sample the world from the interpolation buffer for the current frame
+ * @param entities Receives the entities, interpolated between snapshots
+ * @return false if no complete snapshot has arrived yet
+ */
+bool Client::interpolatedEntities(std::vector<NetEntityState>& entities) {
+    return interpolation.sample(interpolationClock(), entities);
+}
+
+/**
+ * Hand the interpolated entities of every other player and the world to the game state.
+ * Our own ship is left to the prediction.
+ */
+void Client::updateRemoteEntities() {
+    if (!interpolatedEntities(remoteEntities)) return;
+
+    const uint16_t self = playerId.load();
+    beginRemoteEntities();
+    for (const NetEntityState& entity : remoteEntities) {
+        if (entity.type == SIM_SHIP && entity.owner == self) continue;
+        SimVec2 scale = SimScaleOf(entity.type, entity.scaleClass);
+        setRemoteEntity(entity.id, entity.type, AEVec2{ scale.x, scale.y },
+            AEVec2{ entity.posX, entity.posY }, AEVec2{ entity.velX, entity.velY }, entity.dir);
     }
-    else {
-        std::cout << "Message sent: " << udpMessage.data << std::endl;
+    endRemoteEntities();
+}
+
+/**
+ * Ask the server for the list of connected users over the reliable channel
+ */
+void Client::requestUserList() {
+    ClientOutbound item;
+    item.kind = ClientOutbound::RELIABLE_MESSAGE;
+    item.message.assign(1, static_cast<char>(REQ_LISTUSERS));
+    if (!outbound.tryPush(item)) {
+        std::cerr << "Too many messages waiting for the network thread, user list not requested." << std::endl;
     }
+}
 
-    // Clean up
-    freeaddrinfo(result);  // Free the address info as it's no longer needed
+/**
+ * Take one item from the game loop into the command buffer
+ */
+void Client::handleOutbound(ClientOutbound& item) {
+    if (item.kind == ClientOutbound::SHIP_STATE) {
+        std::swap(pendingShip, item);
+        shipPending = true;
+    }
+    else if (item.kind == ClientOutbound::INPUT) {
+        if (pendingInputs.size() == PENDING_INPUTS_MAX) {
+            pendingInputs.erase(pendingInputs.begin()); // The server could no longer use the oldest
+        }
+        pendingInputs.push_back(item);
+    }
+    else if (item.kind == ClientOutbound::RELIABLE_MESSAGE) {
+        if (!reliable.queue(item.message.data(), static_cast<int>(item.message.size()))) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cerr << "Too many messages waiting for the server, message dropped." << std::endl;
+        }
+    }
 }
 
+/**
+ * Send the command buffer and the reliable packets that are due, packed together. Called at the send rate.
+ */
+void Client::sendTick() {
+    if (shipPending) {
+        char message[NET_HEADER_SIZE + NET_SHIP_STATE_SIZE];
+        int size = NetEncodeShipMessage(message, sizeof(message), REQ_SHIP_STATE, pendingShip.sequence, pendingShip.ship);
+        queueOutgoing(message, size);
+        shipPending = false;
+    }
+
+    // Each input repeats the NET_INPUT_REDUNDANCY commands before it, so every one of that many back from the
+    // newest covers all the commands since the last tick. With nothing new, the newest goes again for its acks.
+    if (!pendingInputs.empty()) {
+        const size_t count = pendingInputs.size();
+        for (size_t i = (count - 1) % NET_INPUT_REDUNDANCY; i < count; i += NET_INPUT_REDUNDANCY) {
+            lastInput = pendingInputs[i];
+            queueInput(lastInput);
+        }
+        hasLastInput = true;
+        pendingInputs.clear();
+    }
+    else if (hasLastInput) {
+        queueInput(lastInput);
+    }
+
+    sendReliable();
+    flushBundle();
+}
+
+/**
+ * Add one REQ_INPUT message to the tick's bundle, with the newest reliable acknowledgement
+ */
+void Client::queueInput(ClientOutbound& item) {
+    item.input.reliableAck = reliable.writeAck(); // Acknowledges the server's reliable packets for free
+    // The ticks complete before the acknowledged one, so the server does not take the snapshots sent
+    // between two send ticks for lost
+    const uint32_t back = decodedTick - item.input.ackTick;
+    item.input.ackTickBits = item.input.ackTick == 0 || back >= 64 ? 0 : static_cast<uint32_t>(decodedTickBits >> back);
+    char message[NET_HEADER_SIZE + NET_INPUT_SIZE];
+    int size = NetWriteHeader(message, sizeof(message), NetHeader{ REQ_INPUT, NET_PROTOCOL_VERSION, item.sequence });
+    size += NetWriteInput(message + size, sizeof(message) - size, item.input);
+    queueOutgoing(message, size);
+}
 
+/**
+ * Hand an item to the game loop, dropping it if the game loop has fallen that far behind
+ * @return false if it was dropped
+ */
+bool Client::postInbound(ClientInbound& item) {
+    // Only a game loop stalled for a whole queue, e.g. while its window is dragged, loses anything.
+    // A snapshot is superseded by the next tick, and the welcome comes first, into an empty queue.
+    return inbound.tryPush(item);
+}
 
+/**
+ * Queue the reliable packets that are due, as far as the budget has room
+ */
+void Client::sendReliable() {
+    char packet[NET_RELIABLE_PACKET_MAX];
+    const double now = NetClockSeconds();
+    // Packets the budget has no room for wait for a later tick
+    double budget = rate.available(now);
+    int size;
+    while (budget > 0.0 && (size = reliable.writePacket(now, packet, sizeof(packet))) > 0) {
+        queueOutgoing(packet, size);
+        budget -= size;
+    }
+}
 
+/**
+ * Send the tick's bundle if the upstream budget allows
+ */
+void Client::flushBundle() {
+    // On a link that cannot keep up the tick's messages wait, and the next tick's join them,
+    // rather than queueing in the socket
+    if (outgoingBundle.count() == 0 || !rate.allows(NetClockSeconds(), outgoingBundle.size())) return;
+    sendOutgoing();
+}
+
+/**
+ * Send the tick's bundle whatever the budget, and charge the budget for it
+ */
+void Client::sendOutgoing() {
+    if (outgoingBundle.count() == 0) return;
+    rate.spend(outgoingBundle.size());
+    if (outgoingBundle.count() == 1) {
+        // A bundle of one would only add its framing
+        sendDatagram(outgoing + NET_HEADER_SIZE + NET_BUNDLE_PREFIX_SIZE,
+            outgoingBundle.size() - NET_HEADER_SIZE - NET_BUNDLE_PREFIX_SIZE);
+    }
+    else if (outgoingBundle.count() > 1) {
+        sendDatagram(outgoingBundle.data(), outgoingBundle.size());
+    }
+    outgoingBundle.reset();
+}
+
+/**
+ * Add a message to the tick's bundle, sending the bundle first when it is full
+ * @param data The whole message, header included
+ * @param size Size of the message in bytes
+ */
+void Client::queueOutgoing(const char* data, int size) {
+    if (outgoingBundle.add(data, size)) return;
+    sendOutgoing(); // Full; the budget is paid back on the following ticks
+    if (!outgoingBundle.add(data, size)) {
+        rate.spend(size);
+        sendDatagram(data, size); // Too big to share a datagram
+    }
+}
+
+/**
+ * Send one datagram to the server at the cached address
+ */
+void Client::sendDatagram(const char* data, int size) {
+    int sendResult = sendto(clientSocket, data, size, 0,
+        reinterpret_cast<sockaddr*>(&serverAddr), sizeof(serverAddr));
+    if (sendResult == SOCKET_ERROR) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cerr << "Send failed with error: " << WSAGetLastError() << std::endl;
+    }
+}
 
 /**
  * Initialize the Winsock library
@@ -151,14 +462,15 @@ bool Client::resolveAddress(const std::string& serverIP, uint16_t serverPort) {
         return false;
     }
 
-    // Free the address info as we're just testing resolution
+    // Keep the address so sending does not resolve it again every frame
+    serverAddr = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
     freeaddrinfo(result);
     return true;
 }
 
 
 /**
- * Create a TCP socket
+ * Create the UDP socket, bound to any local port so it can be waited on before the first send
  * @return true if socket creation successful, false otherwise
  */
 bool Client::createSocket() {
@@ -168,6 +480,18 @@ bool Client::createSocket() {
         WSACleanup();
         return false;
     }
+
+    sockaddr_in localAddr{};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    localAddr.sin_port = 0;
+    if (bind(clientSocket, reinterpret_cast<sockaddr*>(&localAddr), sizeof(localAddr)) == SOCKET_ERROR) {
+        std::cerr << "bind() failed with error: " << WSAGetLastError() << std::endl;
+        closesocket(clientSocket);
+        clientSocket = INVALID_SOCKET;
+        WSACleanup();
+        return false;
+    }
     return true;
 }
 
@@ -202,43 +526,261 @@ bool Client::connectToServer() {
 
 /**
  * Thread function to handle network operations
- * Continuously receives and processes data from the server
+ * Sleeps until a datagram arrives or a send tick is due, until cleanup wakes it
  */
 void Client::handleNetwork() {
-    std::vector<uint8_t> recvQueue;  // Buffer for incoming data
     sockaddr_in serverAddr{};        // Store server's address
     int addrSize = sizeof(serverAddr);
-
-    while (true) {
-        char recvBuffer[1024];  // Temporary buffer for received data
-        int receivedBytes = recvfrom(clientSocket, recvBuffer, sizeof(recvBuffer), 0,
-            (sockaddr*)&serverAddr, &addrSize);
-
-        if (receivedBytes == SOCKET_ERROR) {
-            int errorCode = WSAGetLastError();
-            if (errorCode == WSAEWOULDBLOCK) {
-                // Non-blocking operation would block, try again later
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+    ClientOutbound item;             // Reused, so reliable messages hand their storage back to the game loop
+    double nextSend = NetClockSeconds();
+
+    // Room for a whole world and a full command buffer, so neither allocates as it runs
+    decoded.entities.reserve(SIM_ENTITY_MAX);
+    pendingInputs.reserve(PENDING_INPUTS_MAX);
+
+    while (networkRunning.load()) {
+        // Everything the game loop queued since the last pass, in order
+        while (outbound.tryPop(item)) {
+            if (item.kind == ClientOutbound::QUIT) {
+                // Lets the server drop our ship now rather than when the session times out
+                const char quit = static_cast<char>(REQ_QUIT);
+                sendDatagram(&quit, 1);
+                return;
             }
-            // Other error occurred
+            handleOutbound(item);
+        }
+
+        // Send at a steady rate whatever the frame rate, and on through a stalled frame
+        double now = NetClockSeconds();
+        if (now >= nextSend) {
+            sendTick();
+            nextSend += sendInterval;
+            if (nextSend < now) nextSend = now + sendInterval; // Fell behind; do not send a burst to catch up
+        }
+        if (standingHeld) {
+            decoded.kind = ClientInbound::STANDING;
+            decoded.standing = heldStanding;
+            standingHeld = !postInbound(decoded);
+        }
+
+        // Sleep until the server sends something or the next send tick; the game loop's queue is
+        // only needed then, so it never has to wake us
+        now = NetClockSeconds();
+        const int waitMs = static_cast<int>(std::ceil(std::max(0.0, nextSend - now) * 1000.0));
+        const NetWaitResult result = receiveWaiter.wait(waitMs);
+        if (result == NET_WAIT_ERROR) {
             std::lock_guard<std::mutex> lock(mutex);
-            std::cerr << "recvfrom() failed with error: " << errorCode << std::endl;
-            break;
+            std::cerr << "Waiting for datagrams failed with error: " << WSAGetLastError() << std::endl;
+            std::this_thread::sleep_for(std::chrono::duration<double>(sendInterval));
+            continue;
+        }
+        if (result != NET_WAIT_READABLE) continue;
+
+        // Everything queued in the socket, so one wakeup handles a whole burst of snapshot parts
+        while (true) {
+            char recvBuffer[2048];  // Temporary buffer for received data, larger than any snapshot part
+            addrSize = sizeof(serverAddr);
+            int receivedBytes = recvfrom(clientSocket, recvBuffer, sizeof(recvBuffer), 0,
+                (sockaddr*)&serverAddr, &addrSize);
+
+            if (receivedBytes == SOCKET_ERROR) {
+                int errorCode = WSAGetLastError();
+                if (!NetWouldBlock(errorCode)) {
+                    // Other error occurred, e.g. the server's port was unreachable; keep going, it may come back
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cerr << "recvfrom() failed with error: " << errorCode << std::endl;
+                }
+                break;
+            }
+            handleReceived(recvBuffer, receivedBytes);
         }
 
-        // Print out the message received from the server
-        std::cout << "Received message from server: " << std::string(recvBuffer, recvBuffer + receivedBytes) << std::endl;
+        //// Optionally hand received data to the console stream (if needed for future processing)
+        //processReceivedData(recvBuffer, receivedBytes);
+    }
+}
+
+/**
+ * Handle one datagram from the server: a bundle, a single game message or console text
+ * @param data The whole datagram
+ * @param size Size of the datagram in bytes
+ */
+void Client::handleReceived(const char* data, int size) {
+    // A bundle's messages are handled in place, in the order the server queued them
+    if (size > 0 && static_cast<uint8_t>(data[0]) == BUNDLE) {
+        NetBundleReader reader{ data, size };
+        const char* message;
+        int messageSize;
+        while (reader.next(message, messageSize)) {
+            if (!handleDatagram(message, messageSize)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cout << "Received message from server: " << std::string(message, message + messageSize) << std::endl;
+            }
+        }
+        return;
+    }
+    if (handleDatagram(data, size)) return;
 
-        //// Optionally add received data to the processing queue (if needed for future processing)
-        //recvQueue.insert(recvQueue.end(), recvBuffer, recvBuffer + receivedBytes);
+    // Print out the message received from the server
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "Received message from server: " << std::string(data, data + size) << std::endl;
+}
 
-        //// Process received data if needed
-        //processReceivedData(recvQueue);
+/**
+ * Handle one binary game message from the server, alone or from a bundle
+ * @param data The whole message, header included
+ * @param size Size of the message in bytes
+ * @return false if it is not a game message, e.g. text from the console commands
+ */
+bool Client::handleDatagram(const char* data, int size) {
+    NetHeader header{};
+    if (!NetReadHeader(data, size, header)) return false;
+    const char* payload = data + NET_HEADER_SIZE;
+    int payloadSize = size - NET_HEADER_SIZE;
+
+    if (header.commandId == RSP_SHIP_STATE) {
+        // Remember the newest acknowledged ship state
+        if (NetSequenceNewer(header.sequence, ackedSequence)) {
+            ackedSequence = header.sequence;
+        }
+        return true;
     }
+    if (header.commandId == RSP_WELCOME) {
+        NetWelcome welcome{};
+        if (NetReadWelcome(payload, payloadSize, welcome)) {
+            worldConfig = SimConfig{ welcome.tickRate,
+                static_cast<float>(welcome.worldWidth), static_cast<float>(welcome.worldHeight) };
+            serverTickRate = welcome.tickRate;
+            playerId.store(welcome.playerId); // Set here, so the snapshots right behind it find our ship
+            decoded.kind = ClientInbound::WELCOME;
+            decoded.config = worldConfig;
+            postInbound(decoded);
+        }
+        return true;
+    }
+    if (header.commandId == RSP_SNAPSHOT) {
+        handleSnapshot(payload, payloadSize);
+        return true;
+    }
+    if (header.commandId == RELIABLE) {
+        handleReliable(data, size);
+        return true;
+    }
+    return false;
 }
 
 
+/**
+ * Take in a reliable packet and handle the messages now in order
+ * @param data The whole packet, header included
+ * @param size Size of the packet in bytes
+ */
+void Client::handleReliable(const char* data, int size) {
+    if (!reliable.readPacket(NetClockSeconds(), data, size)) return;
+    std::vector<char> message;
+    while (reliable.receive(message)) {
+        NetGameEvent event{};
+        if (!message.empty() && static_cast<uint8_t>(message[0]) == RSP_GAME_EVENT &&
+            NetReadGameEvent(message.data() + 1, static_cast<int>(message.size()) - 1, event)) {
+            decoded.kind = ClientInbound::STANDING; // The game loop hands it to the game state
+            decoded.standing = event;
+            if (!postInbound(decoded)) {
+                heldStanding = event; // Sent only once, so it waits for room rather than being dropped
+                standingHeld = true;
+            }
+            continue;
+        }
+
+        // Everything else is one of the console replies; processReceivedData takes the lock itself
+        processReceivedData(message.data(), static_cast<int>(message.size()));
+    }
+}
+
+/**
+ * Apply one RSP_SNAPSHOT part to the tick being assembled and publish the tick once complete
+ * @param payload The message after the header
+ * @param size Size of the payload in bytes
+ */
+void Client::handleSnapshot(const char* payload, int size) {
+    NetSnapshotInfo info{};
+    if (serverTickRate == 0 || !NetReadSnapshotInfo(payload, size, info) || info.partCount == 0 ||
+        info.partCount > 64 || info.part >= info.partCount) {
+        return;
+    }
+    payload += NET_SNAPSHOT_INFO_SIZE;
+    size -= NET_SNAPSHOT_INFO_SIZE;
+    reliable.readAck(NetClockSeconds(), info.reliableAck);
+
+    // Parts of an older tick arrived late; the newer tick has replaced it
+    if (pendingParts != 0 && info.tick != pending.tick) {
+        if (static_cast<int32_t>(info.tick - pending.tick) < 0) return;
+        pendingParts = 0;
+    }
+    if (pendingParts == 0) {
+        // Never go back to a tick older than the one already shown
+        if (decodedTick != 0 && static_cast<int32_t>(info.tick - decodedTick) <= 0) return;
+
+        // Start from the baseline predicted as the server did, or from nothing for a full snapshot
+        if (info.baseTick != 0) {
+            const SimSnapshot* baseline = snapshots.find(info.baseTick);
+            if (baseline == nullptr) return; // Evicted; the server sends in full once our ack is too old
+            SimSnapshotPredict(*baseline, info.tick, worldConfig, pending);
+        }
+        else {
+            pending.tick = info.tick;
+            for (SimSnapshotEntity& entity : pending.entities) entity.active = false;
+        }
+    }
+
+    uint64_t bit = uint64_t{ 1 } << info.part;
+    if (pendingParts & bit) return;  // Duplicate datagram
+    pendingParts |= bit;
+
+    NetBitReader reader{ payload, size };
+    for (uint16_t i = 0; i < info.entityCount; ++i) {
+        uint8_t mask = 0;
+        NetEntityState delta{};
+        if (!NetReadEntityDelta(reader, mask, delta) || delta.id >= pending.entities.size()) {
+            pendingParts = 0; // Malformed; give up on this tick
+            return;
+        }
+        SimSnapshotApply(pending.entities[delta.id], mask, delta);
+    }
+
+    // All parts are in: keep the tick as a baseline and hand it to the game loop
+    uint64_t allParts = info.partCount == 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << info.partCount) - 1;
+    if (pendingParts == allParts) {
+        SimSnapshot& complete = snapshots.push(info.tick);
+        complete.entities.swap(pending.entities);
+        pendingParts = 0;
+        if (decodedTick != 0) {
+            const uint32_t shift = info.tick - decodedTick; // At least 1
+            uint64_t bits = shift >= 64 ? 0 : decodedTickBits << shift;
+            if (shift <= 64) bits |= uint64_t{ 1 } << (shift - 1); // The previous newest
+            decodedTickBits = bits;
+        }
+        decodedTick = info.tick;
+
+        const uint16_t self = playerId.load();
+        decoded.kind = ClientInbound::SNAPSHOT;
+        decoded.tick = info.tick;
+        decoded.arrival = interpolationClock();
+        decoded.hasShip = false;
+        decoded.entities.clear();
+        for (const SimSnapshotEntity& entity : complete.entities) {
+            if (!entity.active) continue;
+            decoded.entities.push_back(entity.state);
+            if (entity.state.type == SIM_SHIP && entity.state.owner == self) {
+                // Our ship after the server applied inputSequence; the game loop reconciles with it
+                decoded.ship = entity.state;
+                decoded.shipInput = info.inputSequence;
+                decoded.hasShip = true;
+            }
+        }
+        postInbound(decoded);
+    }
+}
+
 /**
  * Process commands from a script file
  * @param scriptPath Path to the script file
@@ -355,9 +897,10 @@ void Client::handleUserInput() {
             sendMessage(msg);
             break;
         }
-        // Handle list users command
+        // Handle list users command; the reply must not be lost, so it goes over the reliable channel
         else if (input.substr(0, 2) == "/l") {
-            msg.push_back(REQ_LISTUSERS);
+            requestUserList();
+            continue;
         }
         // Handle echo command - sends message to specific IP:port
         else if (input.substr(0, 3) == "/e ") {
@@ -431,147 +974,81 @@ void Client::sendMessage(const std::vector<uint8_t>& message) {
 
 /**
  * Process received data from the server
- * Handles different command types and updates the receive queue
- * @param recvQueue Vector containing received data that needs processing
+ * Appends it to the console stream and handles every message now complete
+ * @param data Received bytes, which may hold several messages or part of one
+ * @param size Number of bytes
  */
-void Client::processReceivedData(std::vector<uint8_t>& recvQueue) {
-    while (!recvQueue.empty()) {
-        if (recvQueue.size() < 1) break;
-
-        // Get command ID (first byte)
-        uint8_t commandId = recvQueue[0];
+void Client::processReceivedData(const char* data, int size) {
+    consoleStream.append(data, static_cast<size_t>(size));
 
+    NetStreamMessage message;
+    while (consoleStream.next(message)) {
         // Handle echo request from another client
-        if (commandId == REQ_ECHO) {
-            // Check if we have enough data to process (header + at least part of message)
-            if (recvQueue.size() >= 11) {
-                // Extract source IP, port, and message length
-                uint32_t sourceIp = *reinterpret_cast<uint32_t*>(&recvQueue[1]);
-                uint16_t sourcePort = ntohs(*reinterpret_cast<uint16_t*>(&recvQueue[5])); // Convert to host order
-                uint32_t messageLength = ntohl(*reinterpret_cast<uint32_t*>(&recvQueue[7])); // Convert to host order
-                size_t packetSize = 11 + messageLength;
-
-                // Check if the complete message has been received
-                if (recvQueue.size() >= packetSize) {
-                    // Extract message content
-                    std::string message(recvQueue.begin() + 11, recvQueue.begin() + 11 + messageLength);
-
-                    // Convert source IP to string representation
-                    char sourceIpStr[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &sourceIp, sourceIpStr, INET_ADDRSTRLEN);
-
-                    // Display received message
-                    std::lock_guard<std::mutex> lock(mutex);
-                    std::cout << "==========RECV START==========" << std::endl;
-                    std::cout << sourceIpStr << ":" << sourcePort << std::endl; // Sender's IP:port
-                    std::cout << message << std::endl; // Raw message
-                    std::cout << "==========RECV END==========" << std::endl;
-
-                    // Send RSP_ECHO with sender's IP:port and original message
-                    std::vector<uint8_t> responsePacket;
-                    responsePacket.push_back(RSP_ECHO);
-                    responsePacket.insert(responsePacket.end(), reinterpret_cast<uint8_t*>(&sourceIp), reinterpret_cast<uint8_t*>(&sourceIp) + 4);
-                    uint16_t sourcePortNet = htons(sourcePort); // Convert to network order
-                    responsePacket.insert(responsePacket.end(), reinterpret_cast<uint8_t*>(&sourcePortNet), reinterpret_cast<uint8_t*>(&sourcePortNet) + 2);
-                    uint32_t messageLengthNet = htonl(messageLength);
-                    responsePacket.insert(responsePacket.end(), reinterpret_cast<uint8_t*>(&messageLengthNet), reinterpret_cast<uint8_t*>(&messageLengthNet) + 4);
-                    responsePacket.insert(responsePacket.end(), message.begin(), message.end());
-
-                    // Send the response
-                    send(clientSocket, reinterpret_cast<const char*>(responsePacket.data()), static_cast<int>(responsePacket.size()), 0);
-
-                    // Remove processed data from queue
-                    recvQueue.erase(recvQueue.begin(), recvQueue.begin() + packetSize);
-                    continue;
-                }
+        if (message.commandId == REQ_ECHO) {
+            // Convert source IP to string representation
+            uint32_t sourceIp = message.echoIp();
+            char sourceIpStr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &sourceIp, sourceIpStr, INET_ADDRSTRLEN);
+
+            // Display received message
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cout << "==========RECV START==========" << std::endl;
+                std::cout << sourceIpStr << ":" << message.echoPort() << std::endl; // Sender's IP:port
+                std::cout.write(message.echoText(), message.echoTextSize()) << std::endl; // Raw message
+                std::cout << "==========RECV END==========" << std::endl;
             }
-            break; // Not enough data yet, wait for more
+
+            // Send RSP_ECHO with sender's IP:port and original message; only the command ID differs
+            std::vector<char> responsePacket(message.data, message.data + message.size);
+            responsePacket[0] = static_cast<char>(RSP_ECHO);
+            send(clientSocket, responsePacket.data(), static_cast<int>(responsePacket.size()), 0);
         }
 
         // Handle echo response from server or another client
-        else if (commandId == RSP_ECHO) {
-            // Check if we have enough data to process
-            if (recvQueue.size() >= 11) {
-                // Extract source IP, port, and message length
-                uint32_t sourceIp = *reinterpret_cast<uint32_t*>(&recvQueue[1]);
-                uint16_t sourcePort = ntohs(*reinterpret_cast<uint16_t*>(&recvQueue[5])); // Convert to host order
-                uint32_t messageLength = ntohl(*reinterpret_cast<uint32_t*>(&recvQueue[7])); // Convert to host order
-                size_t packetSize = 11 + messageLength;
-
-                // Check if the complete message has been received
-                if (recvQueue.size() >= packetSize) {
-                    // Extract message content
-                    std::string message(recvQueue.begin() + 11, recvQueue.begin() + 11 + messageLength);
-
-                    // Convert source IP to string representation
-                    char sourceIpStr[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &sourceIp, sourceIpStr, INET_ADDRSTRLEN);
-
-                    // Display received echo response
-                    std::lock_guard<std::mutex> lock(mutex);
-                    std::cout << "==========RECV START==========" << std::endl;
-                    std::cout << sourceIpStr << ":" << sourcePort << std::endl; // Responder's IP:port
-                    std::cout << message << std::endl; // Raw message
-                    std::cout << "==========RECV END==========" << std::endl;
-
-                    // Remove processed data from queue
-                    recvQueue.erase(recvQueue.begin(), recvQueue.begin() + packetSize);
-                    continue;
-                }
-            }
-            break; // Not enough data yet, wait for more
+        else if (message.commandId == RSP_ECHO) {
+            // Convert source IP to string representation
+            uint32_t sourceIp = message.echoIp();
+            char sourceIpStr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &sourceIp, sourceIpStr, INET_ADDRSTRLEN);
+
+            // Display received echo response
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cout << "==========RECV START==========" << std::endl;
+            std::cout << sourceIpStr << ":" << message.echoPort() << std::endl; // Responder's IP:port
+            std::cout.write(message.echoText(), message.echoTextSize()) << std::endl; // Raw message
+            std::cout << "==========RECV END==========" << std::endl;
         }
 
         // Handle response with list of connected users
-        else if (commandId == RSP_LISTUSERS) {
-            // Check if we have the header (command + user count)
-            if (recvQueue.size() >= 3) {
-                // Extract number of users
-                uint16_t totalUsers = ntohs(*reinterpret_cast<uint16_t*>(&recvQueue[1]));
-                size_t expectedPacketSize = 3 + (totalUsers * 6); // Header + (IP+port)*users
-
-                // Check if we have the complete packet
-                if (recvQueue.size() >= expectedPacketSize) {
-                    // Display list of users
-                    std::lock_guard<std::mutex> lock(mutex);
-                    std::cout << "==========RECV START==========" << std::endl;
-                    std::cout << "Users:" << std::endl;
-
-                    // Process each user entry (IP + port)
-                    for (size_t i = 0; i < totalUsers; ++i) {
-                        uint32_t userIp = *reinterpret_cast<uint32_t*>(&recvQueue[3 + i * 6]);
-                        uint16_t userPort = ntohs(*reinterpret_cast<uint16_t*>(&recvQueue[7 + i * 6]));
-
-                        // Convert IP to string representation
-                        char userIpStr[INET_ADDRSTRLEN];
-                        inet_ntop(AF_INET, &userIp, userIpStr, INET_ADDRSTRLEN);
+        else if (message.commandId == RSP_LISTUSERS) {
+            // Display list of users
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cout << "==========RECV START==========" << std::endl;
+            std::cout << "Users:" << std::endl;
 
-                        std::cout << userIpStr << ":" << userPort << std::endl;
-                    }
+            // Process each user entry (IP + port)
+            for (uint16_t i = 0; i < message.userCount(); ++i) {
+                uint32_t userIp;
+                uint16_t userPort;
+                message.user(i, userIp, userPort);
 
-                    std::cout << "==========RECV END==========" << std::endl;
+                // Convert IP to string representation
+                char userIpStr[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &userIp, userIpStr, INET_ADDRSTRLEN);
 
-                    // Remove processed data from queue
-                    recvQueue.erase(recvQueue.begin(), recvQueue.begin() + expectedPacketSize);
-                    continue;
-                }
+                std::cout << userIpStr << ":" << userPort << std::endl;
             }
-            break; // Not enough data yet, wait for more
+
+            std::cout << "==========RECV END==========" << std::endl;
         }
 
         // Handle echo error response
-        else if (commandId == ECHO_ERROR) {
+        else if (message.commandId == ECHO_ERROR) {
             std::lock_guard<std::mutex> lock(mutex);
             std::cout << "Echo error" << std::endl;
-            recvQueue.erase(recvQueue.begin(), recvQueue.begin() + 1);
-            continue;
-        }
-
-        // Handle unknown command - discard the byte
-        else {
-            recvQueue.erase(recvQueue.begin(), recvQueue.begin() + 1);
-            continue;
         }
+        // Unknown bytes never come out of the parser; it skips them to the next known command
     }
 }
 
@@ -579,9 +1056,21 @@ void Client::processReceivedData(std::vector<uint8_t>& recvQueue) {
  * Clean up resources (sockets, Winsock) on exit
  */
 void Client::cleanup() {
+    // Stop the network thread first, waking it from its wait. It says goodbye to the server on the way
+    // out; only if the queue is full does it stop without.
+    if (networkThread.joinable()) {
+        ClientOutbound quit;
+        quit.kind = ClientOutbound::QUIT;
+        if (!outbound.tryPush(quit)) networkRunning.store(false);
+        receiveWaiter.wake();
+        networkThread.join();
+    }
+    networkRunning.store(false);
+    receiveWaiter.close();
     // Close socket if valid
     if (clientSocket != INVALID_SOCKET) {
         closesocket(clientSocket);
+        clientSocket = INVALID_SOCKET;
     }
     // Clean up Winsock
     WSACleanup();
@@ -74,6 +74,9 @@ enum TYPE
 // object flag definition
 
 const unsigned long FLAG_ACTIVE				= 0x00000001;
+const unsigned long FLAG_REMOTE				= 0x00000002;	// Instance shows an entity of the server's world
+
+const unsigned int	REMOTE_ENTITY_NUM_MAX	= 2048;			// The number of entity ids the server uses
 
 /******************************************************************************/
 /*!
@@ -135,6 +138,21 @@ static long					sShipLives;									// The number of lives left
 // the score = number of asteroid destroyed
 static unsigned long		sScore;										// Current score
 
+// last ship motion, reported to the server alongside finalPosition
+static AEVec2				sFinalVelocity;								// Ship velocity at the end of the last update
+static float				sFinalDirection;							// Ship direction at the end of the last update
+
+// ship motion predicted by the client from the server's simulation, see setPredictedShip
+static bool					sShipPredicted;								// Whether the ship follows the prediction instead of the keys
+static AEVec2				sPredictedPosition;
+static AEVec2				sPredictedVelocity;
+static float				sPredictedDirection;
+
+// Instances showing the server's entities, indexed by entity id
+static GameObjInst *		sRemoteInstList[REMOTE_ENTITY_NUM_MAX];
+static bool					sRemoteSeen[REMOTE_ENTITY_NUM_MAX];			// Whether the entity was set since beginRemoteEntities
+static bool					sNetworked;									// Whether the server's world replaces the local asteroids and bullets
+
 // ---------------------------------------------------------------------------
 
 // functions to create/destroy a game object instance
@@ -295,6 +313,11 @@ void GameStateAsteroidsInit(void)
 	// reset the score and the number of ships
 	sScore      = 0;
 	sShipLives  = SHIP_INITIAL_NUM;
+	sShipPredicted = false;
+
+	for (unsigned int i = 0; i < REMOTE_ENTITY_NUM_MAX; ++i)
+		sRemoteInstList[i] = nullptr;
+	sNetworked = false;
 }
 
 /******************************************************************************/
@@ -326,47 +349,55 @@ void GameStateAsteroidsUpdate(void)
 	
 	if (!(sScore >= 5000)) {
 		if (!(sShipLives < 0)) {
-			if (AEInputCheckCurr(AEVK_UP)) // Moving forward
+			if (sShipPredicted) // The client moves the ship as the server does; take its velocity and direction
 			{
-				AEVec2 added, newVel{}, newPos{};
-				AEVec2Set(&added, cosf(spShip->dirCurr), sinf(spShip->dirCurr)); // Creating vector of the direction of the acceleration.
-				AEVec2Normalize(&added, &added); // Normalizing the vector
-				added.x *= SHIP_ACCEL_FORWARD; // * Acceleration
-				added.y *= SHIP_ACCEL_FORWARD; // * Acceleration
-				AEVec2Scale(&added, &added, (float)AEFrameRateControllerGetFrameTime()); // * dt - Makes time-based movement, which will cover the same amount of distance regardless of frame rate.
-				AEVec2Add(&newVel, &added, &spShip->velCurr); // * Adding everything to vector newVal
-				AEVec2Scale(&newVel, &newVel, 0.99f); // * 0.99 - This acts as 'friction', for each frame, the percentage decrease gets bigger, until it reachs 100%, which 'limits' our speed.
-				spShip->velCurr = newVel; // Assigning vector newVal to the ship's velocity.
+				spShip->velCurr = sPredictedVelocity;
+				spShip->dirCurr = sPredictedDirection;
 			}
+			else
+			{
+				if (AEInputCheckCurr(AEVK_UP)) // Moving forward
+				{
+					AEVec2 added, newVel{}, newPos{};
+					AEVec2Set(&added, cosf(spShip->dirCurr), sinf(spShip->dirCurr)); // Creating vector of the direction of the acceleration.
+					AEVec2Normalize(&added, &added); // Normalizing the vector
+					added.x *= SHIP_ACCEL_FORWARD; // * Acceleration
+					added.y *= SHIP_ACCEL_FORWARD; // * Acceleration
+					AEVec2Scale(&added, &added, (float)AEFrameRateControllerGetFrameTime()); // * dt - Makes time-based movement, which will cover the same amount of distance regardless of frame rate.
+					AEVec2Add(&newVel, &added, &spShip->velCurr); // * Adding everything to vector newVal
+					AEVec2Scale(&newVel, &newVel, 0.99f); // * 0.99 - This acts as 'friction', for each frame, the percentage decrease gets bigger, until it reachs 100%, which 'limits' our speed.
+					spShip->velCurr = newVel; // Assigning vector newVal to the ship's velocity.
+				}
 
-			if (AEInputCheckCurr(AEVK_DOWN)) // Moving backwards - The steps below are similar to the steps for forward movement.
-			{								 //                    One change is that we negate the acceleration, which results in moving the opposite direction.
-				AEVec2 added{}, newVel{};
-				AEVec2Set(&added, cosf(spShip->dirCurr), sinf(spShip->dirCurr));
-				AEVec2Normalize(&added, &added);
-				added.x *= -SHIP_ACCEL_BACKWARD;
-				added.y *= -SHIP_ACCEL_BACKWARD;
-				AEVec2Scale(&added, &added, (float)AEFrameRateControllerGetFrameTime());
-				AEVec2Add(&newVel, &added, &spShip->velCurr);
-				AEVec2Scale(&newVel, &newVel, 0.99f);
-				spShip->velCurr = newVel;
-			}
+				if (AEInputCheckCurr(AEVK_DOWN)) // Moving backwards - The steps below are similar to the steps for forward movement.
+				{								 //                    One change is that we negate the acceleration, which results in moving the opposite direction.
+					AEVec2 added{}, newVel{};
+					AEVec2Set(&added, cosf(spShip->dirCurr), sinf(spShip->dirCurr));
+					AEVec2Normalize(&added, &added);
+					added.x *= -SHIP_ACCEL_BACKWARD;
+					added.y *= -SHIP_ACCEL_BACKWARD;
+					AEVec2Scale(&added, &added, (float)AEFrameRateControllerGetFrameTime());
+					AEVec2Add(&newVel, &added, &spShip->velCurr);
+					AEVec2Scale(&newVel, &newVel, 0.99f);
+					spShip->velCurr = newVel;
+				}
 
-			if (AEInputCheckCurr(AEVK_LEFT)) // Rotating the ship anti-clockwise.
-			{
-				spShip->dirCurr += SHIP_ROT_SPEED * (float)(AEFrameRateControllerGetFrameTime());
-				spShip->dirCurr = AEWrap(spShip->dirCurr, -PI, PI);
-			}
+				if (AEInputCheckCurr(AEVK_LEFT)) // Rotating the ship anti-clockwise.
+				{
+					spShip->dirCurr += SHIP_ROT_SPEED * (float)(AEFrameRateControllerGetFrameTime());
+					spShip->dirCurr = AEWrap(spShip->dirCurr, -PI, PI);
+				}
 
-			if (AEInputCheckCurr(AEVK_RIGHT)) // Rotating the ship clockwise.
-			{
-				spShip->dirCurr -= SHIP_ROT_SPEED * (float)(AEFrameRateControllerGetFrameTime());
-				spShip->dirCurr = AEWrap(spShip->dirCurr, -PI, PI);
+				if (AEInputCheckCurr(AEVK_RIGHT)) // Rotating the ship clockwise.
+				{
+					spShip->dirCurr -= SHIP_ROT_SPEED * (float)(AEFrameRateControllerGetFrameTime());
+					spShip->dirCurr = AEWrap(spShip->dirCurr, -PI, PI);
+				}
 			}
 
-
 			// Shoot a bullet if space is triggered (Create a new object instance)
-			if (AEInputCheckTriggered(AEVK_SPACE)) // Creating a bullet when space is triggered.
+			// Once networked, the server fires the bullet and it arrives with the remote entities
+			if (!sNetworked && AEInputCheckTriggered(AEVK_SPACE)) // Creating a bullet when space is triggered.
 			{ 
 				AEVec2 scale{}, pos{}, vel{};
 				AEVec2Set(&scale, BULLET_SCALE_X, BULLET_SCALE_Y); // Vector for scaling the bullet
@@ -410,6 +441,7 @@ void GameStateAsteroidsUpdate(void)
 		pInst->boundingBox.max.x = (BOUNDING_RECT_SIZE / 2.f) * pInst->scale.x + pInst->posPrev.x;
 		pInst->boundingBox.max.y = (BOUNDING_RECT_SIZE / 2.f) * pInst->scale.y + pInst->posPrev.y;
 
+		if (pInst->flag & FLAG_REMOTE) continue; // Remote instances are placed by the client from the server's snapshots.
 		pInst->posCurr.x += pInst->velCurr.x * (float)AEFrameRateControllerGetFrameTime(); // Updating position of the object instance.
 		pInst->posCurr.y += pInst->velCurr.y * (float)AEFrameRateControllerGetFrameTime();
 	}
@@ -428,10 +460,12 @@ void GameStateAsteroidsUpdate(void)
 			for (int i = 0; i < GAME_OBJ_INST_NUM_MAX; ++i) { // For loop 1: This will iterate for each game object instance.
  				GameObjInst* pInst = sGameObjInstList + i; // To access each game object instance...
 				if ((pInst->flag & FLAG_ACTIVE) == 0) continue; // If the instance is not active (indicated by pInst->flag, which is 1 when the instance is active), continue to the next iteration.
+				if (pInst->flag & FLAG_REMOTE) continue; // The server decides collisions between its own entities.
 				if (pInst->pObject->type == TYPE_ASTEROID) { // Checking if the current instance is of type ASTEROID, which is the instance we are checking for collision for.
 					for (int j = 0; j < GAME_OBJ_INST_NUM_MAX; ++j) { // For loop 2: To iterate through all the other instances to check for collision with the ASTEROID.
 						GameObjInst* NewpInst = sGameObjInstList + j; // To access the other instances...
 						if ((NewpInst->flag & FLAG_ACTIVE) == 0) continue; // If the current instance is not active, skip.
+						if (NewpInst->flag & FLAG_REMOTE) continue; // Likewise for remote instances.
 						if (NewpInst->pObject->type == TYPE_ASTEROID) continue; // If the current instance is of type ASTEROID as well, skip, since there is no ASTEROID - ASTEROID collision.
 
 						float tFirst = 0.0f;
@@ -487,6 +521,10 @@ void GameStateAsteroidsUpdate(void)
 		// skip non-active object
 		if ((pInst->flag & FLAG_ACTIVE) == 0)
 			continue;
+
+		// skip remote objects, the server has wrapped and removed them already
+		if (pInst->flag & FLAG_REMOTE)
+			continue;
 		
 		// check if the object is a ship
 		if (pInst->pObject->type == TYPE_SHIP) // Checking for ship.
@@ -496,8 +534,14 @@ void GameStateAsteroidsUpdate(void)
 														AEGfxGetWinMaxX() + SHIP_SCALE_X);
 			pInst->posCurr.y = AEWrap(pInst->posCurr.y, AEGfxGetWinMinY() - SHIP_SCALE_Y,   // Likewise, wrapping the y-coordinates of the ship to the opposite end of the screen, should it go out of bounds.
 														AEGfxGetWinMaxY() + SHIP_SCALE_Y);
+			// A predicted ship is where the client's prediction puts it, whatever the local update did
+			if (sShipPredicted)
+				pInst->posCurr = sPredictedPosition;
+
 			//update ship position
 			finalPosition = { pInst->posCurr.x, pInst->posCurr.y };
+			sFinalVelocity = pInst->velCurr;
+			sFinalDirection = pInst->dirCurr;
 		}
 
 		// Wrap asteroids here
@@ -641,6 +685,121 @@ AEVec2 returnPosition()
 	return finalPosition;
 }
 
+AEVec2 returnVelocity()
+{
+	return sFinalVelocity;
+}
+
+float returnDirection()
+{
+	return sFinalDirection;
+}
+
+/******************************************************************************/
+/*!
+	Hands the game state the client's predicted ship for the next update. From then on
+	the ship follows the prediction instead of the movement keys.
+*/
+/******************************************************************************/
+void setPredictedShip(AEVec2 position, AEVec2 velocity, float direction)
+{
+	sShipPredicted = true;
+	sPredictedPosition = position;
+	sPredictedVelocity = velocity;
+	sPredictedDirection = direction;
+}
+
+/******************************************************************************/
+/*!
+	Takes the score and lives the server keeps for this player; once the asteroids
+	are the server's, it is also the one that counts hits and lost ships.
+*/
+/******************************************************************************/
+void setPlayerStanding(unsigned long score, long lives)
+{
+	sScore = score;
+	sShipLives = lives;
+	onValueChange = true;
+}
+
+/******************************************************************************/
+/*!
+	Starts a frame of the server's entities, to be followed by setRemoteEntity for each of
+	them and endRemoteEntities. The first call hands the asteroids and bullets to the server:
+	the local ones are destroyed and no longer fired.
+*/
+/******************************************************************************/
+void beginRemoteEntities()
+{
+	if (!sNetworked)
+	{
+		for (unsigned long i = 0; i < GAME_OBJ_INST_NUM_MAX; i++)
+		{
+			GameObjInst* pInst = sGameObjInstList + i;
+			if ((pInst->flag & FLAG_ACTIVE) == 0)
+				continue;
+			if (pInst->pObject->type == TYPE_ASTEROID || pInst->pObject->type == TYPE_BULLET)
+				gameObjInstDestroy(pInst);
+		}
+		sNetworked = true;
+	}
+
+	for (unsigned int i = 0; i < REMOTE_ENTITY_NUM_MAX; ++i)
+		sRemoteSeen[i] = false;
+}
+
+/******************************************************************************/
+/*!
+	Shows one entity of the server's world, creating its instance the first time it is seen
+	or when its id has been reused for another type. The local wall stands in for the server's.
+*/
+/******************************************************************************/
+void setRemoteEntity(unsigned int id, unsigned long type, AEVec2 scale, AEVec2 position, AEVec2 velocity, float direction)
+{
+	if (id >= REMOTE_ENTITY_NUM_MAX || type >= TYPE_WALL)
+		return;
+
+	GameObjInst* pInst = sRemoteInstList[id];
+	if (pInst && pInst->pObject->type != type)
+	{
+		gameObjInstDestroy(pInst);
+		pInst = nullptr;
+	}
+	if (!pInst)
+	{
+		pInst = gameObjInstCreate(type, &scale, &position, &velocity, direction);
+		if (!pInst) // No free instance; the entity is left out until one frees up.
+			return;
+		pInst->flag |= FLAG_REMOTE;
+		pInst->posPrev = position;
+		sRemoteInstList[id] = pInst;
+	}
+
+	pInst->scale = scale;
+	pInst->posCurr = position;
+	pInst->velCurr = velocity;
+	pInst->dirCurr = direction;
+	sRemoteSeen[id] = true;
+}
+
+/******************************************************************************/
+/*!
+	Ends a frame of the server's entities, destroying the instances of every entity that
+	was not set since beginRemoteEntities.
+*/
+/******************************************************************************/
+void endRemoteEntities()
+{
+	for (unsigned int i = 0; i < REMOTE_ENTITY_NUM_MAX; ++i)
+	{
+		if (sRemoteInstList[i] && !sRemoteSeen[i])
+		{
+			gameObjInstDestroy(sRemoteInstList[i]);
+			sRemoteInstList[i] = nullptr;
+		}
+	}
+}
+
 /******************************************************************************/
 /*!
 	Function to aid in creating an instance for a object. Essentially initializing the new instance with the appropriate values.
@@ -88,7 +88,20 @@ int WINAPI WinMain(_In_ HINSTANCE instanceH, _In_opt_ HINSTANCE prevInstanceH, _
 		{
 				AESysFrameStart();
 
+				// Take in the snapshots, welcome and standing the network thread received since the last frame
+				client.pollNetwork();
+				// Move our ship as the server will before the game state uses it, so controls respond at once
+				client.updatePrediction((f32)AEFrameRateControllerGetFrameTime());
+				SimVec2 shipPos{}, shipVel{};
+				float shipDir = 0.0f;
+				if (client.predictedShip(shipPos, shipVel, shipDir))
+					setPredictedShip({ shipPos.x, shipPos.y }, { shipVel.x, shipVel.y }, shipDir);
+
+				// Show everything else a little behind the server, interpolated between its snapshots
+				client.updateRemoteEntities();
+
 				GameStateUpdate();
+				// The network thread sends the newest state at its own fixed rate
 				client.run();
 
 				GameStateDraw();
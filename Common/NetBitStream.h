@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Bit-level stream writer and reader, and fixed-point field quantization.
+ *
+ * Values are packed most significant bit first into caller-provided buffers
+ * and never allocate. A NetQuantizer maps a float onto an unsigned integer of
+ * a set number of bits with a set step; Protocol.h defines one per field.
+ ******************************************************************************/
+
+#ifndef _NETBITSTREAM_H_
+#define _NETBITSTREAM_H_
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+// Packs values of 1 to 32 bits into a byte buffer.
+class NetBitWriter {
+public:
+    NetBitWriter(char* out, int capacity) : out(out), capacity(capacity) {}
+
+    /**
+     * Append the low bits of value
+     * @return false if the buffer is full; the writer then stays failed
+     */
+    bool write(uint32_t value, int bits) {
+        if (failed || bitCount + bits > static_cast<int64_t>(capacity) * 8) {
+            failed = true;
+            return false;
+        }
+        if (bits < 32) value &= (uint32_t{ 1 } << bits) - 1;
+        scratch = (scratch << bits) | value;
+        scratchBits += bits;
+        bitCount += bits;
+        while (scratchBits >= 8) {
+            scratchBits -= 8;
+            out[bytes++] = static_cast<char>(scratch >> scratchBits);
+        }
+        return true;
+    }
+
+    bool writeBool(bool value) { return write(value ? 1 : 0, 1); }
+
+    /**
+     * Write out the last partial byte, padded with zero bits
+     * @return The bytes used
+     */
+    int flush() {
+        if (scratchBits > 0) {
+            out[bytes++] = static_cast<char>(scratch << (8 - scratchBits));
+            scratchBits = 0;
+            bitCount = static_cast<int64_t>(bytes) * 8;
+        }
+        return bytes;
+    }
+
+    int64_t bitsWritten() const { return bitCount; }
+    bool overflowed() const { return failed; }
+
+private:
+    char* out;
+    int capacity;
+    int bytes = 0;          // Whole bytes written to out
+    int64_t bitCount = 0;   // Bits written, including those still in scratch
+    uint64_t scratch = 0;   // Bits not yet written out, in the low scratchBits bits
+    int scratchBits = 0;
+    bool failed = false;
+};
+
+// Reads values written by NetBitWriter.
+class NetBitReader {
+public:
+    NetBitReader(const char* in, int size) : in(reinterpret_cast<const unsigned char*>(in)), size(size) {}
+
+    /**
+     * Read a value of 1 to 32 bits
+     * @return The value, or 0 past the end of the buffer; the reader then stays failed
+     */
+    uint32_t read(int bits) {
+        if (failed || bitCount + bits > static_cast<int64_t>(size) * 8) {
+            failed = true;
+            return 0;
+        }
+        while (scratchBits < bits) {
+            scratch = (scratch << 8) | in[bytes++];
+            scratchBits += 8;
+        }
+        scratchBits -= bits;
+        bitCount += bits;
+        uint64_t value = scratch >> scratchBits;
+        return static_cast<uint32_t>(bits < 32 ? value & ((uint64_t{ 1 } << bits) - 1) : value);
+    }
+
+    bool readBool() { return read(1) != 0; }
+
+    int64_t bitsRead() const { return bitCount; }
+    bool overflowed() const { return failed; }
+
+private:
+    const unsigned char* in;
+    int size;
+    int bytes = 0;          // Whole bytes moved into scratch
+    int64_t bitCount = 0;
+    uint64_t scratch = 0;
+    int scratchBits = 0;
+    bool failed = false;
+};
+
+// Fixed-point encoding of a float field: min + index * step, index in [0, 2^bits).
+// Out-of-range values clamp, or wrap around for angles.
+struct NetQuantizer {
+    float min;
+    float step;
+    int bits;
+    bool wraps;     // The range is periodic, as for an angle
+
+    uint32_t encode(float value) const {
+        const uint32_t top = (bits < 32 ? (uint32_t{ 1 } << bits) : 0) - 1;
+        float index = std::floor((value - min) / step + 0.5f);
+        if (std::isnan(index)) return 0;
+        if (wraps) {
+            return static_cast<uint32_t>(static_cast<int64_t>(index)) & top;
+        }
+        if (index <= 0.0f) return 0;
+        if (index >= static_cast<float>(top)) return top;
+        return static_cast<uint32_t>(index);
+    }
+
+    float decode(uint32_t index) const {
+        return min + static_cast<float>(index) * step;
+    }
+
+    // The value the wire can carry that is closest to value
+    float quantize(float value) const {
+        return decode(encode(value));
+    }
+
+    // Largest difference between an in-range value and its quantized form:
+    // half a step, plus the float rounding of value - min near the ends of the range
+    float maxError() const {
+        float range = step * static_cast<float>(uint64_t{ 1 } << bits);
+        return step / 2.0f + (std::fabs(min) + std::fabs(min + range)) * FLT_EPSILON;
+    }
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Several game messages packed into one datagram.
+ *
+ * Most messages to a peer are a few dozen bytes (inputs, ship acks, reliable
+ * acknowledgements, snapshot parts of a quiet view), so IP and UDP headers and
+ * the syscall per datagram cost more than the payload. A sender collects what
+ * it has for one peer during a network tick and packs it into NET_CMD_BUNDLE
+ * datagrams of at most an MTU budget:
+ *
+ *   [0..3] header; its sequence field holds the number of messages
+ *   then per message: [0..1] size, big-endian, [2..] the message itself
+ *
+ * Each message keeps its own header, so the receiver handles it exactly as if
+ * it had arrived alone. The reader hands out pointers into the received
+ * datagram and never copies. Bundles never nest.
+ ******************************************************************************/
+
+#ifndef _NETBUNDLE_H_
+#define _NETBUNDLE_H_
+
+#include <cstdint>
+#include <cstring>
+#include "Protocol.h"
+
+// Size field ahead of each message in a bundle.
+#define NET_BUNDLE_PREFIX_SIZE  2
+
+// Packs messages into a caller-provided buffer of at most the MTU budget.
+class NetBundleWriter {
+public:
+    NetBundleWriter(char* out, int capacity) : out(out), capacity(capacity) { reset(); }
+
+    /**
+     * Empty the bundle to start the next datagram in the same buffer
+     */
+    void reset() {
+        messages = 0;
+        bytes = NetWriteHeader(out, capacity, NetHeader{ NET_CMD_BUNDLE, NET_PROTOCOL_VERSION, 0 });
+    }
+
+    /**
+     * Whether a message of the given size still fits
+     */
+    bool fits(int size) const {
+        return bytes > 0 && size > 0 && size <= 0xFFFF && bytes + NET_BUNDLE_PREFIX_SIZE + size <= capacity;
+    }
+
+    /**
+     * Append one complete message, header included
+     * @return false if it does not fit; the bundle is unchanged
+     */
+    bool add(const char* data, int size) {
+        if (!fits(size) || messages == 0xFFFF) return false;
+        NetWriteU16(out + bytes, static_cast<uint16_t>(size));
+        std::memcpy(out + bytes + NET_BUNDLE_PREFIX_SIZE, data, size);
+        bytes += NET_BUNDLE_PREFIX_SIZE + size;
+        NetWriteU16(out + 2, static_cast<uint16_t>(++messages));
+        return true;
+    }
+
+    int count() const { return messages; }
+
+    /**
+     * @return Bytes of the datagram so far, header included
+     */
+    int size() const { return bytes; }
+
+    const char* data() const { return out; }
+
+private:
+    char* out;
+    int capacity;
+    int bytes = 0;
+    int messages = 0;
+};
+
+// Walks the messages of a received bundle in place.
+class NetBundleReader {
+public:
+    /**
+     * @param data The whole datagram; it must outlive the reader and the messages it hands out
+     */
+    NetBundleReader(const char* data, int size) : in(data), size(size) {
+        NetHeader header{};
+        if (NetReadHeader(data, size, header) && header.commandId == NET_CMD_BUNDLE) {
+            remaining = header.sequence;
+            offset = NET_HEADER_SIZE;
+        }
+        else {
+            bad = true;
+        }
+    }
+
+    /**
+     * Take the next message
+     * @param message Receives a pointer to the message inside the datagram
+     * @param length Receives its size
+     * @return false once every message has been read, or at the first malformed one
+     */
+    bool next(const char*& message, int& length) {
+        if (bad || remaining == 0) return false;
+        if (size - offset < NET_BUNDLE_PREFIX_SIZE) {
+            bad = true;
+            return false;
+        }
+        length = NetReadU16(in + offset);
+        offset += NET_BUNDLE_PREFIX_SIZE;
+        if (length == 0 || size - offset < length ||
+            static_cast<uint8_t>(in[offset]) == NET_CMD_BUNDLE) {
+            bad = true;
+            return false;
+        }
+        message = in + offset;
+        offset += length;
+        --remaining;
+        return true;
+    }
+
+    /**
+     * @return true if the datagram is not a bundle or was cut short
+     */
+    bool malformed() const { return bad; }
+
+private:
+    const char* in;
+    int size;
+    int offset = 0;
+    int remaining = 0;
+    bool bad = false;
+};
+
+#endif
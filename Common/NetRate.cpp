@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * Per-connection send-rate control.
+ ******************************************************************************/
+
+#include <algorithm>
+#include "NetRate.h"
+
+// Bytes per second the rate grows by for every second without trouble
+static const double RATE_GROWTH = 2000.0;
+// Share of the rate kept when it is cut
+static const double RATE_BACK_OFF = 0.75;
+// The bucket holds this long of sending at the current rate, and at least two full-size datagrams
+static const double BURST_SECONDS = 0.1;
+static const double BURST_MIN = 2400.0;
+// Smoothed loss above which the rate is cut
+static const double LOSS_LIMIT = 0.02;
+// A round trip this much above the quickest one means packets are queueing. The slack covers
+// how long a peer may hold an acknowledgement back for its next input, snapshot or ack packet.
+static const double QUEUE_FACTOR = 2.0;
+static const double QUEUE_SLACK = 0.1;
+// Share of each sample the smoothed values move by
+static const double LOSS_GAIN = 1.0 / 16.0;
+static const double RTT_GAIN = 1.0 / 8.0;
+// The quickest round trip creeps up by this share per sample, so a route change is noticed
+static const double MIN_RTT_DRIFT = 0.001;
+
+NetRateController::NetRateController(double maxRate) :
+    maxRate(std::max(maxRate, NET_RATE_MIN)),
+    bytesPerSecond(std::min(NET_RATE_START, this->maxRate)) {
+    tokens = burst();
+}
+
+double NetRateController::available(double now) {
+    advance(now);
+    return tokens;
+}
+
+bool NetRateController::allows(double now, int bytes) {
+    advance(now);
+    return tokens >= bytes || tokens >= burst();
+}
+
+void NetRateController::onRoundTrip(double now, double seconds) {
+    if (seconds <= 0.0) return;
+    if (minRtt < 0.0) {
+        minRtt = seconds;
+        smoothedRtt = seconds;
+    }
+    else {
+        minRtt = std::min(seconds, minRtt * (1.0 + MIN_RTT_DRIFT));
+        smoothedRtt += (seconds - smoothedRtt) * RTT_GAIN;
+    }
+    if (smoothedRtt > minRtt * QUEUE_FACTOR + QUEUE_SLACK) backOff(now);
+}
+
+void NetRateController::onDelivery(double now, int delivered, int lost) {
+    for (int i = 0; i < delivered + lost; ++i) {
+        lossRate += ((i < lost ? 1.0 : 0.0) - lossRate) * LOSS_GAIN;
+    }
+    if (lost > 0 && lossRate > LOSS_LIMIT) backOff(now);
+}
+
+void NetRateController::advance(double now) {
+    if (lastUpdate < 0.0) {
+        lastUpdate = now;
+        return;
+    }
+    const double elapsed = std::max(0.0, now - lastUpdate);
+    lastUpdate = now;
+
+    // Grow only once a round trip has passed since the last cut, so the cut can take effect first
+    if (lastBackOff < 0.0 || now - lastBackOff > smoothedRtt) {
+        bytesPerSecond = std::min(maxRate, bytesPerSecond + RATE_GROWTH * elapsed);
+    }
+    tokens = std::min(burst(), tokens + bytesPerSecond * elapsed);
+}
+
+void NetRateController::backOff(double now) {
+    if (lastBackOff >= 0.0 && now - lastBackOff < smoothedRtt) return;
+    bytesPerSecond = std::max(NET_RATE_MIN, bytesPerSecond * RATE_BACK_OFF);
+    lastBackOff = now;
+}
+
+double NetRateController::burst() const {
+    return std::max(BURST_MIN, bytesPerSecond * BURST_SECONDS);
+}
+
+void NetSendTracker::sent(uint32_t id, double now) {
+    slots[next] = Slot{ true, id, now };
+    next = (next + 1) % slots.size();
+}
+
+bool NetSendTracker::acked(uint32_t id, uint32_t ackBits, double now, double& rtt, int& delivered, int& lost) {
+    delivered = 0;
+    lost = 0;
+    if (hasAcked && static_cast<int32_t>(id - newestAcked) <= 0) return false;
+
+    const Slot* match = nullptr;
+    for (Slot& slot : slots) {
+        if (!slot.used || static_cast<int32_t>(slot.id - id) > 0) continue;
+        const uint32_t back = id - slot.id;
+        if (back == 0) {
+            match = &slot;
+            ++delivered;
+        }
+        else if (back <= NET_RATE_ACK_BITS) {
+            if (ackBits & (1u << (back - 1))) ++delivered;
+            else ++lost; // The peer has newer ones, so this one is not coming
+        }
+        slot.used = false;
+    }
+    newestAcked = id;
+    hasAcked = true;
+    if (match == nullptr) return false;
+    rtt = now - match->sentAt;
+    return true;
+}
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * Per-connection send-rate control: a token bucket whose rate adapts to the
+ * round trip and loss measured on the connection.
+ *
+ * Each connection owns a NetRateController. Bytes are spent from its bucket
+ * as datagrams go out, and the bucket refills at the current rate. The rate
+ * grows steadily while the link keeps up and is cut by a quarter, at most once
+ * per round trip, when packets are lost or the round trip climbs well above
+ * the quickest one seen, which is the sign of a queue building up on the way.
+ * Senders that find the bucket empty hold back what can wait (a snapshot tick,
+ * a resend) instead of piling it into the kernel's and the routers' queues.
+ *
+ * A NetSendTracker turns the peer's acknowledgements of numbered packets,
+ * such as snapshot ticks, into the round-trip and loss samples the controller
+ * needs; the reliable channel reports its own.
+ ******************************************************************************/
+
+#ifndef _NETRATE_H_
+#define _NETRATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packets a NetSendTracker remembers; older ones count neither as lost nor as delivered.
+#define NET_RATE_TRACKED        64
+// Ids before the acknowledged one that an acknowledgement's bitfield covers; a packet further back
+// than that when an acknowledgement passes it counts neither as lost nor as delivered.
+#define NET_RATE_ACK_BITS       32
+
+// Bounds and starting point of the rate, in bytes per second.
+#define NET_RATE_MIN            4000.0
+#define NET_RATE_START          32000.0
+#define NET_RATE_MAX_DEFAULT    250000.0
+
+class NetRateController {
+public:
+    /**
+     * @param maxRate Most bytes per second the connection is ever given
+     */
+    explicit NetRateController(double maxRate = NET_RATE_MAX_DEFAULT);
+
+    /**
+     * Bytes that may go out now; negative while earlier sends are still being paid off
+     * @param now Local time in seconds (NetClockSeconds)
+     */
+    double available(double now);
+
+    /**
+     * Whether a datagram of the given size may go out now. One larger than the bucket
+     * holds is allowed once the bucket is full, so nothing is held back forever.
+     */
+    bool allows(double now, int bytes);
+
+    /**
+     * Take the bytes of a datagram that went out from the bucket
+     */
+    void spend(int bytes) { tokens -= bytes; }
+
+    /**
+     * Take in a round-trip sample
+     */
+    void onRoundTrip(double now, double seconds);
+
+    /**
+     * Take in packets found delivered and lost since the last call
+     */
+    void onDelivery(double now, int delivered, int lost);
+
+    /**
+     * @return Current rate in bytes per second
+     */
+    double rate() const { return bytesPerSecond; }
+
+    /**
+     * @return Smoothed share of packets lost, 0 to 1
+     */
+    double loss() const { return lossRate; }
+
+    /**
+     * @return Smoothed round trip in seconds
+     */
+    double roundTrip() const { return smoothedRtt; }
+
+    /**
+     * @return Most bytes the bucket holds at the current rate
+     */
+    double burst() const;
+
+private:
+    // Refill the bucket and grow the rate for the time since the last call
+    void advance(double now);
+    // Cut the rate unless it was cut less than a round trip ago
+    void backOff(double now);
+
+    double maxRate;
+    double bytesPerSecond = NET_RATE_START;
+    double tokens = 0.0;
+    double lastUpdate = -1.0;       // Negative until the first call
+    double lastBackOff = -1.0;
+    double smoothedRtt = 0.1;       // Starting guess until the first sample
+    double minRtt = -1.0;           // Quickest round trip seen, negative before any
+    double lossRate = 0.0;
+};
+
+// Send times of numbered packets, matched against the peer's acknowledgements: the newest one it has,
+// plus a bitfield of the ids before it, so packets sent faster than acknowledgements come back are not
+// mistaken for lost.
+class NetSendTracker {
+public:
+    NetSendTracker() : slots(NET_RATE_TRACKED) {}
+
+    /**
+     * Remember that packet id went out now; ids must grow
+     */
+    void sent(uint32_t id, double now);
+
+    /**
+     * Take in the peer's acknowledgement of id, the newest packet it has received
+     * @param ackBits Bit i set if the peer also received id - 1 - i
+     * @param rtt Receives the round trip of that packet
+     * @param delivered Receives the packets up to id found received, id itself included
+     * @param lost Receives the packets up to id whose bit is clear; 0 if id is not newer
+     * @return false if id is not newer than the last acknowledgement or was never tracked
+     */
+    bool acked(uint32_t id, uint32_t ackBits, double now, double& rtt, int& delivered, int& lost);
+
+private:
+    struct Slot {
+        bool used = false;
+        uint32_t id = 0;
+        double sentAt = 0.0;
+    };
+
+    std::vector<Slot> slots;        // Ring in send order
+    size_t next = 0;                // Slot the next send goes in
+    uint32_t newestAcked = 0;
+    bool hasAcked = false;
+};
+
+#endif
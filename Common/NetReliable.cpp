@@ -0,0 +1,193 @@
+/*******************************************************************************
+ * Reliable, ordered message channel over the game's UDP socket.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "NetReliable.h"
+
+// Longest an acknowledgement waits for another message to ride on before it goes out alone
+static const double ACK_DELAY = 0.05;
+// Bounds of the resend timeout, whatever the round trip measures
+static const double RESEND_MIN = 0.05;
+static const double RESEND_MAX = 1.0;
+
+// Packet header, acknowledgement and message count
+static const int PACKET_HEADER_SIZE = NET_HEADER_SIZE + NET_ACK_SIZE + 1;
+// Id and size ahead of each message
+static const int MESSAGE_HEADER_SIZE = 4;
+
+NetReliableChannel::NetReliableChannel() :
+    outgoing(NET_RELIABLE_WINDOW),
+    sent(NET_RELIABLE_PACKETS),
+    incoming(NET_RELIABLE_WINDOW) {}
+
+bool NetReliableChannel::queue(const char* data, int size) {
+    if (size <= 0 || size > NET_RELIABLE_MESSAGE_MAX) return false;
+    if (static_cast<uint16_t>(nextId - oldestId) >= NET_RELIABLE_WINDOW) return false;
+
+    Outgoing& message = outgoing[nextId % NET_RELIABLE_WINDOW];
+    message.used = true;
+    message.id = nextId;
+    message.sentAt = -1.0;
+    message.data.assign(data, data + size);
+    ++nextId;
+    return true;
+}
+
+int NetReliableChannel::writePacket(double now, char* out, int capacity) {
+    capacity = std::min(capacity, NET_RELIABLE_PACKET_MAX);
+    if (capacity < PACKET_HEADER_SIZE) return 0;
+
+    // New messages and ones whose packet has gone unacknowledged too long, oldest first
+    const double timeout = resendTimeout();
+    uint16_t ids[NET_RELIABLE_PACKET_MESSAGES];
+    uint8_t count = 0;
+    bool resend = false;
+    int size = PACKET_HEADER_SIZE;
+    for (uint16_t id = oldestId; id != nextId && count < NET_RELIABLE_PACKET_MESSAGES; ++id) {
+        const Outgoing& message = outgoing[id % NET_RELIABLE_WINDOW];
+        if (!message.used || message.id != id) continue;
+        if (message.sentAt >= 0.0 && now - message.sentAt < timeout) continue;
+        const int needed = MESSAGE_HEADER_SIZE + static_cast<int>(message.data.size());
+        if (size + needed > capacity) break;
+        ids[count++] = id;
+        size += needed;
+        if (message.sentAt >= 0.0) resend = true;
+    }
+    if (count == 0 && !(ackOwed && now - ackOwedSince >= ACK_DELAY)) return 0;
+
+    const uint16_t sequence = nextSequence++;
+    if (nextSequence == 0) nextSequence = 1; // 0 stands for no packet in acknowledgements
+
+    int offset = NetWriteHeader(out, capacity, NetHeader{ NET_CMD_RELIABLE, NET_PROTOCOL_VERSION, sequence });
+    offset += NetWriteAck(out + offset, capacity - offset, writeAck());
+    out[offset++] = static_cast<char>(count);
+    for (uint8_t i = 0; i < count; ++i) {
+        Outgoing& message = outgoing[ids[i] % NET_RELIABLE_WINDOW];
+        NetWriteU16(out + offset, message.id);
+        NetWriteU16(out + offset + 2, static_cast<uint16_t>(message.data.size()));
+        std::copy(message.data.begin(), message.data.end(), out + offset + MESSAGE_HEADER_SIZE);
+        offset += MESSAGE_HEADER_SIZE + static_cast<int>(message.data.size());
+        message.sentAt = now;
+    }
+
+    SentPacket& packet = sent[sequence % NET_RELIABLE_PACKETS];
+    packet.used = true;
+    packet.sequence = sequence;
+    packet.sentAt = now;
+    packet.count = count;
+    std::copy(ids, ids + count, packet.ids);
+    if (resend && rate != nullptr) rate->onDelivery(now, 0, 1); // The packet it went in before was lost
+    return offset;
+}
+
+bool NetReliableChannel::readPacket(double now, const char* data, int size) {
+    NetHeader header{};
+    NetAck ack{};
+    if (!NetReadHeader(data, size, header) || header.commandId != NET_CMD_RELIABLE || header.sequence == 0 ||
+        !NetReadAck(data + NET_HEADER_SIZE, size - NET_HEADER_SIZE, ack) || size < PACKET_HEADER_SIZE) {
+        return false;
+    }
+    readAck(now, ack);
+
+    // Remember the packet for our own acknowledgements
+    const uint16_t sequence = header.sequence;
+    if (received.ack == 0) {
+        received.ack = sequence;
+        received.ackBits = 0;
+    }
+    else if (NetSequenceNewer(sequence, received.ack)) {
+        const uint16_t shift = static_cast<uint16_t>(sequence - received.ack);
+        uint64_t bits = shift >= 64 ? 0 : static_cast<uint64_t>(received.ackBits) << shift;
+        if (shift <= 32) bits |= uint64_t{ 1 } << (shift - 1); // The previous newest
+        received.ack = sequence;
+        received.ackBits = static_cast<uint32_t>(bits);
+    }
+    else {
+        const uint16_t back = static_cast<uint16_t>(received.ack - sequence);
+        if (back >= 1 && back <= 32) received.ackBits |= 1u << (back - 1);
+    }
+
+    // Keep every message in the window that has not arrived before; older ones were delivered already
+    const uint8_t count = static_cast<uint8_t>(data[NET_HEADER_SIZE + NET_ACK_SIZE]);
+    int offset = PACKET_HEADER_SIZE;
+    for (uint8_t i = 0; i < count; ++i) {
+        if (size - offset < MESSAGE_HEADER_SIZE) return false;
+        const uint16_t id = NetReadU16(data + offset);
+        const uint16_t length = NetReadU16(data + offset + 2);
+        offset += MESSAGE_HEADER_SIZE;
+        if (size - offset < length) return false;
+
+        Incoming& message = incoming[id % NET_RELIABLE_WINDOW];
+        if (static_cast<uint16_t>(id - deliverId) < NET_RELIABLE_WINDOW && !message.used) {
+            message.used = true;
+            message.id = id;
+            message.data.assign(data + offset, data + offset + length);
+        }
+        offset += length;
+    }
+
+    if (count > 0 && !ackOwed) {
+        ackOwed = true;
+        ackOwedSince = now;
+    }
+    return true;
+}
+
+NetAck NetReliableChannel::writeAck() {
+    ackOwed = false;
+    return received;
+}
+
+void NetReliableChannel::readAck(double now, const NetAck& ack) {
+    if (ack.ack == 0) return;
+
+    for (int i = -1; i < 32; ++i) {
+        if (i >= 0 && (ack.ackBits & (1u << i)) == 0) continue;
+        const uint16_t sequence = static_cast<uint16_t>(ack.ack - 1 - i);
+        SentPacket& packet = sent[sequence % NET_RELIABLE_PACKETS];
+        if (!packet.used || packet.sequence != sequence) continue;
+        packet.used = false;
+
+        // Smoothed round trip and its variation, as TCP keeps them
+        const double sample = now - packet.sentAt;
+        if (!hasRtt) {
+            smoothedRtt = sample;
+            rttVariance = sample / 2.0;
+            hasRtt = true;
+        }
+        else {
+            rttVariance = 0.75 * rttVariance + 0.25 * std::fabs(smoothedRtt - sample);
+            smoothedRtt = 0.875 * smoothedRtt + 0.125 * sample;
+        }
+        if (rate != nullptr) {
+            rate->onRoundTrip(now, sample);
+            rate->onDelivery(now, 1, 0);
+        }
+
+        for (uint8_t m = 0; m < packet.count; ++m) {
+            Outgoing& message = outgoing[packet.ids[m] % NET_RELIABLE_WINDOW];
+            if (message.used && message.id == packet.ids[m]) {
+                message.used = false;
+                message.data.clear();
+            }
+        }
+    }
+
+    while (oldestId != nextId && !outgoing[oldestId % NET_RELIABLE_WINDOW].used) ++oldestId;
+}
+
+bool NetReliableChannel::receive(std::vector<char>& message) {
+    Incoming& next = incoming[deliverId % NET_RELIABLE_WINDOW];
+    if (!next.used || next.id != deliverId) return false;
+    message.swap(next.data);
+    next.used = false;
+    next.data.clear();
+    ++deliverId;
+    return true;
+}
+
+double NetReliableChannel::resendTimeout() const {
+    return std::clamp(smoothedRtt + 4.0 * rttVariance, RESEND_MIN, RESEND_MAX);
+}
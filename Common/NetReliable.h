@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Reliable, ordered message channel over the game's UDP socket.
+ *
+ * Messages that must not be lost (score and lives changes, user lists) are
+ * queued on a channel and leave in NET_CMD_RELIABLE packets, each numbered by
+ * a per-connection packet sequence. Every packet a peer sends regularly
+ * carries a NetAck naming the newest reliable packet it received plus a 32-bit
+ * field for the ones before it, so acknowledgements cost no packets of their
+ * own while inputs or snapshots flow. A message whose packet goes unacked for
+ * longer than the smoothed round trip allows is sent again in a new packet,
+ * and the receiver hands messages on strictly in the order they were queued.
+ * Snapshots and inputs never go through the channel, so a lost message holds
+ * up only the messages after it.
+ ******************************************************************************/
+
+#ifndef _NETRELIABLE_H_
+#define _NETRELIABLE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "Protocol.h"
+#include "NetRate.h"
+
+// Messages in flight in one direction; queue refuses more until the oldest is acknowledged.
+#define NET_RELIABLE_WINDOW         64
+// Sent packets remembered to match acknowledgements against.
+#define NET_RELIABLE_PACKETS        64
+// Messages packed into one packet.
+#define NET_RELIABLE_PACKET_MESSAGES 16
+// Largest packet, header included, within the server's receive buffer; one message must fit with room to spare.
+#define NET_RELIABLE_PACKET_MAX     1000
+#define NET_RELIABLE_MESSAGE_MAX    960
+
+// Local steady clock in seconds, the time base of the channel's timers.
+inline double NetClockSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class NetReliableChannel {
+public:
+    NetReliableChannel();
+
+    /**
+     * Queue a message for reliable, ordered delivery
+     * @return false if the message is too large or the window is full
+     */
+    bool queue(const char* data, int size);
+
+    /**
+     * Write a NET_CMD_RELIABLE packet when messages are due or an acknowledgement has waited too long
+     * @param now Local time in seconds (NetClockSeconds)
+     * @return Size of the packet, 0 if there is nothing to send
+     */
+    int writePacket(double now, char* out, int capacity);
+
+    /**
+     * Take in a NET_CMD_RELIABLE packet: its acknowledgements, then its messages
+     * @return false if the packet is malformed
+     */
+    bool readPacket(double now, const char* data, int size);
+
+    /**
+     * Acknowledgement of the peer's packets, for a message about to be sent
+     */
+    NetAck writeAck();
+
+    /**
+     * Take in an acknowledgement the peer piggybacked on another message
+     */
+    void readAck(double now, const NetAck& ack);
+
+    /**
+     * Take the next message in order
+     * @return false if the next message has not arrived yet
+     */
+    bool receive(std::vector<char>& message);
+
+    /**
+     * @return Smoothed round-trip time in seconds
+     */
+    double roundTrip() const { return smoothedRtt; }
+
+    /**
+     * Report every round trip measured and every resend to the connection's send-rate control
+     * @param controller Controller of the connection, nullptr to stop reporting
+     */
+    void setRateController(NetRateController* controller) { rate = controller; }
+
+private:
+    struct Outgoing {
+        bool used = false;
+        uint16_t id = 0;
+        double sentAt = -1.0;   // Last time the message went out, negative if never
+        std::vector<char> data;
+    };
+    struct SentPacket {
+        bool used = false;
+        uint16_t sequence = 0;
+        double sentAt = 0.0;
+        uint8_t count = 0;
+        uint16_t ids[NET_RELIABLE_PACKET_MESSAGES];
+    };
+    struct Incoming {
+        bool used = false;
+        uint16_t id = 0;
+        std::vector<char> data;
+    };
+
+    // Seconds an unacknowledged message waits before it is sent again
+    double resendTimeout() const;
+
+    std::vector<Outgoing> outgoing;     // outgoing[id % NET_RELIABLE_WINDOW]
+    std::vector<SentPacket> sent;       // sent[sequence % NET_RELIABLE_PACKETS]
+    std::vector<Incoming> incoming;     // incoming[id % NET_RELIABLE_WINDOW]
+    uint16_t nextId = 0;                // Id of the next message queued
+    uint16_t oldestId = 0;              // Oldest message not acknowledged yet
+    uint16_t nextSequence = 1;          // Sequence of the next packet sent
+    uint16_t deliverId = 0;             // Next message receive hands on
+    NetAck received{ 0, 0 };            // Peer packets received so far
+    bool ackOwed = false;               // A packet with messages has not been acknowledged yet
+    double ackOwedSince = 0.0;
+    double smoothedRtt = 0.1;           // Starting guess until the first sample
+    double rttVariance = 0.05;
+    bool hasRtt = false;
+    NetRateController* rate = nullptr;  // Told of round trips and resends, may be null
+};
+
+#endif
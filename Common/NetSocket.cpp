@@ -0,0 +1,383 @@
+/*******************************************************************************
+ * Portable socket layer shared by the client and the server.
+ ******************************************************************************/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // recvmmsg/sendmmsg
+#endif
+#endif
+
+#include "NetSocket.h"
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// Cleared the first time the kernel rejects UDP_SEGMENT, so we stop asking.
+static std::atomic<bool> gsoAvailable{ true };
+#endif
+
+// Start up the socket library
+bool NetStartup() {
+#ifdef _WIN32
+    WSADATA wsaData{};
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == NO_ERROR;
+#else
+    return true;
+#endif
+}
+
+// Shut down the socket library
+void NetCleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// Last socket error code of the calling thread
+int NetLastError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// Whether several sockets can share a port with kernel load balancing
+bool NetReusePortSupported() {
+#ifdef __linux__
+    return true;
+#else
+    // Winsock's SO_REUSEADDR lets sockets share a port but delivers to only one of them
+    return false;
+#endif
+}
+
+// Allow s to share its port with other sockets
+bool NetSetReusePort(SOCKET s) {
+#ifdef __linux__
+    int enable = 1;
+    return setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == 0;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+static void countIo(NetIoStats* stats, uint64_t datagrams, uint64_t syscalls) {
+    if (stats == nullptr) return;
+    stats->datagrams.fetch_add(datagrams, std::memory_order_relaxed);
+    stats->syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+int NetRecvBatch(SOCKET s, NetDatagram* slots, int count, NetIoStats* stats) {
+    if (count > NET_RECV_BATCH_MAX) count = NET_RECV_BATCH_MAX;
+
+    mmsghdr msgs[NET_RECV_BATCH_MAX];
+    iovec iovs[NET_RECV_BATCH_MAX];
+    for (int i = 0; i < count; ++i) {
+        iovs[i].iov_base = slots[i].data;
+        iovs[i].iov_len = static_cast<size_t>(slots[i].capacity);
+        SecureZeroMemory(&msgs[i], sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &slots[i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(slots[i].addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // MSG_WAITFORONE: block for the first datagram only, then drain what is queued.
+    int received = recvmmsg(s, msgs, static_cast<unsigned int>(count), MSG_WAITFORONE, nullptr);
+    if (received < 0) {
+        countIo(stats, 0, 1);
+        return SOCKET_ERROR;
+    }
+
+    for (int i = 0; i < received; ++i) {
+        slots[i].size = static_cast<int>(msgs[i].msg_len);
+    }
+    countIo(stats, static_cast<uint64_t>(received), 1);
+    return received;
+}
+
+#else
+
+int NetRecvBatch(SOCKET s, NetDatagram* slots, int count, NetIoStats* stats) {
+    if (count > NET_RECV_BATCH_MAX) count = NET_RECV_BATCH_MAX;
+
+    int received = 0;
+    uint64_t syscalls = 0;
+    while (received < count) {
+        if (received > 0) {
+            // Only keep going while something is already queued, so we never block mid-batch.
+#ifdef _WIN32
+            u_long pending = 0;
+            ++syscalls;
+            if (ioctlsocket(s, FIONREAD, &pending) == SOCKET_ERROR || pending == 0) break;
+#else
+            break;
+#endif
+        }
+
+        NetDatagram& slot = slots[received];
+        socklen_t addrSize = sizeof(slot.addr);
+        ++syscalls;
+        int bytes = recvfrom(s, slot.data, slot.capacity, 0,
+            reinterpret_cast<sockaddr*>(&slot.addr), &addrSize);
+        if (bytes == SOCKET_ERROR) {
+            if (received > 0) break;
+            countIo(stats, 0, syscalls);
+            return SOCKET_ERROR;
+        }
+        slot.size = bytes;
+        ++received;
+    }
+
+    countIo(stats, static_cast<uint64_t>(received), syscalls);
+    return received;
+}
+
+#endif
+
+#ifdef __linux__
+
+int NetSendBatch(SOCKET s, const NetDatagram* msgs, int count, NetIoStats* stats) {
+    mmsghdr hdrs[NET_SEND_BATCH_MAX];
+    iovec iovs[NET_SEND_BATCH_MAX];
+    int sent = 0;
+    int accepted = 0;
+    uint64_t syscalls = 0;
+
+    while (sent < count) {
+        int chunk = count - sent < NET_SEND_BATCH_MAX ? count - sent : NET_SEND_BATCH_MAX;
+        for (int i = 0; i < chunk; ++i) {
+            const NetDatagram& msg = msgs[sent + i];
+            iovs[i].iov_base = msg.data;
+            iovs[i].iov_len = static_cast<size_t>(msg.size);
+            SecureZeroMemory(&hdrs[i], sizeof(hdrs[i]));
+            hdrs[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&msg.addr);
+            hdrs[i].msg_hdr.msg_namelen = sizeof(msg.addr);
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ++syscalls;
+        int result = sendmmsg(s, hdrs, static_cast<unsigned int>(chunk), 0);
+        if (result <= 0) {
+            // Skip the datagram the kernel refused, so one bad peer cannot stall the batch.
+            ++sent;
+            continue;
+        }
+        sent += result;
+        accepted += result;
+    }
+
+    countIo(stats, static_cast<uint64_t>(accepted), syscalls);
+    return accepted;
+}
+
+bool NetSendSegmented(SOCKET s, const sockaddr_in& to, const NetDatagram* msgs, int count,
+    int segmentSize, NetIoStats* stats) {
+    if (!gsoAvailable.load(std::memory_order_relaxed)) return false;
+    if (count > NET_GSO_SEGMENTS_MAX || count * segmentSize > NET_GSO_BYTES_MAX) return false;
+
+    iovec iovs[NET_GSO_SEGMENTS_MAX];
+    for (int i = 0; i < count; ++i) {
+        iovs[i].iov_base = msgs[i].data;
+        iovs[i].iov_len = static_cast<size_t>(msgs[i].size);
+    }
+
+    char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+    msghdr hdr{};
+    hdr.msg_name = const_cast<sockaddr_in*>(&to);
+    hdr.msg_namelen = sizeof(to);
+    hdr.msg_iov = iovs;
+    hdr.msg_iovlen = static_cast<size_t>(count);
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segment = static_cast<uint16_t>(segmentSize);
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+    if (sendmsg(s, &hdr, 0) < 0) {
+        if (errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EIO) {
+            gsoAvailable.store(false, std::memory_order_relaxed);
+        }
+        countIo(stats, 0, 1);
+        return false;
+    }
+
+    countIo(stats, static_cast<uint64_t>(count), 1);
+    return true;
+}
+
+#else
+
+int NetSendBatch(SOCKET s, const NetDatagram* msgs, int count, NetIoStats* stats) {
+    int sent = 0;
+    for (int i = 0; i < count; ++i) {
+        const NetDatagram& msg = msgs[i];
+        if (sendto(s, msg.data, msg.size, 0,
+            reinterpret_cast<const sockaddr*>(&msg.addr), sizeof(msg.addr)) != SOCKET_ERROR) {
+            ++sent;
+        }
+    }
+    countIo(stats, static_cast<uint64_t>(sent), static_cast<uint64_t>(count));
+    return sent;
+}
+
+bool NetSendSegmented(SOCKET, const sockaddr_in&, const NetDatagram*, int, int, NetIoStats*) {
+    return false;
+}
+
+#endif
+
+// Whether a socket error code means a non-blocking socket has nothing more to read
+bool NetWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EWOULDBLOCK || error == EAGAIN;
+#endif
+}
+
+#ifdef _WIN32
+
+bool NetSocketWaiter::open(SOCKET s) {
+    close();
+    readEvent = WSACreateEvent();
+    wakeEvent = WSACreateEvent();
+    // WSAEventSelect also makes the socket non-blocking
+    if (readEvent == WSA_INVALID_EVENT || wakeEvent == WSA_INVALID_EVENT ||
+        WSAEventSelect(s, readEvent, FD_READ) == SOCKET_ERROR) {
+        close();
+        return false;
+    }
+    watched = s;
+    return true;
+}
+
+NetWaitResult NetSocketWaiter::wait(int timeoutMs) {
+    // The wake event comes first, so a shutdown is not held up behind a stream of datagrams
+    const WSAEVENT events[2] = { wakeEvent, readEvent };
+    DWORD result = WSAWaitForMultipleEvents(2, events, FALSE,
+        timeoutMs < 0 ? WSA_INFINITE : static_cast<DWORD>(timeoutMs), FALSE);
+    if (result == WSA_WAIT_EVENT_0) {
+        WSAResetEvent(wakeEvent);
+        return NET_WAIT_WOKEN;
+    }
+    if (result == WSA_WAIT_EVENT_0 + 1) {
+        // Reset before the caller drains; a datagram arriving after its last read sets it again
+        WSAResetEvent(readEvent);
+        return NET_WAIT_READABLE;
+    }
+    return result == WSA_WAIT_TIMEOUT ? NET_WAIT_TIMEOUT : NET_WAIT_ERROR;
+}
+
+void NetSocketWaiter::wake() {
+    if (wakeEvent != WSA_INVALID_EVENT) WSASetEvent(wakeEvent);
+}
+
+void NetSocketWaiter::close() {
+    if (watched != INVALID_SOCKET) {
+        WSAEventSelect(watched, nullptr, 0);
+        watched = INVALID_SOCKET;
+    }
+    if (readEvent != WSA_INVALID_EVENT) WSACloseEvent(readEvent);
+    if (wakeEvent != WSA_INVALID_EVENT) WSACloseEvent(wakeEvent);
+    readEvent = WSA_INVALID_EVENT;
+    wakeEvent = WSA_INVALID_EVENT;
+}
+
+#elif defined(__linux__)
+
+bool NetSocketWaiter::open(SOCKET s) {
+    close();
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pollFd < 0 || wakeFd < 0) {
+        close();
+        return false;
+    }
+
+    // Level-triggered, so whatever a drain leaves behind wakes the next wait straight away
+    epoll_event socketEvent{};
+    socketEvent.events = EPOLLIN;
+    socketEvent.data.fd = s;
+    epoll_event wakeEventSpec{};
+    wakeEventSpec.events = EPOLLIN;
+    wakeEventSpec.data.fd = wakeFd;
+    const int flags = fcntl(s, F_GETFL, 0);
+    if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        epoll_ctl(pollFd, EPOLL_CTL_ADD, s, &socketEvent) < 0 ||
+        epoll_ctl(pollFd, EPOLL_CTL_ADD, wakeFd, &wakeEventSpec) < 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+NetWaitResult NetSocketWaiter::wait(int timeoutMs) {
+    epoll_event events[2];
+    int ready = epoll_wait(pollFd, events, 2, timeoutMs < 0 ? -1 : timeoutMs);
+    if (ready < 0) return errno == EINTR ? NET_WAIT_TIMEOUT : NET_WAIT_ERROR;
+    if (ready == 0) return NET_WAIT_TIMEOUT;
+
+    bool readable = false;
+    for (int i = 0; i < ready; ++i) {
+        if (events[i].data.fd == wakeFd) {
+            uint64_t count = 0;
+            (void)::read(wakeFd, &count, sizeof(count));
+            return NET_WAIT_WOKEN;
+        }
+        readable = true;
+    }
+    return readable ? NET_WAIT_READABLE : NET_WAIT_TIMEOUT;
+}
+
+void NetSocketWaiter::wake() {
+    if (wakeFd < 0) return;
+    const uint64_t one = 1;
+    (void)::write(wakeFd, &one, sizeof(one));
+}
+
+void NetSocketWaiter::close() {
+    if (pollFd >= 0) ::close(pollFd);
+    if (wakeFd >= 0) ::close(wakeFd);
+    pollFd = -1;
+    wakeFd = -1;
+}
+
+#else
+
+// No waiter elsewhere yet; open fails, so callers know to fall back to blocking reads
+bool NetSocketWaiter::open(SOCKET) {
+    return false;
+}
+
+NetWaitResult NetSocketWaiter::wait(int) {
+    return NET_WAIT_ERROR;
+}
+
+void NetSocketWaiter::wake() {
+}
+
+void NetSocketWaiter::close() {
+}
+
+#endif
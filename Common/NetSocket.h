@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * Portable socket layer shared by the client and the server.
+ *
+ * On Windows this is a thin wrapper over Winsock. On Linux the Winsock names
+ * used across the code base (SOCKET, INVALID_SOCKET, closesocket, ...) are
+ * mapped onto BSD sockets so the same sources build on both platforms.
+ ******************************************************************************/
+
+#ifndef _NETSOCKET_H_
+#define _NETSOCKET_H_
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+using SOCKET = int;
+
+#define INVALID_SOCKET  (-1)
+#define SOCKET_ERROR    (-1)
+#define NO_ERROR        0
+#define SD_BOTH         SHUT_RDWR
+
+inline int closesocket(SOCKET s) { return ::close(s); }
+inline void SecureZeroMemory(void* p, size_t n) { std::memset(p, 0, n); }
+
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+// Upper bound on datagrams pulled from the kernel by one NetRecvBatch call.
+#define NET_RECV_BATCH_MAX  64
+// Upper bound on datagrams handed to the kernel by one sendmmsg call.
+#define NET_SEND_BATCH_MAX  64
+// Upper bound on segments the kernel accepts in one UDP_SEGMENT (GSO) send.
+#define NET_GSO_SEGMENTS_MAX 64
+// Upper bound on the total payload of one UDP_SEGMENT (GSO) send.
+#define NET_GSO_BYTES_MAX   65000
+
+// One datagram slot of a batched receive or send.
+// On receive the kernel writes straight into data; on send, size bytes of data go out.
+struct NetDatagram {
+    sockaddr_in addr;   // Source address on receive, destination on send
+    char* data;         // Caller-owned payload buffer
+    int capacity;       // Size of the payload buffer (receive only)
+    int size;           // Bytes received, or bytes to send
+};
+
+// Datagram and syscall counters, used to report packets per syscall.
+struct NetIoStats {
+    std::atomic<uint64_t> datagrams{ 0 };
+    std::atomic<uint64_t> syscalls{ 0 };
+    std::atomic<uint64_t> messages{ 0 };    // Messages the datagrams carried, more than datagrams when bundled
+};
+
+// Start up the socket library (WSAStartup on Windows, no-op elsewhere)
+bool NetStartup();
+// Shut down the socket library
+void NetCleanup();
+// Last socket error code of the calling thread
+int NetLastError();
+
+// Whether several sockets can share a port with kernel load balancing (SO_REUSEPORT)
+bool NetReusePortSupported();
+// Allow s to share its port with other sockets; must be called before bind
+bool NetSetReusePort(SOCKET s);
+
+// Receive up to count datagrams into slots. Blocks until at least one datagram
+// is available, then takes whatever else is already queued without blocking.
+// Uses recvmmsg on Linux; elsewhere it falls back to one recvfrom per datagram.
+// Returns the number of datagrams received, or SOCKET_ERROR.
+int NetRecvBatch(SOCKET s, NetDatagram* slots, int count, NetIoStats* stats = nullptr);
+
+// Send count datagrams, each to its own address. Uses sendmmsg on Linux,
+// NET_SEND_BATCH_MAX datagrams per syscall; elsewhere one sendto per datagram.
+// Returns the number of datagrams the kernel accepted.
+int NetSendBatch(SOCKET s, const NetDatagram* msgs, int count, NetIoStats* stats = nullptr);
+
+// Send count datagrams to one peer in a single syscall using UDP generic
+// segmentation offload. Every datagram but the last must be segmentSize bytes,
+// the last may be shorter. Returns false without sending anything when GSO is
+// not available, so the caller can fall back to NetSendBatch.
+bool NetSendSegmented(SOCKET s, const sockaddr_in& to, const NetDatagram* msgs, int count,
+    int segmentSize, NetIoStats* stats = nullptr);
+
+// Whether a socket error code means a non-blocking socket has nothing more to read
+bool NetWouldBlock(int error);
+
+// Why NetSocketWaiter::wait returned.
+enum NetWaitResult {
+    NET_WAIT_READABLE,  // Datagrams are queued; read until NetWouldBlock
+    NET_WAIT_WOKEN,     // Another thread called wake
+    NET_WAIT_TIMEOUT,
+    NET_WAIT_ERROR
+};
+
+// Sleeps a thread until its socket has datagrams, a timeout passes, or another
+// thread wakes it, e.g. to shut down. Uses epoll and an eventfd on Linux, and
+// WSAEventSelect and a second event on Windows. Watching a socket makes it
+// non-blocking, so each wakeup can drain everything queued and no more.
+class NetSocketWaiter {
+public:
+    NetSocketWaiter() = default;
+    ~NetSocketWaiter() { close(); }
+    NetSocketWaiter(const NetSocketWaiter&) = delete;
+    NetSocketWaiter& operator=(const NetSocketWaiter&) = delete;
+
+    // Start watching s for datagrams. Returns false if the platform refused.
+    bool open(SOCKET s);
+    // Block for at most timeoutMs milliseconds, or without limit if negative.
+    // A wake and readable data at once report the wake; the data is reported next time.
+    NetWaitResult wait(int timeoutMs);
+    // Make the current or next wait return NET_WAIT_WOKEN; safe from any thread
+    void wake();
+    // Stop watching and release the events; the socket itself stays open
+    void close();
+
+private:
+#ifdef _WIN32
+    WSAEVENT readEvent = WSA_INVALID_EVENT;
+    WSAEVENT wakeEvent = WSA_INVALID_EVENT;
+    SOCKET watched = INVALID_SOCKET;
+#else
+    int pollFd = -1;    // epoll instance, or -1 when closed
+    int wakeFd = -1;    // eventfd written by wake
+#endif
+};
+
+#endif
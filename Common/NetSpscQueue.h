@@ -0,0 +1,80 @@
+/*******************************************************************************
+ * Lock-free bounded single-producer/single-consumer queue.
+ *
+ * Hands items between exactly two threads, such as the client's game loop and
+ * its network thread, without a lock or a syscall on either side. The
+ * producer only writes the tail and the consumer only writes the head, each on
+ * its own cache line; an acquire load of the other side's index is all either
+ * needs to see the items. Slots are preallocated and items are swapped in and
+ * out, so a queue of vectors passes their storage back and forth between the
+ * two threads instead of allocating.
+ ******************************************************************************/
+
+#ifndef _NETSPSCQUEUE_H_
+#define _NETSPSCQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Size of a cache line, to keep the two indices from sharing one.
+#define NET_CACHE_LINE_SIZE 64
+
+template <typename TItem>
+class NetSpscQueue {
+public:
+    /**
+     * @param capacity Items the queue holds, rounded up to a power of two
+     */
+    explicit NetSpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    NetSpscQueue(const NetSpscQueue&) = delete;
+    NetSpscQueue& operator=(const NetSpscQueue&) = delete;
+
+    /**
+     * Swap an item in; producer thread only
+     * @param item Receives the stale contents of the slot, whose storage may be reused
+     * @return false if the queue is full; the item is left as it was
+     */
+    bool tryPush(TItem& item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        std::swap(slots[t & mask], item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Swap the oldest item out; consumer thread only
+     * @param item Receives the item; its old contents are left in the slot for the producer to reuse
+     * @return false if the queue is empty
+     */
+    bool tryPop(TItem& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        std::swap(item, slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @return true if nothing is queued; exact only on the consumer thread
+     */
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<TItem> slots;
+    size_t mask = 0;
+    alignas(NET_CACHE_LINE_SIZE) std::atomic<size_t> head{ 0 };    // Next slot to pop, written by the consumer
+    alignas(NET_CACHE_LINE_SIZE) std::atomic<size_t> tail{ 0 };    // Next slot to push, written by the producer
+};
+
+#endif
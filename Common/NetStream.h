@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * Framed parser for the console messages, which arrive as a byte stream.
+ *
+ * The echo and user-list messages carry no NetHeader and may be split across
+ * or packed into reads, so the receiver buffers bytes until a whole message
+ * is in. NetStreamParser keeps them in one contiguous buffer between a read
+ * and a write index: parsing hands out views into that buffer and consumes a
+ * message by moving the read index, with no copy and no erase. The unread
+ * tail is moved to the front only when an append would not otherwise fit,
+ * so each byte is moved at most once per buffer length appended.
+ *
+ *   REQ_ECHO, RSP_ECHO  [0] id, [1..4] IPv4 as on the wire, [5..6] port,
+ *                       [7..10] text length, [11..] text
+ *   RSP_LISTUSERS       [0] id, [1..2] user count, then per user
+ *                       [0..3] IPv4 as on the wire, [4..5] port
+ *   ECHO_ERROR          [0] id
+ *
+ * Ports and lengths are big-endian. Fields are read byte by byte, so nothing
+ * depends on the alignment of a message inside the buffer.
+ ******************************************************************************/
+
+#ifndef _NETSTREAM_H_
+#define _NETSTREAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "Protocol.h"
+
+#define NET_STREAM_ECHO_FIXED_SIZE  11  // Echo message before its text
+#define NET_STREAM_LIST_FIXED_SIZE  3   // User list before its entries
+#define NET_STREAM_LIST_ENTRY_SIZE  6
+// Bytes the parser holds before its first growth.
+#define NET_STREAM_INITIAL_CAPACITY 4096
+
+// One complete console message, pointing into the parser's buffer. Valid until the next append.
+struct NetStreamMessage {
+    uint8_t commandId = 0;      // NET_CMD_REQ_ECHO, NET_CMD_RSP_ECHO, NET_CMD_RSP_LISTUSERS or NET_CMD_ECHO_ERROR
+    const char* data = nullptr; // The whole message
+    uint32_t size = 0;
+
+    /**
+     * Echo address, IPv4 as on the wire and the port in host order
+     */
+    uint32_t echoIp() const {
+        uint32_t ip;
+        std::memcpy(&ip, data + 1, sizeof(ip));
+        return ip;
+    }
+    uint16_t echoPort() const { return NetReadU16(data + 5); }
+    const char* echoText() const { return data + NET_STREAM_ECHO_FIXED_SIZE; }
+    uint32_t echoTextSize() const { return NetReadU32(data + 7); }
+
+    uint16_t userCount() const { return NetReadU16(data + 1); }
+
+    /**
+     * Address of user i of a user list, IPv4 as on the wire and the port in host order
+     */
+    void user(uint16_t i, uint32_t& ip, uint16_t& port) const {
+        const char* entry = data + NET_STREAM_LIST_FIXED_SIZE + i * NET_STREAM_LIST_ENTRY_SIZE;
+        std::memcpy(&ip, entry, sizeof(ip));
+        port = NetReadU16(entry + 4);
+    }
+};
+
+class NetStreamParser {
+public:
+    /**
+     * @param maxMessage Largest message accepted; a bigger length is treated as a corrupt byte and skipped
+     */
+    explicit NetStreamParser(uint32_t maxMessage = 1u << 20) : maxMessage(maxMessage) {
+        buffer.resize(NET_STREAM_INITIAL_CAPACITY);
+    }
+
+    /**
+     * Add received bytes after those not yet parsed
+     */
+    void append(const char* data, size_t size) {
+        if (size > buffer.size() - writeIndex) {
+            // Move the unread tail to the front, and grow only if that is still not enough room
+            const size_t unread = writeIndex - readIndex;
+            if (readIndex > 0) {
+                std::memmove(buffer.data(), buffer.data() + readIndex, unread);
+                readIndex = 0;
+                writeIndex = unread;
+            }
+            if (size > buffer.size() - writeIndex) {
+                buffer.resize(std::max(buffer.size() * 2, writeIndex + size));
+            }
+        }
+        std::memcpy(buffer.data() + writeIndex, data, size);
+        writeIndex += size;
+    }
+
+    /**
+     * Take the next complete message
+     * @param message Receives a view of it, valid until the next append
+     * @return false once only part of a message, or nothing, is left
+     */
+    bool next(NetStreamMessage& message) {
+        while (readIndex < writeIndex) {
+            const char* in = buffer.data() + readIndex;
+            const size_t available = writeIndex - readIndex;
+            const uint8_t commandId = static_cast<uint8_t>(in[0]);
+
+            size_t size = 0;
+            if (commandId == NET_CMD_REQ_ECHO || commandId == NET_CMD_RSP_ECHO) {
+                if (available < NET_STREAM_ECHO_FIXED_SIZE) return false;
+                const uint32_t textSize = NetReadU32(in + 7);
+                if (textSize > maxMessage) {
+                    skipUnknown();
+                    continue;
+                }
+                size = NET_STREAM_ECHO_FIXED_SIZE + static_cast<size_t>(textSize);
+            }
+            else if (commandId == NET_CMD_RSP_LISTUSERS) {
+                if (available < NET_STREAM_LIST_FIXED_SIZE) return false;
+                size = NET_STREAM_LIST_FIXED_SIZE + static_cast<size_t>(NetReadU16(in + 1)) * NET_STREAM_LIST_ENTRY_SIZE;
+            }
+            else if (commandId == NET_CMD_ECHO_ERROR) {
+                size = 1;
+            }
+            else {
+                skipUnknown();
+                continue;
+            }
+            if (available < size) return false;
+
+            message.commandId = commandId;
+            message.data = in;
+            message.size = static_cast<uint32_t>(size);
+            readIndex += size;
+            if (readIndex == writeIndex) readIndex = writeIndex = 0; // Drained; the next append starts at the front
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return Bytes skipped because they did not start a known message
+     */
+    uint64_t skipped() const { return skippedBytes; }
+
+    /**
+     * @return Bytes received but not yet parsed
+     */
+    size_t pending() const { return writeIndex - readIndex; }
+
+private:
+    // Skip the byte at the read index and everything after it up to the next known command ID, in one pass
+    void skipUnknown() {
+        const char* begin = buffer.data() + readIndex + 1;
+        const char* end = buffer.data() + writeIndex;
+        const char* found = std::find_if(begin, end, [](char c) {
+            const uint8_t id = static_cast<uint8_t>(c);
+            return id == NET_CMD_REQ_ECHO || id == NET_CMD_RSP_ECHO ||
+                id == NET_CMD_RSP_LISTUSERS || id == NET_CMD_ECHO_ERROR;
+        });
+        const size_t count = static_cast<size_t>(found - (buffer.data() + readIndex));
+        skippedBytes += count;
+        readIndex += count;
+    }
+
+    std::vector<char> buffer;
+    size_t readIndex = 0;       // First byte not yet parsed
+    size_t writeIndex = 0;      // One past the last byte received
+    uint32_t maxMessage;
+    uint64_t skippedBytes = 0;
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*******************************************************************************
+ * Binary game-state wire protocol shared by the client and the server.
+ *
+ * Every game message starts with a fixed 4-byte header:
+ *
+ *   [0]    command ID (CMDID on the client, CommandID on the server)
+ *   [1]    protocol version
+ *   [2..3] sequence number, big-endian, wrapping
+ *
+ * followed by the command's payload. All multi-byte fields are big-endian.
+ * Snapshot entities are bit-packed with quantized fields (NetBitStream.h).
+ * Encoding and decoding work on caller-provided buffers and never allocate.
+ ******************************************************************************/
+
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include <cstdint>
+#include <cstring>
+#include "NetBitStream.h"
+
+// Bumped whenever the layout of a message changes; mismatching messages are dropped.
+#define NET_PROTOCOL_VERSION    9
+
+#define NET_HEADER_SIZE         4
+#define NET_SHIP_STATE_SIZE     20
+#define NET_INPUT_SIZE          19
+#define NET_WELCOME_SIZE        8
+#define NET_SNAPSHOT_INFO_SIZE  20
+#define NET_ACK_SIZE            6
+#define NET_GAME_EVENT_SIZE     7
+
+// Input commands repeated in every REQ_INPUT, so a lost datagram costs no command.
+#define NET_INPUT_REDUNDANCY    4
+
+// Bit widths of the packed entity delta fields.
+#define NET_ENTITY_ID_BITS      11      // Covers SIM_ENTITY_MAX
+#define NET_ENTITY_MASK_BITS    5
+#define NET_ENTITY_TYPE_BITS    2
+#define NET_ENTITY_OWNER_BITS   16
+#define NET_ENTITY_SCALE_BITS   8
+
+// Fields present in an entity delta, or-ed into its change mask.
+#define NET_ENTITY_CREATE       0x01    // New in this slot: type, owner and scale class follow
+#define NET_ENTITY_POS          0x02
+#define NET_ENTITY_VEL          0x04
+#define NET_ENTITY_DIR          0x08
+#define NET_ENTITY_DESTROY      0x10    // Gone since the baseline; no fields follow
+
+// Quantization of the entity fields. The world snaps its state onto the same
+// grid every tick, so what the server holds survives the wire unchanged.
+constexpr NetQuantizer NET_QUANT_POS{ -2048.0f, 1.0f / 128.0f, 19, false };   // 1/128 px over [-2048, 2048)
+constexpr NetQuantizer NET_QUANT_VEL{ -1024.0f, 1.0f / 64.0f, 17, false };    // 1/64 px/s over [-1024, 1024)
+constexpr NetQuantizer NET_QUANT_DIR{ -3.14159265f, 6.28318531f / 1024.0f, 10, true }; // 1024 steps per turn
+
+// Bits of an entity delta with every field present.
+constexpr int NET_ENTITY_DELTA_MAX_BITS = NET_ENTITY_ID_BITS + NET_ENTITY_MASK_BITS + NET_ENTITY_TYPE_BITS +
+    NET_ENTITY_OWNER_BITS + NET_ENTITY_SCALE_BITS + 2 * NET_QUANT_POS.bits + 2 * NET_QUANT_VEL.bits + NET_QUANT_DIR.bits;
+
+// Largest snapshot datagram; bigger worlds are split so no datagram is IP-fragmented.
+#define NET_SNAPSHOT_MTU        1200
+
+// Default budget of a bundle of messages to one peer (NetBundle.h), the same as a snapshot part.
+#define NET_BUNDLE_MTU          1200
+// Budget of the client's bundles, which must fit the server's receive buffer.
+#define NET_BUNDLE_UPLINK_MTU   1000
+
+// Command IDs of the game messages; the values are mirrored in CMDID and CommandID.
+#define NET_CMD_REQ_SHIP_STATE  0x10    // Client reports its ship
+#define NET_CMD_RSP_SHIP_STATE  0x11    // Server acknowledges a ship report
+#define NET_CMD_REQ_INPUT       0x12    // Client sends its controls; the first one joins the game
+#define NET_CMD_RSP_WELCOME     0x13    // Server tells a joining client its player ID
+#define NET_CMD_RSP_SNAPSHOT    0x14    // One part of the server's world state for a tick
+#define NET_CMD_RELIABLE        0x15    // Reliable, ordered messages and the sender's acks (see NetReliable.h)
+#define NET_CMD_RSP_GAME_EVENT  0x16    // Reliable message: the receiver's score or lives changed
+#define NET_CMD_BUNDLE          0x17    // Several of the above in one datagram (see NetBundle.h)
+
+// Command IDs of the console messages, which have no NetHeader (see NetStream.h).
+#define NET_CMD_REQ_ECHO        0x02    // Echo from another client: source address, length, text
+#define NET_CMD_RSP_ECHO        0x03    // Reply to an echo: responder address, length, text
+#define NET_CMD_REQ_LISTUSERS   0x04    // Client asks for the connected users
+#define NET_CMD_RSP_LISTUSERS   0x05    // Count, then an address per user
+#define NET_CMD_ECHO_ERROR      0x30    // The echo could not be delivered
+
+// Fixed header of every game message.
+struct NetHeader {
+    uint8_t commandId;
+    uint8_t version;
+    uint16_t sequence;
+};
+
+// State of one ship, as sent over the wire.
+struct NetShipState {
+    float posX;
+    float posY;
+    float velX;
+    float velY;
+    float dir;      // Facing in radians
+};
+
+// Acknowledgement of the peer's reliable packets, carried by every message that flows regularly.
+struct NetAck {
+    uint16_t ack;           // Newest reliable packet received, 0 before any; packet 0 is never sent
+    uint32_t ackBits;       // Bit i set if packet ack - 1 - i was received too
+};
+
+// Controls of one player: one command of SIM_INPUT_* buttons per simulation tick, numbered by
+// the header sequence. The newest command comes first, followed by the ones before it.
+struct NetInput {
+    uint8_t buttons[NET_INPUT_REDUNDANCY];  // buttons[i] is command header.sequence - i
+    uint32_t ackTick;       // Newest snapshot tick the client has complete, 0 for none
+    uint8_t viewLag;        // Ticks the world the client shows trails ackTick; the server rewinds shots by it
+    NetAck reliableAck;     // The server's reliable packets the client has received
+    uint32_t ackTickBits;   // Bit i set if snapshot tick ackTick - 1 - i was complete too
+};
+
+// Reply to a client's first input.
+struct NetWelcome {
+    uint16_t playerId;
+    uint16_t tickRate;      // Server simulation ticks per second
+    uint16_t worldWidth;    // Size of the field, centred on the origin
+    uint16_t worldHeight;
+};
+
+// Leads every snapshot part; a tick's snapshot is complete once all parts have arrived.
+// The entities are deltas against the baseline tick as both ends predict it forward.
+struct NetSnapshotInfo {
+    uint32_t tick;
+    uint32_t baseTick;      // Acknowledged tick the deltas apply to, 0 for a full snapshot
+    uint8_t part;           // Index of this part
+    uint8_t partCount;      // Parts in this tick's snapshot
+    uint16_t entityCount;   // Entity deltas in this part
+    uint16_t inputSequence; // Last input command the server applied to the receiver's ship by this tick
+    NetAck reliableAck;     // The receiver's reliable packets the server has received
+};
+
+// A player's standing, sent reliably whenever it changes.
+struct NetGameEvent {
+    uint32_t score;
+    int16_t lives;          // Ships left; below 0 the game is over
+    uint8_t gameOver;       // 1 once the player is out of ships or has reached the winning score
+};
+
+// State of one entity in a snapshot.
+struct NetEntityState {
+    uint16_t id;
+    uint8_t type;           // SimEntityType
+    uint16_t owner;         // Owning player, 0 for none
+    uint8_t scaleClass;     // Size of an asteroid (SimScaleClass); other types have one size
+    float posX;
+    float posY;
+    float velX;
+    float velY;
+    float dir;
+};
+
+// Whether sequence a is newer than b, allowing for wrap-around.
+inline bool NetSequenceNewer(uint16_t a, uint16_t b) {
+    return static_cast<int16_t>(a - b) > 0;
+}
+
+inline void NetWriteU16(char* out, uint16_t value) {
+    out[0] = static_cast<char>(value >> 8);
+    out[1] = static_cast<char>(value);
+}
+
+inline uint16_t NetReadU16(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline void NetWriteU32(char* out, uint32_t value) {
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+inline uint32_t NetReadU32(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+        (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+inline void NetWriteF32(char* out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    NetWriteU32(out, bits);
+}
+
+inline float NetReadF32(const char* in) {
+    uint32_t bits = NetReadU32(in);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Write the header; returns the bytes written, or 0 if it does not fit.
+inline int NetWriteHeader(char* out, int capacity, const NetHeader& header) {
+    if (capacity < NET_HEADER_SIZE) return 0;
+    out[0] = static_cast<char>(header.commandId);
+    out[1] = static_cast<char>(header.version);
+    NetWriteU16(out + 2, header.sequence);
+    return NET_HEADER_SIZE;
+}
+
+// Read the header; fails if the message is too short or from another protocol version.
+inline bool NetReadHeader(const char* in, int size, NetHeader& header) {
+    if (size < NET_HEADER_SIZE) return false;
+    header.commandId = static_cast<uint8_t>(in[0]);
+    header.version = static_cast<uint8_t>(in[1]);
+    header.sequence = NetReadU16(in + 2);
+    return header.version == NET_PROTOCOL_VERSION;
+}
+
+// Write a ship state; returns the bytes written, or 0 if it does not fit.
+inline int NetWriteShipState(char* out, int capacity, const NetShipState& ship) {
+    if (capacity < NET_SHIP_STATE_SIZE) return 0;
+    NetWriteF32(out, ship.posX);
+    NetWriteF32(out + 4, ship.posY);
+    NetWriteF32(out + 8, ship.velX);
+    NetWriteF32(out + 12, ship.velY);
+    NetWriteF32(out + 16, ship.dir);
+    return NET_SHIP_STATE_SIZE;
+}
+
+// Read a ship state; fails if the payload is too short.
+inline bool NetReadShipState(const char* in, int size, NetShipState& ship) {
+    if (size < NET_SHIP_STATE_SIZE) return false;
+    ship.posX = NetReadF32(in);
+    ship.posY = NetReadF32(in + 4);
+    ship.velX = NetReadF32(in + 8);
+    ship.velY = NetReadF32(in + 12);
+    ship.dir = NetReadF32(in + 16);
+    return true;
+}
+
+inline int NetWriteAck(char* out, int capacity, const NetAck& ack) {
+    if (capacity < NET_ACK_SIZE) return 0;
+    NetWriteU16(out, ack.ack);
+    NetWriteU32(out + 2, ack.ackBits);
+    return NET_ACK_SIZE;
+}
+
+inline bool NetReadAck(const char* in, int size, NetAck& ack) {
+    if (size < NET_ACK_SIZE) return false;
+    ack.ack = NetReadU16(in);
+    ack.ackBits = NetReadU32(in + 2);
+    return true;
+}
+
+inline int NetWriteInput(char* out, int capacity, const NetInput& input) {
+    if (capacity < NET_INPUT_SIZE) return 0;
+    for (int i = 0; i < NET_INPUT_REDUNDANCY; ++i) {
+        out[i] = static_cast<char>(input.buttons[i]);
+    }
+    NetWriteU32(out + NET_INPUT_REDUNDANCY, input.ackTick);
+    out[NET_INPUT_REDUNDANCY + 4] = static_cast<char>(input.viewLag);
+    NetWriteAck(out + NET_INPUT_REDUNDANCY + 5, NET_ACK_SIZE, input.reliableAck);
+    NetWriteU32(out + NET_INPUT_REDUNDANCY + 5 + NET_ACK_SIZE, input.ackTickBits);
+    return NET_INPUT_SIZE;
+}
+
+inline bool NetReadInput(const char* in, int size, NetInput& input) {
+    if (size < NET_INPUT_SIZE) return false;
+    for (int i = 0; i < NET_INPUT_REDUNDANCY; ++i) {
+        input.buttons[i] = static_cast<uint8_t>(in[i]);
+    }
+    input.ackTick = NetReadU32(in + NET_INPUT_REDUNDANCY);
+    input.viewLag = static_cast<uint8_t>(in[NET_INPUT_REDUNDANCY + 4]);
+    NetReadAck(in + NET_INPUT_REDUNDANCY + 5, NET_ACK_SIZE, input.reliableAck);
+    input.ackTickBits = NetReadU32(in + NET_INPUT_REDUNDANCY + 5 + NET_ACK_SIZE);
+    return true;
+}
+
+inline int NetWriteWelcome(char* out, int capacity, const NetWelcome& welcome) {
+    if (capacity < NET_WELCOME_SIZE) return 0;
+    NetWriteU16(out, welcome.playerId);
+    NetWriteU16(out + 2, welcome.tickRate);
+    NetWriteU16(out + 4, welcome.worldWidth);
+    NetWriteU16(out + 6, welcome.worldHeight);
+    return NET_WELCOME_SIZE;
+}
+
+inline bool NetReadWelcome(const char* in, int size, NetWelcome& welcome) {
+    if (size < NET_WELCOME_SIZE) return false;
+    welcome.playerId = NetReadU16(in);
+    welcome.tickRate = NetReadU16(in + 2);
+    welcome.worldWidth = NetReadU16(in + 4);
+    welcome.worldHeight = NetReadU16(in + 6);
+    return true;
+}
+
+inline int NetWriteSnapshotInfo(char* out, int capacity, const NetSnapshotInfo& info) {
+    if (capacity < NET_SNAPSHOT_INFO_SIZE) return 0;
+    NetWriteU32(out, info.tick);
+    NetWriteU32(out + 4, info.baseTick);
+    out[8] = static_cast<char>(info.part);
+    out[9] = static_cast<char>(info.partCount);
+    NetWriteU16(out + 10, info.entityCount);
+    NetWriteU16(out + 12, info.inputSequence);
+    NetWriteAck(out + 14, NET_ACK_SIZE, info.reliableAck);
+    return NET_SNAPSHOT_INFO_SIZE;
+}
+
+inline bool NetReadSnapshotInfo(const char* in, int size, NetSnapshotInfo& info) {
+    if (size < NET_SNAPSHOT_INFO_SIZE) return false;
+    info.tick = NetReadU32(in);
+    info.baseTick = NetReadU32(in + 4);
+    info.part = static_cast<uint8_t>(in[8]);
+    info.partCount = static_cast<uint8_t>(in[9]);
+    info.entityCount = NetReadU16(in + 10);
+    info.inputSequence = NetReadU16(in + 12);
+    NetReadAck(in + 14, NET_ACK_SIZE, info.reliableAck);
+    return true;
+}
+
+inline int NetWriteGameEvent(char* out, int capacity, const NetGameEvent& event) {
+    if (capacity < NET_GAME_EVENT_SIZE) return 0;
+    NetWriteU32(out, event.score);
+    NetWriteU16(out + 4, static_cast<uint16_t>(event.lives));
+    out[6] = static_cast<char>(event.gameOver);
+    return NET_GAME_EVENT_SIZE;
+}
+
+inline bool NetReadGameEvent(const char* in, int size, NetGameEvent& event) {
+    if (size < NET_GAME_EVENT_SIZE) return false;
+    event.score = NetReadU32(in);
+    event.lives = static_cast<int16_t>(NetReadU16(in + 4));
+    event.gameOver = static_cast<uint8_t>(in[6]);
+    return true;
+}
+
+// Write an entity delta: id, change mask, then the fields the mask names.
+// Returns false if the writer is out of room.
+inline bool NetWriteEntityDelta(NetBitWriter& out, uint8_t mask, const NetEntityState& entity) {
+    out.write(entity.id, NET_ENTITY_ID_BITS);
+    out.write(mask, NET_ENTITY_MASK_BITS);
+    if (mask & NET_ENTITY_CREATE) {
+        out.write(entity.type, NET_ENTITY_TYPE_BITS);
+        out.write(entity.owner, NET_ENTITY_OWNER_BITS);
+        out.write(entity.scaleClass, NET_ENTITY_SCALE_BITS);
+    }
+    if (mask & NET_ENTITY_POS) {
+        out.write(NET_QUANT_POS.encode(entity.posX), NET_QUANT_POS.bits);
+        out.write(NET_QUANT_POS.encode(entity.posY), NET_QUANT_POS.bits);
+    }
+    if (mask & NET_ENTITY_VEL) {
+        out.write(NET_QUANT_VEL.encode(entity.velX), NET_QUANT_VEL.bits);
+        out.write(NET_QUANT_VEL.encode(entity.velY), NET_QUANT_VEL.bits);
+    }
+    if (mask & NET_ENTITY_DIR) {
+        out.write(NET_QUANT_DIR.encode(entity.dir), NET_QUANT_DIR.bits);
+    }
+    return !out.overflowed();
+}
+
+// Read an entity delta; only the id and the fields the mask names are set.
+// Returns false if the delta is truncated.
+inline bool NetReadEntityDelta(NetBitReader& in, uint8_t& mask, NetEntityState& entity) {
+    entity.id = static_cast<uint16_t>(in.read(NET_ENTITY_ID_BITS));
+    mask = static_cast<uint8_t>(in.read(NET_ENTITY_MASK_BITS));
+    if (mask & NET_ENTITY_CREATE) {
+        entity.type = static_cast<uint8_t>(in.read(NET_ENTITY_TYPE_BITS));
+        entity.owner = static_cast<uint16_t>(in.read(NET_ENTITY_OWNER_BITS));
+        entity.scaleClass = static_cast<uint8_t>(in.read(NET_ENTITY_SCALE_BITS));
+    }
+    if (mask & NET_ENTITY_POS) {
+        entity.posX = NET_QUANT_POS.decode(in.read(NET_QUANT_POS.bits));
+        entity.posY = NET_QUANT_POS.decode(in.read(NET_QUANT_POS.bits));
+    }
+    if (mask & NET_ENTITY_VEL) {
+        entity.velX = NET_QUANT_VEL.decode(in.read(NET_QUANT_VEL.bits));
+        entity.velY = NET_QUANT_VEL.decode(in.read(NET_QUANT_VEL.bits));
+    }
+    if (mask & NET_ENTITY_DIR) {
+        entity.dir = NET_QUANT_DIR.decode(in.read(NET_QUANT_DIR.bits));
+    }
+    return !in.overflowed();
+}
+
+// Encode a complete ship-state message; returns its size, or 0 if it does not fit.
+inline int NetEncodeShipMessage(char* out, int capacity, uint8_t commandId, uint16_t sequence,
+    const NetShipState& ship) {
+    int header = NetWriteHeader(out, capacity, NetHeader{ commandId, NET_PROTOCOL_VERSION, sequence });
+    if (header == 0) return 0;
+    int body = NetWriteShipState(out + header, capacity - header, ship);
+    return body == 0 ? 0 : header + body;
+}
+
+#endif
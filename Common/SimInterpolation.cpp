@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * Jitter and interpolation buffer for the entities of server snapshots.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "SimInterpolation.h"
+
+// Share of the gap to a late snapshot's clock sample the estimate moves by; early ones are taken at once
+static const double CLOCK_DRIFT = 0.02;
+
+static const float TWO_PI = 6.28318531f;
+
+// Wrap an angle into [-pi, pi]
+static float wrapAngle(float angle) {
+    angle = std::fmod(angle + TWO_PI / 2.0f, TWO_PI);
+    if (angle < 0.0f) angle += TWO_PI;
+    return angle - TWO_PI / 2.0f;
+}
+
+SimInterpolationBuffer::SimInterpolationBuffer(const SimConfig& config, float delay, float extrapolation) :
+    delay(delay),
+    extrapolation(extrapolation),
+    frames(SIM_INTERPOLATION_HISTORY) {
+    reset(config);
+}
+
+void SimInterpolationBuffer::reset(const SimConfig& config) {
+    this->config = config;
+    tickSeconds = SimTickSeconds(config.tickRate);
+    first = 0;
+    count = 0;
+    hasClock = false;
+}
+
+void SimInterpolationBuffer::push(uint32_t tick, const std::vector<NetEntityState>& entities, double arrival) {
+    if (count > 0) {
+        const Frame& newest = frames[(first + count - 1) % frames.size()];
+        if (static_cast<int32_t>(tick - newest.tick) <= 0) return;
+    }
+
+    // The quickest arrivals show the server clock best; late ones only pull it back slowly,
+    // so the shown time follows a slower path without shaking on every late packet
+    double offset = static_cast<double>(tick) * tickSeconds - arrival;
+    if (!hasClock || offset > clockOffset) {
+        clockOffset = offset;
+    }
+    else {
+        clockOffset += (offset - clockOffset) * CLOCK_DRIFT;
+    }
+    hasClock = true;
+
+    Frame* slot;
+    if (count == frames.size()) {
+        slot = &frames[first]; // Evict the oldest
+        first = (first + 1) % frames.size();
+    }
+    else {
+        slot = &frames[(first + count) % frames.size()];
+        ++count;
+    }
+    slot->tick = tick;
+    slot->entities.assign(entities.begin(), entities.end());
+}
+
+bool SimInterpolationBuffer::sample(double now, std::vector<NetEntityState>& out) const {
+    out.clear();
+    double shownTick = 0.0;
+    if (!this->shownTick(now, shownTick)) return false;
+
+    const Frame& oldest = frames[first];
+    const Frame& newest = frames[(first + count - 1) % frames.size()];
+
+    if (shownTick <= oldest.tick) {
+        out = oldest.entities;
+        return true;
+    }
+
+    // Past the newest snapshot: coast on from it for a while, then hold
+    if (shownTick >= newest.tick) {
+        const float ahead = std::min(static_cast<float>((shownTick - newest.tick) * tickSeconds), extrapolation);
+        out = newest.entities;
+        for (NetEntityState& entity : out) {
+            SimVec2 pos = SimCoast(entity.type, { entity.posX, entity.posY }, { entity.velX, entity.velY }, ahead, config);
+            entity.posX = pos.x;
+            entity.posY = pos.y;
+        }
+        return true;
+    }
+
+    // The two snapshots either side of the shown time
+    size_t later = count - 1;
+    while (later > 1 && frames[(first + later - 1) % frames.size()].tick > shownTick) --later;
+    const Frame& from = frames[(first + later - 1) % frames.size()];
+    const Frame& to = frames[(first + later) % frames.size()];
+    const float alpha = static_cast<float>((shownTick - from.tick) / static_cast<double>(to.tick - from.tick));
+
+    // Both lists are in id order. Entities gone by the later snapshot are dropped; new ones show as they arrived.
+    size_t i = 0;
+    for (const NetEntityState& entity : to.entities) {
+        while (i < from.entities.size() && from.entities[i].id < entity.id) ++i;
+        if (i < from.entities.size() && from.entities[i].id == entity.id) {
+            out.push_back(blend(from.entities[i], entity, alpha,
+                static_cast<float>((to.tick - from.tick) * tickSeconds)));
+        }
+        else {
+            out.push_back(entity);
+        }
+    }
+    return true;
+}
+
+bool SimInterpolationBuffer::shownTick(double now, double& tick) const {
+    if (count == 0) return false;
+    tick = (now + clockOffset - delay) / tickSeconds;
+    return true;
+}
+
+NetEntityState SimInterpolationBuffer::blend(const NetEntityState& a, const NetEntityState& b, float alpha,
+    float interval) const {
+    // A reused slot holds another object
+    if (a.type != b.type || a.owner != b.owner || a.scaleClass != b.scaleClass) {
+        return alpha < 0.5f ? a : b;
+    }
+
+    NetEntityState out = b;
+    const float dx = b.posX - a.posX;
+    const float dy = b.posY - a.posY;
+    if (std::fabs(dx) > config.width / 2.0f || std::fabs(dy) > config.height / 2.0f) {
+        // A jump of half the field is a wrap, not a flight across it: coast from the nearer snapshot,
+        // which wraps the way the server does
+        const NetEntityState& near = alpha < 0.5f ? a : b;
+        const float dt = alpha < 0.5f ? alpha * interval : (alpha - 1.0f) * interval;
+        SimVec2 pos = SimCoast(near.type, { near.posX, near.posY }, { near.velX, near.velY }, dt, config);
+        out.posX = pos.x;
+        out.posY = pos.y;
+    }
+    else {
+        out.posX = a.posX + dx * alpha;
+        out.posY = a.posY + dy * alpha;
+    }
+    out.velX = a.velX + (b.velX - a.velX) * alpha;
+    out.velY = a.velY + (b.velY - a.velY) * alpha;
+    out.dir = wrapAngle(a.dir + wrapAngle(b.dir - a.dir) * alpha); // The short way round
+    return out;
+}
@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * Jitter and interpolation buffer for the entities of server snapshots.
+ *
+ * Snapshots arrive a few times per second with uneven gaps. The buffer keeps
+ * the recent ones by server tick and estimates the server clock from their
+ * arrival times, then shows the world a fixed delay behind that clock, so
+ * there is nearly always a snapshot on either side of the shown time to
+ * interpolate between. When packets are lost and the shown time passes the
+ * newest snapshot, entities coast on for a short while before they stop.
+ ******************************************************************************/
+
+#ifndef _SIMINTERPOLATION_H_
+#define _SIMINTERPOLATION_H_
+
+#include <cstdint>
+#include <vector>
+#include "Protocol.h"
+#include "SimWorld.h"
+
+// Snapshots kept; over a second at 20 snapshots per second.
+#define SIM_INTERPOLATION_HISTORY   32
+
+class SimInterpolationBuffer {
+public:
+    /**
+     * @param config World settings, for the tick length and wrapping
+     * @param delay Seconds the shown world trails the server, best about two snapshot intervals
+     * @param extrapolation Longest time entities coast past the newest snapshot, in seconds
+     */
+    explicit SimInterpolationBuffer(const SimConfig& config = SimConfig{}, float delay = 0.1f,
+        float extrapolation = 0.25f);
+
+    /**
+     * Drop every snapshot and the clock estimate, e.g. when joining a server with other settings
+     */
+    void reset(const SimConfig& config);
+
+    void setDelay(float seconds) { delay = seconds; }
+    float getDelay() const { return delay; }
+
+    /**
+     * Add a complete snapshot; ticks not newer than the newest one kept are ignored
+     * @param tick Server tick of the snapshot
+     * @param entities Its active entities, in id order
+     * @param arrival Local time the snapshot was complete, in seconds
+     */
+    void push(uint32_t tick, const std::vector<NetEntityState>& entities, double arrival);
+
+    /**
+     * Entities as they were the buffer's delay before the server time estimated for now
+     * @param now Local time, on the clock push was given
+     * @param out Receives the entities in id order
+     * @return false before the first snapshot
+     */
+    bool sample(double now, std::vector<NetEntityState>& out) const;
+
+    /**
+     * Server tick sample shows at a local time, between two ticks while interpolating
+     * @return false before the first snapshot
+     */
+    bool shownTick(double now, double& tick) const;
+
+private:
+    struct Frame {
+        uint32_t tick = 0;
+        std::vector<NetEntityState> entities;
+    };
+
+    // Blend two states of one entity interval seconds apart; across a wrap the nearer one is coasted instead
+    NetEntityState blend(const NetEntityState& a, const NetEntityState& b, float alpha, float interval) const;
+
+    SimConfig config;
+    double tickSeconds;
+    float delay;
+    float extrapolation;
+    std::vector<Frame> frames;  // Ring of snapshots, oldest at first
+    size_t first = 0;
+    size_t count = 0;
+    double clockOffset = 0.0;   // Server time minus local time, in seconds
+    bool hasClock = false;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*******************************************************************************
+ * Client-side prediction of the local ship with server reconciliation.
+ ******************************************************************************/
+
+#include <cmath>
+#include "SimPrediction.h"
+
+SimShipPredictor::SimShipPredictor(const SimConfig& config) : history(SIM_PREDICTION_HISTORY) {
+    reset(config);
+}
+
+void SimShipPredictor::reset(const SimConfig& config) {
+    this->config = config;
+    dt = SimTickSeconds(config.tickRate);
+    current = SimEntity{};
+    started = false;
+    newest = 0;
+    for (Command& command : history) command = Command{};
+}
+
+void SimShipPredictor::apply(uint16_t sequence, uint8_t buttons) {
+    Command& command = history[sequence % SIM_PREDICTION_HISTORY];
+    command.sequence = sequence;
+    command.used = true;
+    command.buttons = buttons;
+    command.predicted = started;
+    if (started) {
+        SimStepShip(current, buttons, dt, config);
+        command.state = current;
+    }
+    newest = sequence;
+}
+
+float SimShipPredictor::reconcile(uint16_t sequence, const NetEntityState& server) {
+    // Snapshots carry the quantized state the prediction also keeps, so a hit compares equal
+    const Command& command = history[sequence % SIM_PREDICTION_HISTORY];
+    if (started && command.used && command.predicted && command.sequence == sequence &&
+        command.state.pos.x == server.posX && command.state.pos.y == server.posY &&
+        command.state.vel.x == server.velX && command.state.vel.y == server.velY &&
+        command.state.dir == server.dir) {
+        return 0.0f;
+    }
+
+    SimEntity from{};
+    from.active = true;
+    from.type = SIM_SHIP;
+    from.owner = server.owner;
+    from.scale = SimScaleOf(SIM_SHIP, 0);
+    from.pos = { server.posX, server.posY };
+    from.vel = { server.velX, server.velY };
+    from.dir = server.dir;
+
+    const SimVec2 before = current.pos;
+    const bool wasStarted = started;
+    replay(sequence, from);
+    started = true;
+    return wasStarted ? std::hypot(current.pos.x - before.x, current.pos.y - before.y) : 0.0f;
+}
+
+void SimShipPredictor::replay(uint16_t sequence, const SimEntity& from) {
+    current = from;
+    if (!NetSequenceNewer(newest, sequence)) return; // The server has applied everything sent
+
+    // Commands older than the history are gone; start at the oldest one kept
+    uint16_t first = static_cast<uint16_t>(sequence + 1);
+    if (static_cast<uint16_t>(newest - sequence) > SIM_PREDICTION_HISTORY) {
+        first = static_cast<uint16_t>(newest - SIM_PREDICTION_HISTORY + 1);
+    }
+    for (uint16_t s = first; ; ++s) {
+        Command& command = history[s % SIM_PREDICTION_HISTORY];
+        if (command.used && command.sequence == s) {
+            SimStepShip(current, command.buttons, dt, config);
+            command.state = current;
+            command.predicted = true;
+        }
+        if (s == newest) break;
+    }
+}
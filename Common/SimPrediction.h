@@ -0,0 +1,74 @@
+/*******************************************************************************
+ * Client-side prediction of the local ship with server reconciliation.
+ *
+ * The client applies each input command to its own ship the moment it is
+ * issued, with the same SimStepShip the server runs, and keeps the commands
+ * with the state each produced. Snapshots report the server's ship together
+ * with the last command it applied; if that state differs from what was
+ * predicted for the command, the ship is reset to the server's state and the
+ * commands the server has not applied yet are replayed on top of it.
+ ******************************************************************************/
+
+#ifndef _SIMPREDICTION_H_
+#define _SIMPREDICTION_H_
+
+#include <cstdint>
+#include <vector>
+#include "Protocol.h"
+#include "SimWorld.h"
+
+// Commands kept for replay; two seconds at 60 ticks per second, well beyond a round trip.
+#define SIM_PREDICTION_HISTORY  128
+
+class SimShipPredictor {
+public:
+    explicit SimShipPredictor(const SimConfig& config = SimConfig{});
+
+    /**
+     * Forget the ship and every command, e.g. when joining a server with other settings
+     */
+    void reset(const SimConfig& config);
+
+    /**
+     * Apply a new command to the predicted ship and keep it for replay.
+     * Before the server's first state arrives the command is only kept.
+     */
+    void apply(uint16_t sequence, uint8_t buttons);
+
+    /**
+     * Correct the prediction with the server's ship as it was after applying command sequence
+     * @return How far the corrected ship is from where it was predicted, 0 if the prediction held
+     */
+    float reconcile(uint16_t sequence, const NetEntityState& server);
+
+    /**
+     * @return false until the server's first state has arrived
+     */
+    bool hasShip() const { return started; }
+
+    /**
+     * @return The predicted ship after the newest command
+     */
+    const SimEntity& ship() const { return current; }
+
+private:
+    struct Command {
+        uint16_t sequence = 0;
+        bool used = false;      // The slot holds a command
+        bool predicted = false; // state is the ship after the command
+        uint8_t buttons = 0;
+        SimEntity state;
+    };
+
+    // Start from a state and apply every kept command newer than sequence
+    void replay(uint16_t sequence, const SimEntity& from);
+
+    SimConfig config;
+    float dt;
+    SimEntity current;
+    bool started = false;
+    uint16_t newest = 0;        // Newest command applied
+    std::vector<Command> history; // history[sequence % SIM_PREDICTION_HISTORY]
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * World snapshots for delta compression, shared by the client and the server.
+ ******************************************************************************/
+
+#include "SimSnapshot.h"
+
+void SimSnapshotCapture(const SimWorld& world, SimSnapshot& snapshot) {
+    const std::vector<SimEntity>& entities = world.entities();
+    snapshot.tick = world.tick();
+    for (size_t id = 0; id < entities.size() && id < snapshot.entities.size(); ++id) {
+        const SimEntity& entity = entities[id];
+        SimSnapshotEntity& slot = snapshot.entities[id];
+        slot.active = entity.active;
+        slot.spawn = entity.spawn;
+        slot.state = NetEntityState{ static_cast<uint16_t>(id), entity.type, entity.owner, entity.scaleClass,
+            entity.pos.x, entity.pos.y, entity.vel.x, entity.vel.y, entity.dir };
+    }
+}
+
+SimSnapshotEntity SimSnapshotPredictEntity(const SimSnapshotEntity& baseline, uint32_t ticks,
+    const SimConfig& config) {
+    SimSnapshotEntity slot = baseline;
+    if (!slot.active) return slot;
+
+    const float dt = SimTickSeconds(config.tickRate);
+    SimVec2 pos{ slot.state.posX, slot.state.posY };
+    const SimVec2 vel{ slot.state.velX, slot.state.velY };
+    for (uint32_t i = 0; i < ticks; ++i) {
+        pos = SimCoast(slot.state.type, pos, vel, dt, config);
+    }
+    slot.state.posX = pos.x;
+    slot.state.posY = pos.y;
+    return slot;
+}
+
+void SimSnapshotPredict(const SimSnapshot& baseline, uint32_t tick, const SimConfig& config,
+    SimSnapshot& predicted) {
+    const uint32_t ticks = tick - baseline.tick;
+
+    predicted.tick = tick;
+    for (size_t id = 0; id < baseline.entities.size(); ++id) {
+        predicted.entities[id] = SimSnapshotPredictEntity(baseline.entities[id], ticks, config);
+    }
+}
+
+uint8_t SimSnapshotDiff(const SimSnapshotEntity& predicted, const SimSnapshotEntity& current) {
+    if (!current.active) {
+        return predicted.active ? NET_ENTITY_DESTROY : 0;
+    }
+
+    // A new object in the slot goes out whole, even if the slot was busy in the baseline
+    if (!predicted.active || predicted.spawn != current.spawn) {
+        return NET_ENTITY_CREATE | NET_ENTITY_POS | NET_ENTITY_VEL | NET_ENTITY_DIR;
+    }
+
+    const NetEntityState& a = predicted.state;
+    const NetEntityState& b = current.state;
+    uint8_t mask = 0;
+    if (a.posX != b.posX || a.posY != b.posY) mask |= NET_ENTITY_POS;
+    if (a.velX != b.velX || a.velY != b.velY) mask |= NET_ENTITY_VEL;
+    if (a.dir != b.dir) mask |= NET_ENTITY_DIR;
+    return mask;
+}
+
+void SimSnapshotApply(SimSnapshotEntity& entity, uint8_t mask, const NetEntityState& delta) {
+    if (mask & NET_ENTITY_DESTROY) {
+        entity.active = false;
+        return;
+    }
+    if (mask & NET_ENTITY_CREATE) {
+        entity.active = true;
+        entity.state.id = delta.id;
+        entity.state.type = delta.type;
+        entity.state.owner = delta.owner;
+        entity.state.scaleClass = delta.scaleClass;
+    }
+    if (mask & NET_ENTITY_POS) {
+        entity.state.posX = delta.posX;
+        entity.state.posY = delta.posY;
+    }
+    if (mask & NET_ENTITY_VEL) {
+        entity.state.velX = delta.velX;
+        entity.state.velY = delta.velY;
+    }
+    if (mask & NET_ENTITY_DIR) {
+        entity.state.dir = delta.dir;
+    }
+}
+
+SimSnapshot& SimSnapshotRing::push(uint32_t tick) {
+    SimSnapshot& slot = slots[tick % SIM_SNAPSHOT_HISTORY];
+    slot.tick = tick;
+    return slot;
+}
+
+const SimSnapshot* SimSnapshotRing::find(uint32_t tick) const {
+    const SimSnapshot& slot = slots[tick % SIM_SNAPSHOT_HISTORY];
+    return (tick != 0 && slot.tick == tick) ? &slot : nullptr;
+}
@@ -0,0 +1,74 @@
+/*******************************************************************************
+ * World snapshots for delta compression, shared by the client and the server.
+ *
+ * The server captures the world on every snapshot tick into a ring of recent
+ * snapshots. Each client acknowledges the newest snapshot it has complete, and
+ * the server sends only the entities that differ from that baseline once both
+ * ends have predicted it forward to the current tick with SimCoast. Asteroids
+ * and bullets that only coasted match the prediction exactly and cost nothing.
+ ******************************************************************************/
+
+#ifndef _SIMSNAPSHOT_H_
+#define _SIMSNAPSHOT_H_
+
+#include <cstdint>
+#include <vector>
+#include "Protocol.h"
+#include "SimWorld.h"
+
+// Snapshots kept for use as baselines; older acknowledgements fall back to a full snapshot.
+#define SIM_SNAPSHOT_HISTORY    32
+
+// One entity slot of a snapshot.
+struct SimSnapshotEntity {
+    bool active = false;
+    uint16_t spawn = 0;         // Slot reuse counter of the server's world; not sent
+    NetEntityState state{};
+};
+
+// The world's entities at one tick, indexed by entity id.
+struct SimSnapshot {
+    uint32_t tick = 0;          // 0 while the snapshot holds no tick
+    std::vector<SimSnapshotEntity> entities;
+
+    SimSnapshot() : entities(SIM_ENTITY_MAX) {}
+};
+
+// Copy the world's entities into a snapshot of its current tick.
+void SimSnapshotCapture(const SimWorld& world, SimSnapshot& snapshot);
+
+// Advance one baseline slot by a number of ticks as if it coasted.
+SimSnapshotEntity SimSnapshotPredictEntity(const SimSnapshotEntity& baseline, uint32_t ticks,
+    const SimConfig& config);
+
+// Advance a baseline to the given tick as if every entity coasted.
+void SimSnapshotPredict(const SimSnapshot& baseline, uint32_t tick, const SimConfig& config,
+    SimSnapshot& predicted);
+
+// Change mask (NET_ENTITY_*) that turns the predicted slot into the current one, 0 if they match.
+uint8_t SimSnapshotDiff(const SimSnapshotEntity& predicted, const SimSnapshotEntity& current);
+
+// Apply a delta read with NetReadEntityDelta to a predicted slot.
+void SimSnapshotApply(SimSnapshotEntity& entity, uint8_t mask, const NetEntityState& delta);
+
+// Fixed ring of the most recent snapshots, looked up by tick.
+class SimSnapshotRing {
+public:
+    SimSnapshotRing() : slots(SIM_SNAPSHOT_HISTORY) {}
+
+    /**
+     * Take the slot for a tick, evicting the snapshot SIM_SNAPSHOT_HISTORY ticks older
+     * @return The slot, with its tick set and its entities left for the caller to fill
+     */
+    SimSnapshot& push(uint32_t tick);
+
+    /**
+     * @return The snapshot of a tick, or nullptr if it was never pushed or has been evicted
+     */
+    const SimSnapshot* find(uint32_t tick) const;
+
+private:
+    std::vector<SimSnapshot> slots;     // slots[tick % SIM_SNAPSHOT_HISTORY]
+};
+
+#endif
@@ -0,0 +1,486 @@
+/*******************************************************************************
+ * Headless asteroid-field simulation shared by the client and the server.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "SimWorld.h"
+#include "Protocol.h"
+
+// Tuning, identical to GameState_Asteroids.cpp
+static const float SIM_PI = 3.14159265358979323846f;
+static const int SHIP_INITIAL_NUM = 3;              // Initial number of ship lives
+static const uint32_t SCORE_MAX = 5000;             // Score at which a player has won
+static const float SHIP_SCALE_X = 16.0f;
+static const float SHIP_SCALE_Y = 16.0f;
+static const float BULLET_SCALE_X = 20.0f;
+static const float BULLET_SCALE_Y = 3.0f;
+static const int ASTEROID_MIN_STEPS = 2;            // 10 pixels
+static const int ASTEROID_MAX_STEPS = 12;           // 60 pixels
+static const float ASTEROID_MAX_SCALE = ASTEROID_MAX_STEPS * SIM_SCALE_STEP;
+static const float WALL_SCALE_X = 64.0f;
+static const float WALL_SCALE_Y = 164.0f;
+static const float SHIP_ACCEL_FORWARD = 100.0f;
+static const float SHIP_ACCEL_BACKWARD = 100.0f;
+static const float SHIP_ROT_SPEED = 2.0f * SIM_PI;
+static const float SHIP_FRICTION = 0.99f;
+static const float BULLET_SPEED = 400.0f;
+static const float BOUNDING_RECT_SIZE = 1.0f;
+
+// Wrap x into [low, high], as AEWrap
+static float wrap(float x, float low, float high) {
+    float range = high - low;
+    if (range <= 0.0f) return low;
+    if (x < low) return x + range;
+    if (x > high) return x - range;
+    return x;
+}
+
+// Wrap ships and asteroids around the field; other types keep their position
+static SimVec2 wrapPosition(uint8_t type, SimVec2 pos, const SimConfig& config) {
+    const float halfWidth = config.width / 2.0f;
+    const float halfHeight = config.height / 2.0f;
+    if (type == SIM_SHIP) {
+        pos.x = wrap(pos.x, -halfWidth - SHIP_SCALE_X, halfWidth + SHIP_SCALE_X);
+        pos.y = wrap(pos.y, -halfHeight - SHIP_SCALE_Y, halfHeight + SHIP_SCALE_Y);
+    }
+    else if (type == SIM_ASTEROID) {
+        pos.x = wrap(pos.x, -halfWidth - ASTEROID_MAX_SCALE, halfWidth + ASTEROID_MAX_SCALE);
+        pos.y = wrap(pos.y, -halfHeight - ASTEROID_MAX_SCALE, halfHeight + ASTEROID_MAX_SCALE);
+    }
+    return pos;
+}
+
+static float dot(const SimVec2& a, const SimVec2& b) {
+    return a.x * b.x + a.y * b.y;
+}
+
+void SimApplyShipInput(SimEntity& ship, uint8_t buttons, float dt) {
+    // v1 = a*t + v0, then friction; the direction vector is already unit length
+    if (buttons & SIM_INPUT_UP) {
+        ship.vel.x = (ship.vel.x + std::cos(ship.dir) * SHIP_ACCEL_FORWARD * dt) * SHIP_FRICTION;
+        ship.vel.y = (ship.vel.y + std::sin(ship.dir) * SHIP_ACCEL_FORWARD * dt) * SHIP_FRICTION;
+    }
+    if (buttons & SIM_INPUT_DOWN) {
+        ship.vel.x = (ship.vel.x - std::cos(ship.dir) * SHIP_ACCEL_BACKWARD * dt) * SHIP_FRICTION;
+        ship.vel.y = (ship.vel.y - std::sin(ship.dir) * SHIP_ACCEL_BACKWARD * dt) * SHIP_FRICTION;
+    }
+    if (buttons & SIM_INPUT_LEFT) {
+        ship.dir = wrap(ship.dir + SHIP_ROT_SPEED * dt, -SIM_PI, SIM_PI);
+    }
+    if (buttons & SIM_INPUT_RIGHT) {
+        ship.dir = wrap(ship.dir - SHIP_ROT_SPEED * dt, -SIM_PI, SIM_PI);
+    }
+}
+
+void SimStepShip(SimEntity& ship, uint8_t buttons, float dt, const SimConfig& config) {
+    SimApplyShipInput(ship, buttons, dt);
+    ship.pos.x += ship.vel.x * dt;
+    ship.pos.y += ship.vel.y * dt;
+    ship.pos = wrapPosition(SIM_SHIP, ship.pos, config);
+    SimQuantize(ship);
+}
+
+uint8_t SimScaleClass(int stepsX, int stepsY) {
+    stepsX = std::clamp(stepsX, 1, SIM_SCALE_STEPS_MAX);
+    stepsY = std::clamp(stepsY, 1, SIM_SCALE_STEPS_MAX);
+    return static_cast<uint8_t>(((stepsX - 1) << 4) | (stepsY - 1));
+}
+
+SimVec2 SimScaleOf(uint8_t type, uint8_t scaleClass) {
+    switch (type) {
+    case SIM_SHIP: return { SHIP_SCALE_X, SHIP_SCALE_Y };
+    case SIM_BULLET: return { BULLET_SCALE_X, BULLET_SCALE_Y };
+    case SIM_WALL: return { WALL_SCALE_X, WALL_SCALE_Y };
+    default:
+        return { static_cast<float>((scaleClass >> 4) + 1) * SIM_SCALE_STEP,
+            static_cast<float>((scaleClass & 0x0F) + 1) * SIM_SCALE_STEP };
+    }
+}
+
+void SimQuantize(SimEntity& entity) {
+    entity.pos.x = NET_QUANT_POS.quantize(entity.pos.x);
+    entity.pos.y = NET_QUANT_POS.quantize(entity.pos.y);
+    entity.vel.x = NET_QUANT_VEL.quantize(entity.vel.x);
+    entity.vel.y = NET_QUANT_VEL.quantize(entity.vel.y);
+    entity.dir = NET_QUANT_DIR.quantize(entity.dir);
+}
+
+bool SimPlayerOut(const SimPlayer& player) {
+    return player.lives < 0 || player.score >= SCORE_MAX;
+}
+
+float SimTickSeconds(int tickRate) {
+    return 1.0f / static_cast<float>(std::max(1, tickRate));
+}
+
+SimVec2 SimCoast(uint8_t type, SimVec2 pos, SimVec2 vel, float dt, const SimConfig& config) {
+    // Same operations as the move, wrap and quantization of SimWorld::step, so the result matches bit for bit
+    pos.x += vel.x * dt;
+    pos.y += vel.y * dt;
+    pos = wrapPosition(type, pos, config);
+    pos.x = NET_QUANT_POS.quantize(pos.x);
+    pos.y = NET_QUANT_POS.quantize(pos.y);
+    return pos;
+}
+
+bool SimCollideAabb(const SimAabb& a, const SimVec2& velA, const SimAabb& b, const SimVec2& velB,
+    float dt, float& firstTimeOfCollision) {
+    // Static overlap
+    if (a.max.x > b.min.x && a.max.y > b.min.y && b.max.x > a.min.x && b.max.y > a.min.y) {
+        return true;
+    }
+
+    // Dynamic: sweep b relative to a over the tick
+    firstTimeOfCollision = 0.0f;
+    float tLast = dt;
+    SimVec2 vb{ velB.x - velA.x, velB.y - velA.y };
+
+    const float aMin[2] = { a.min.x, a.min.y };
+    const float aMax[2] = { a.max.x, a.max.y };
+    const float bMin[2] = { b.min.x, b.min.y };
+    const float bMax[2] = { b.max.x, b.max.y };
+    const float v[2] = { vb.x, vb.y };
+    for (int axis = 0; axis < 2; ++axis) {
+        if (v[axis] < 0.0f) {
+            if (aMin[axis] > bMax[axis]) return false;
+            if (aMax[axis] < bMin[axis]) firstTimeOfCollision = std::max((aMax[axis] - bMin[axis]) / v[axis], firstTimeOfCollision);
+            if (aMin[axis] < bMax[axis]) tLast = std::min((aMin[axis] - bMax[axis]) / v[axis], tLast);
+        }
+        else if (v[axis] > 0.0f) {
+            if (aMin[axis] > bMax[axis]) firstTimeOfCollision = std::max((aMin[axis] - bMax[axis]) / v[axis], firstTimeOfCollision);
+            if (aMax[axis] > bMin[axis]) tLast = std::min((aMax[axis] - bMin[axis]) / v[axis], tLast);
+            if (aMax[axis] < bMin[axis]) return false;
+        }
+        else if (aMax[axis] < bMin[axis] || aMin[axis] > bMax[axis]) {
+            return false;
+        }
+    }
+
+    return firstTimeOfCollision <= tLast;
+}
+
+SimWorld::SimWorld(const SimConfig& config) :
+    config(config),
+    dt(SimTickSeconds(config.tickRate)),
+    entityList(SIM_ENTITY_MAX),
+    random(config.seed) {
+    if (config.maxRewind > 0) history.resize(static_cast<size_t>(SIM_REWIND_TICKS) * SIM_ENTITY_MAX);
+
+    // The four opening asteroids and the static wall of GameStateAsteroidsInit
+    spawnAsteroid({ 90.0f, -220.0f }, { -60.0f, -30.0f }, SimScaleClass(ASTEROID_MIN_STEPS, ASTEROID_MAX_STEPS));
+    spawnAsteroid({ -260.0f, -250.0f }, { 39.0f, -130.0f }, SimScaleClass(ASTEROID_MAX_STEPS, ASTEROID_MIN_STEPS));
+    spawnAsteroid({ -200.0f, -150.0f }, { 40.0f, -200.0f }, SimScaleClass(ASTEROID_MAX_STEPS / 2, ASTEROID_MIN_STEPS / 2));
+    spawnAsteroid({ 300.0f, -115.0f }, { -25.0f, -100.0f }, SimScaleClass(ASTEROID_MIN_STEPS / 2, ASTEROID_MAX_STEPS / 2));
+
+    SimEntity* wallEntity = create(SIM_WALL, 0, { 300.0f, 150.0f }, { 0.0f, 0.0f }, 0.0f);
+    wall = static_cast<uint16_t>(wallEntity - entityList.data());
+}
+
+// Bounding box of an object of the given size at a position
+static SimAabb boundingBox(SimVec2 scale, SimVec2 pos) {
+    return SimAabb{
+        { -(BOUNDING_RECT_SIZE / 2.0f) * scale.x + pos.x, -(BOUNDING_RECT_SIZE / 2.0f) * scale.y + pos.y },
+        { (BOUNDING_RECT_SIZE / 2.0f) * scale.x + pos.x, (BOUNDING_RECT_SIZE / 2.0f) * scale.y + pos.y }
+    };
+}
+
+// Bounding box of an entity at its previous position
+static SimAabb boundingBox(const SimEntity& entity) {
+    return boundingBox(entity.scale, entity.posPrev);
+}
+
+SimEntity* SimWorld::create(uint8_t type, uint8_t scaleClass, SimVec2 pos, SimVec2 vel, float dir, uint16_t owner) {
+    for (SimEntity& entity : entityList) {
+        if (entity.active) continue;
+        uint16_t spawn = static_cast<uint16_t>(entity.spawn + 1);
+        entity = SimEntity{};
+        entity.active = true;
+        entity.type = type;
+        entity.spawn = spawn;
+        entity.owner = owner;
+        entity.scaleClass = scaleClass;
+        entity.scale = SimScaleOf(type, scaleClass);
+        entity.pos = pos;
+        entity.vel = vel;
+        entity.dir = dir;
+        SimQuantize(entity);
+        entity.posPrev = entity.pos;
+        entity.box = boundingBox(entity);
+        return &entity;
+    }
+    return nullptr; // World is full
+}
+
+void SimWorld::destroy(SimEntity& entity) {
+    entity.active = false;
+}
+
+int SimWorld::randomRange(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(random);
+}
+
+void SimWorld::spawnAsteroid(SimVec2 pos, SimVec2 vel, uint8_t scaleClass) {
+    create(SIM_ASTEROID, scaleClass, pos, vel, 0.0f);
+}
+
+SimVec2 SimWorld::randomRespawnPos() {
+    // Just above the top edge, so a replacement asteroid wraps in rather than appearing on a ship
+    const int halfWidth = static_cast<int>(config.width / 2);
+    return { static_cast<float>(randomRange(-halfWidth - 100, halfWidth + 500)), config.height / 2 + 100.0f };
+}
+
+uint8_t SimWorld::randomScaleClass() {
+    int stepsX = randomRange(ASTEROID_MIN_STEPS, ASTEROID_MAX_STEPS);
+    int stepsY = randomRange(ASTEROID_MIN_STEPS, ASTEROID_MAX_STEPS);
+    return SimScaleClass(stepsX, stepsY);
+}
+
+uint16_t SimWorld::spawnShip(uint16_t playerId) {
+    // Anywhere in the field, so a crowd of players does not start on one spot
+    SimVec2 pos{
+        static_cast<float>(randomRange(static_cast<int>(-config.width / 2), static_cast<int>(config.width / 2))),
+        static_cast<float>(randomRange(static_cast<int>(-config.height / 2), static_cast<int>(config.height / 2)))
+    };
+    SimEntity* ship = create(SIM_SHIP, 0, pos, { 0.0f, 0.0f }, 0.0f, playerId);
+    return ship ? static_cast<uint16_t>(ship - entityList.data()) : SIM_ENTITY_NONE;
+}
+
+uint16_t SimWorld::addPlayer() {
+    size_t slot = 0;
+    while (slot < players.size() && players[slot].active) ++slot;
+    if (slot == players.size()) {
+        if (players.size() >= 0xFFFF) return 0;
+        players.emplace_back();
+    }
+
+    uint16_t playerId = static_cast<uint16_t>(slot + 1);
+    SimPlayer& player = players[slot];
+    player = SimPlayer{};
+    player.ship = spawnShip(playerId); // Retried every tick while the world is full
+    player.active = true;
+    player.lives = SHIP_INITIAL_NUM;
+    ++activePlayers;
+    return playerId;
+}
+
+void SimWorld::removePlayer(uint16_t playerId) {
+    if (playerId == 0 || playerId > players.size() || !players[playerId - 1].active) return;
+    SimPlayer& player = players[playerId - 1];
+    if (player.ship != SIM_ENTITY_NONE) destroy(entityList[player.ship]);
+
+    // Bullets still in flight go too, or a player that joins into the same slot would score their hits
+    for (SimEntity& entity : entityList) {
+        if (entity.active && entity.type == SIM_BULLET && entity.owner == playerId) destroy(entity);
+    }
+    player.active = false;
+    --activePlayers;
+}
+
+void SimWorld::queueInput(uint16_t playerId, const SimInput& input) {
+    if (playerId == 0 || playerId > players.size() || !players[playerId - 1].active) return;
+    SimPlayer& player = players[playerId - 1];
+    if (player.hasQueued && !NetSequenceNewer(input.sequence, player.lastQueued)) return;
+
+    // A client running ahead of the server drops its oldest commands rather than lagging further
+    if (player.queueCount == SIM_INPUT_QUEUE) {
+        player.queueHead = (player.queueHead + 1) % SIM_INPUT_QUEUE;
+        --player.queueCount;
+    }
+    player.queue[(player.queueHead + player.queueCount) % SIM_INPUT_QUEUE] = input;
+    ++player.queueCount;
+    player.lastQueued = input.sequence;
+    player.hasQueued = true;
+}
+
+const SimPlayer* SimWorld::player(uint16_t playerId) const {
+    if (playerId == 0 || playerId > players.size() || !players[playerId - 1].active) return nullptr;
+    return &players[playerId - 1];
+}
+
+void SimWorld::step() {
+    // Input: only for players still in the game
+    for (SimPlayer& player : players) {
+        if (!player.active || SimPlayerOut(player)) continue;
+        uint16_t owner = static_cast<uint16_t>(&player - players.data() + 1);
+        if (player.ship == SIM_ENTITY_NONE) player.ship = spawnShip(owner);
+        if (player.ship == SIM_ENTITY_NONE) continue;
+        SimEntity& ship = entityList[player.ship];
+
+        // Without a new command the held buttons carry on, but a shot is not fired twice
+        if (player.queueCount > 0) {
+            player.input = player.queue[player.queueHead];
+            player.queueHead = (player.queueHead + 1) % SIM_INPUT_QUEUE;
+            --player.queueCount;
+        }
+        else {
+            player.input.buttons &= ~SIM_INPUT_FIRE;
+        }
+        SimApplyShipInput(ship, player.input.buttons, dt);
+
+        if (player.input.buttons & SIM_INPUT_FIRE) {
+            SimEntity* bullet = create(SIM_BULLET, 0, ship.pos,
+                { BULLET_SPEED * std::cos(ship.dir), BULLET_SPEED * std::sin(ship.dir) }, ship.dir, owner);
+            if (bullet) bullet->rewind = rewindFor(player.input.viewTick);
+        }
+    }
+
+    // Save previous positions, build the bounding boxes from them, then move
+    for (SimEntity& entity : entityList) {
+        if (!entity.active) continue;
+        entity.posPrev = entity.pos;
+        entity.box = boundingBox(entity);
+        entity.pos.x += entity.vel.x * dt;
+        entity.pos.y += entity.vel.y * dt;
+    }
+    record();
+
+    // Dynamic-static: ships against the wall
+    for (SimEntity& entity : entityList) {
+        if (entity.active && entity.type == SIM_SHIP) collideWall(entity);
+    }
+
+    // Dynamic-dynamic: asteroids against ships and bullets
+    collideAsteroids();
+
+    // Wrap ships and asteroids around the field, drop bullets that leave it
+    const float halfWidth = config.width / 2.0f;
+    const float halfHeight = config.height / 2.0f;
+    for (SimEntity& entity : entityList) {
+        if (!entity.active) continue;
+        if (entity.type == SIM_SHIP || entity.type == SIM_ASTEROID) {
+            entity.pos = wrapPosition(entity.type, entity.pos, config);
+        }
+        else if (entity.type == SIM_BULLET) {
+            if (entity.pos.x > halfWidth || entity.pos.x < -halfWidth ||
+                entity.pos.y > halfHeight || entity.pos.y < -halfHeight) {
+                destroy(entity);
+            }
+        }
+    }
+
+    // Keep only what a snapshot can carry, so clients predict from the same numbers
+    for (SimEntity& entity : entityList) {
+        if (entity.active) SimQuantize(entity);
+    }
+
+    ++tickCount;
+}
+
+void SimWorld::record() {
+    if (history.empty()) return;
+
+    // Only asteroids are rewound; everything else is kept inactive
+    SimPastEntity* past = &history[(tickCount % SIM_REWIND_TICKS) * SIM_ENTITY_MAX];
+    for (size_t id = 0; id < entityList.size(); ++id) {
+        const SimEntity& entity = entityList[id];
+        past[id].spawn = entity.spawn;
+        past[id].active = entity.active && entity.type == SIM_ASTEROID;
+        past[id].posPrev = entity.posPrev;
+        past[id].vel = entity.vel;
+    }
+    historyTicks = std::min<uint32_t>(historyTicks + 1, SIM_REWIND_TICKS);
+}
+
+uint8_t SimWorld::rewindFor(uint32_t viewTick) const {
+    if (history.empty() || viewTick == 0) return 0;
+    const int32_t lag = static_cast<int32_t>(tickCount - viewTick);
+    const int32_t window = std::min(config.maxRewind, SIM_REWIND_TICKS - 1);
+    return static_cast<uint8_t>(std::clamp(lag, 0, window));
+}
+
+bool SimWorld::rewound(uint16_t id, uint8_t ticks, SimAabb& box, SimVec2& vel) const {
+    // No further back than recorded; the current tick is recorded before collisions
+    const uint32_t back = std::min<uint32_t>(ticks, historyTicks - 1);
+    const SimPastEntity& past = history[((tickCount - back) % SIM_REWIND_TICKS) * SIM_ENTITY_MAX + id];
+    const SimEntity& entity = entityList[id];
+    if (!past.active || past.spawn != entity.spawn) return false; // Not there yet in the shooter's view
+
+    box = boundingBox(entity.scale, past.posPrev);
+    vel = past.vel;
+    return true;
+}
+
+void SimWorld::collideWall(SimEntity& ship) {
+    const SimEntity& wallEntity = entityList[wall];
+
+    // Only respond when the ship is moving towards a face of the wall
+    SimVec2 toMin{ ship.posPrev.x - wallEntity.box.min.x, ship.posPrev.y - wallEntity.box.min.y };
+    SimVec2 toMax{ ship.posPrev.x - wallEntity.box.max.x, ship.posPrev.y - wallEntity.box.max.y };
+    const SimVec2 down{ 0.0f, -1.0f };
+    const SimVec2 right{ 1.0f, 0.0f };
+    const SimVec2 up{ 0.0f, 1.0f };
+    const SimVec2 left{ -1.0f, 0.0f };
+    bool approaching =
+        (dot(toMin, down) >= 0.0f && dot(ship.vel, down) <= 0.0f) ||
+        (dot(toMax, right) >= 0.0f && dot(ship.vel, right) <= 0.0f) ||
+        (dot(toMax, up) >= 0.0f && dot(ship.vel, up) <= 0.0f) ||
+        (dot(toMin, left) >= 0.0f && dot(ship.vel, left) <= 0.0f);
+    if (!approaching) return;
+
+    float firstTimeOfCollision = 0.0f;
+    if (SimCollideAabb(ship.box, ship.vel, wallEntity.box, wallEntity.vel, dt, firstTimeOfCollision)) {
+        // Stop the ship where it first touched the wall
+        ship.pos.x = ship.vel.x * firstTimeOfCollision + ship.posPrev.x;
+        ship.pos.y = ship.vel.y * firstTimeOfCollision + ship.posPrev.y;
+        ship.vel = { 0.0f, 0.0f };
+    }
+}
+
+void SimWorld::collideAsteroids() {
+    // Only ships and bullets hit asteroids; gather them once instead of rescanning every slot per asteroid
+    targets.clear();
+    for (uint16_t i = 0; i < entityList.size(); ++i) {
+        const SimEntity& entity = entityList[i];
+        if (!entity.active || (entity.type != SIM_SHIP && entity.type != SIM_BULLET)) continue;
+        if (entity.owner == 0 || entity.owner > players.size()) continue;
+        targets.push_back(i);
+    }
+
+    for (SimEntity& asteroid : entityList) {
+        if (!asteroid.active || asteroid.type != SIM_ASTEROID) continue;
+
+        for (uint16_t target : targets) {
+            SimEntity& other = entityList[target];
+            if (!other.active || (other.type != SIM_SHIP && other.type != SIM_BULLET)) continue;
+            SimPlayer& owner = players[other.owner - 1];
+
+            float tFirst = 0.0f;
+            if (other.type == SIM_SHIP) {
+                // Ships of players who are out of the game no longer collide
+                if (SimPlayerOut(owner)) continue;
+                if (!SimCollideAabb(asteroid.box, asteroid.vel, other.box, other.vel, dt, tFirst)) continue;
+
+                destroy(asteroid);
+                destroy(other);
+                owner.ship = spawnShip(other.owner);
+                spawnAsteroid(
+                    randomRespawnPos(),
+                    { static_cast<float>(randomRange(-100, 100)), static_cast<float>(randomRange(-100, 100)) },
+                    randomScaleClass());
+                --owner.lives;
+                break;
+            }
+
+            // A bullet meets the asteroid where its shooter saw it, not where it is now
+            SimAabb seenBox = asteroid.box;
+            SimVec2 seenVel = asteroid.vel;
+            if (other.rewind > 0 &&
+                !rewound(static_cast<uint16_t>(&asteroid - entityList.data()), other.rewind, seenBox, seenVel)) {
+                continue;
+            }
+            if (!SimCollideAabb(seenBox, seenVel, other.box, other.vel, dt, tFirst)) continue;
+
+            // A bullet splits the asteroid into two random ones, mirrored through the origin
+            destroy(asteroid);
+            destroy(other);
+            uint8_t scale = randomScaleClass();
+            SimVec2 pos = randomRespawnPos();
+            SimVec2 vel{ static_cast<float>(randomRange(-100, 100)), static_cast<float>(randomRange(-100, 100)) };
+            spawnAsteroid(pos, vel, scale);
+            spawnAsteroid({ -pos.x, -pos.y }, { vel.x * -1.3f, vel.y * -1.3f }, scale);
+            owner.score += 100;
+            break;
+        }
+    }
+}
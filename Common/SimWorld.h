@@ -0,0 +1,207 @@
+/*******************************************************************************
+ * Headless asteroid-field simulation shared by the client and the server.
+ *
+ * A port of the ship/bullet/asteroid update and collision in
+ * GameState_Asteroids.cpp with no AlphaEngine dependency, so the server can
+ * own the world on any platform. The world advances in fixed ticks of
+ * 1 / tickRate seconds and holds one ship per connected player. At the end of
+ * every tick positions, velocities and directions are snapped onto the wire's
+ * quantization grid, so snapshots carry the server's state exactly.
+ *
+ * Clients show asteroids a little in the past, so a bullet is tested against
+ * the asteroids as its shooter saw them when firing, looked up in a short
+ * history of their bounding boxes and never more than maxRewind ticks back.
+ ******************************************************************************/
+
+#ifndef _SIMWORLD_H_
+#define _SIMWORLD_H_
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Upper bound on live entities, as GAME_OBJ_INST_NUM_MAX on the client.
+#define SIM_ENTITY_MAX      2048
+// Entity id that refers to no entity.
+#define SIM_ENTITY_NONE     0xFFFF
+
+// Input buttons, or-ed together into SimInput::buttons.
+#define SIM_INPUT_UP        0x01    // Thrust forward
+#define SIM_INPUT_DOWN      0x02    // Thrust backward
+#define SIM_INPUT_LEFT      0x04    // Rotate anti-clockwise
+#define SIM_INPUT_RIGHT     0x08    // Rotate clockwise
+#define SIM_INPUT_FIRE      0x10    // Fire one bullet (set on the frame the key was triggered)
+
+// Input commands a player may have queued ahead of the simulation; older ones are dropped.
+#define SIM_INPUT_QUEUE     8
+
+// Ticks of asteroid history kept for lag-compensated shots; a shot is rewound by at most one less.
+#define SIM_REWIND_TICKS    32
+
+// Asteroid sizes go in steps of SIM_SCALE_STEP pixels per axis, 1 to SIM_SCALE_STEPS_MAX steps,
+// packed into one scale class byte.
+#define SIM_SCALE_STEP      5.0f
+#define SIM_SCALE_STEPS_MAX 12
+
+struct SimVec2 {
+    float x;
+    float y;
+};
+
+struct SimAabb {
+    SimVec2 min;
+    SimVec2 max;
+};
+
+enum SimEntityType : uint8_t {
+    SIM_SHIP = 0,
+    SIM_BULLET,
+    SIM_ASTEROID,
+    SIM_WALL
+};
+
+// One live object of the world; the entity's id is its slot index.
+struct SimEntity {
+    bool active = false;
+    uint8_t type = SIM_SHIP;
+    uint16_t spawn = 0;     // Bumped whenever the slot is reused, so a new object is never mistaken for the old one
+    uint16_t owner = 0;     // Player that owns a ship or fired a bullet, 0 for none
+    uint8_t scaleClass = 0; // Size of an asteroid, see SimScaleClass
+    SimVec2 scale{};
+    SimVec2 pos{};
+    SimVec2 posPrev{};
+    SimVec2 vel{};
+    float dir = 0.0f;
+    SimAabb box{};          // Bounding box at the start of the tick
+    uint8_t rewind = 0;     // Ticks back a bullet's hits are tested, as far as its shooter's view trailed the world
+};
+
+// One tick of a player's controls.
+struct SimInput {
+    uint16_t sequence = 0;  // Command number, one per client tick
+    uint8_t buttons = 0;
+    uint32_t viewTick = 0;  // World tick the client was showing when it issued the command, 0 if unknown
+};
+
+struct SimPlayer {
+    bool active = false;
+    uint16_t ship = SIM_ENTITY_NONE; // Entity id of the player's ship
+    int lives = 0;
+    uint32_t score = 0;
+    SimInput input;         // Command of the last tick; its held buttons repeat while none are queued
+    SimInput queue[SIM_INPUT_QUEUE]; // Commands waiting for their tick, one applied per tick
+    uint8_t queueHead = 0;
+    uint8_t queueCount = 0;
+    uint16_t lastQueued = 0; // Newest command queued, to drop repeats and stale ones
+    bool hasQueued = false;
+};
+
+struct SimConfig {
+    int tickRate = 60;          // Ticks per second
+    float width = 800.0f;       // World width, centred on the origin
+    float height = 600.0f;      // World height, centred on the origin
+    uint32_t seed = 1;          // Seed for asteroid respawns
+    int maxRewind = 15;         // Most ticks a shot is rewound by, up to SIM_REWIND_TICKS - 1; 0 turns rewinding off
+};
+
+// Apply one tick of player input to a ship: thrust with friction and rotation.
+// Shared with the client so a locally predicted ship moves exactly as on the server.
+void SimApplyShipInput(SimEntity& ship, uint8_t buttons, float dt);
+
+// One whole world tick of a ship that hits nothing: input, move, wrap and quantization in the
+// order SimWorld::step applies them, so a client replaying its commands lands where the server does.
+void SimStepShip(SimEntity& ship, uint8_t buttons, float dt, const SimConfig& config);
+
+// Whether a player is out of ships or has reached the winning score; its ship no longer plays.
+bool SimPlayerOut(const SimPlayer& player);
+
+// Scale class of an asteroid that is stepsX by stepsY SIM_SCALE_STEPs in size.
+uint8_t SimScaleClass(int stepsX, int stepsY);
+
+// Size of an entity of the given type and scale class.
+SimVec2 SimScaleOf(uint8_t type, uint8_t scaleClass);
+
+// Snap an entity's position, velocity and direction onto the wire's quantization grid.
+void SimQuantize(SimEntity& entity);
+
+// Length of one tick at the given rate, as the world uses it.
+float SimTickSeconds(int tickRate);
+
+// Where an entity of the given type ends up after coasting one tick at vel, wrapped as in a world step.
+// Delta snapshots predict with it on both ends, so an entity that only coasted needs no position on the wire.
+SimVec2 SimCoast(uint8_t type, SimVec2 pos, SimVec2 vel, float dt, const SimConfig& config);
+
+// Swept AABB test of the client's CollisionIntersection_RectRect over one tick of dt seconds.
+bool SimCollideAabb(const SimAabb& a, const SimVec2& velA, const SimAabb& b, const SimVec2& velB,
+    float dt, float& firstTimeOfCollision);
+
+class SimWorld {
+public:
+    explicit SimWorld(const SimConfig& config = SimConfig{});
+
+    /**
+     * Add a player and spawn its ship
+     * @return The player ID (1-based), or 0 if there are no player IDs left
+     */
+    uint16_t addPlayer();
+
+    /**
+     * Remove a player together with its ship and the bullets it fired
+     */
+    void removePlayer(uint16_t playerId);
+
+    /**
+     * Queue a command for a player's ship, applied on the first tick with no older command waiting.
+     * Commands that are not newer than the last one queued are ignored, so redundant copies are harmless.
+     */
+    void queueInput(uint16_t playerId, const SimInput& input);
+
+    /**
+     * Advance the world by one fixed tick
+     */
+    void step();
+
+    uint32_t tick() const { return tickCount; }
+    float tickSeconds() const { return dt; }
+    const SimConfig& settings() const { return config; }
+    const std::vector<SimEntity>& entities() const { return entityList; }
+    const SimPlayer* player(uint16_t playerId) const;
+    int playerCount() const { return activePlayers; }
+    uint16_t playerSlots() const { return static_cast<uint16_t>(players.size()); } // Highest player ID handed out so far
+
+private:
+    // An asteroid's collision state at a past tick
+    struct SimPastEntity {
+        uint16_t spawn = 0;
+        bool active = false;
+        SimVec2 posPrev{};
+        SimVec2 vel{};
+    };
+
+    SimConfig config;
+    float dt;
+    uint32_t tickCount = 0;
+    std::vector<SimEntity> entityList;
+    std::vector<SimPlayer> players;     // players[id - 1]
+    int activePlayers = 0;
+    uint16_t wall = 0;                  // Entity id of the static wall
+    std::mt19937 random;
+    std::vector<uint16_t> targets;      // Ships and bullets of the current tick, reused across ticks
+    std::vector<SimPastEntity> history; // history[(tick % SIM_REWIND_TICKS) * SIM_ENTITY_MAX + id], empty without rewinding
+    uint32_t historyTicks = 0;          // Ticks recorded so far, up to SIM_REWIND_TICKS
+
+    SimEntity* create(uint8_t type, uint8_t scaleClass, SimVec2 pos, SimVec2 vel, float dir, uint16_t owner = 0);
+    void destroy(SimEntity& entity);
+    uint16_t spawnShip(uint16_t playerId);
+    void spawnAsteroid(SimVec2 pos, SimVec2 vel, uint8_t scaleClass);
+    uint8_t randomScaleClass();
+    SimVec2 randomRespawnPos();
+    int randomRange(int low, int high);
+    void record();
+    uint8_t rewindFor(uint32_t viewTick) const;
+    bool rewound(uint16_t id, uint8_t ticks, SimAabb& box, SimVec2& vel) const;
+    void collideWall(SimEntity& ship);
+    void collideAsteroids();
+};
+
+#endif
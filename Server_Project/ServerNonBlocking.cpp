@@ -15,26 +15,40 @@ prior written consent of DigiPen Institute of Technology is prohibited.
 /* End Header
 *******************************************************************/
 
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <windows.h>
+#include "NetSocket.h"
+#include "Protocol.h"
+#include "SimWorld.h"
+#include "SimSnapshot.h"
+#include "NetReliable.h"
+#include "NetBundle.h"
+#include "NetRate.h"
 #include <iostream>
 #include <string>
-#include <unordered_map>
 #include <mutex>
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <unordered_map>
 #include "taskqueue.h"
-
-#pragma comment(lib, "ws2_32.lib")
+#include "ringbuffer.h"
+#include "lanebuffer.h"
+#include "sendqueue.h"
+#include "packetpool.h"
+#include "sessiontable.h"
+#include "bench.h"
+#include "logger.h"
+#include "interestgrid.h"
+#include "userlist.h"
 
 // Constants
-#define WINSOCK_VERSION     2
-#define WINSOCK_SUBVERSION  2
 #define MAX_STR_LEN         1000
+#define STATS_INTERVAL_SEC  5
+#define QUEUE_SLOTS         20
 #define RETURN_CODE_1       1
 #define RETURN_CODE_2       2
 #define RETURN_CODE_3       3
@@ -48,6 +62,14 @@ enum class CommandID : unsigned char {
     RSP_ECHO = 0x3,  // Server responds to an echo request
     REQ_LISTUSERS = 0x4,  // Client requests the list of users
     RSP_LISTUSERS = 0x5,  // Server responds with the list of users
+    REQ_SHIP_STATE = NET_CMD_REQ_SHIP_STATE, // Client reports its ship (binary, see Protocol.h)
+    RSP_SHIP_STATE = NET_CMD_RSP_SHIP_STATE, // Server acknowledges a ship report
+    REQ_INPUT = NET_CMD_REQ_INPUT, // Client sends its controls; the first one joins the game
+    RSP_WELCOME = NET_CMD_RSP_WELCOME, // Server tells a joining client its player ID
+    RSP_SNAPSHOT = NET_CMD_RSP_SNAPSHOT, // One part of the world state for a tick
+    RELIABLE = NET_CMD_RELIABLE, // Reliable, ordered messages and acknowledgements
+    RSP_GAME_EVENT = NET_CMD_RSP_GAME_EVENT, // Player's score or lives changed (reliable)
+    BUNDLE = NET_CMD_BUNDLE, // Several of the above in one datagram
     CMD_TEST = 0x20, // Test command (not used)
     ECHO_ERROR = 0x30  // Server indicates an echo error
 };
@@ -57,10 +79,70 @@ struct UdpClientData {
     int dataSize;     // Size of the incoming data
 };
 
+// Datagrams pulled from the socket by one receive call, handed to a worker as one task.
+// The batch owns pooled buffers; the worker releases them when it is done.
+using UdpBatch = PacketBatch<UdpClientData, NET_RECV_BATCH_MAX>;
+
+// Worker lane of a client by its session key. Every datagram from one address lands on the same lane,
+// so a client's packets are handled by one worker, in the order they arrived, and its session lives there.
+// The lane comes from the top bits of the same hash SessionTable takes its home slot from the low bits of,
+// so the keys of one lane still spread over its whole table.
+static size_t clientLane(uint64_t key, size_t lanes) {
+    uint64_t hash = (key * 0x9E3779B97F4A7C15ull) >> 32;
+    return static_cast<size_t>((hash * lanes) >> 32);
+}
+
+// Runtime options, parsed from the command line in main()
+struct ServerConfig {
+    int recvBatch = 32; // Datagrams per receive syscall (--recv-batch), 1 receives one datagram at a time
+    int sendTickMs = 5; // Flush interval of the outbound stage (--send-tick-ms), 0 sends every reply directly
+    bool useGso = true; // Send trains of replies to one peer with UDP_SEGMENT (--no-gso to disable)
+    int mtu = NET_BUNDLE_MTU; // Largest datagram a tick's replies to one client are packed into (--mtu), 0 sends each alone
+    int shards = 1; // Sockets bound to the port with SO_REUSEPORT (--shards), 0 opens one per core
+    int workers = 10; // Worker threads, split evenly across the shards (--workers)
+    LogLevel logLevel = LogLevel::Info; // Lowest level the logger prints (--log-level)
+    int tickRate = 60; // Simulation ticks per second (--tick-rate), 0 runs no simulation
+    int snapshotRate = 20; // Snapshots sent per second (--snapshot-rate), at most tickRate; clients interpolate between them
+    int worldWidth = 800; // Field width (--world-width); past one screen, players are only sent what is near their ship
+    int worldHeight = 600; // Field height (--world-height)
+    int interestCell = 128; // Cell size of the interest grid (--interest-cell)
+    int maxRewindMs = 250; // Longest a shot is rewound to match what its shooter saw (--max-rewind-ms), 0 to turn off
+    int maxClientKbps = 2000; // Most a client is sent (--max-client-kbps); below that the rate follows its link
+    int sessionTimeoutMs = 5000; // A UDP client silent this long is dropped with its ship (--session-timeout-ms), 0 never
+};
+
+// Hash of what an encoding depends on: its baseline and the entities shown now and at the baseline
+static uint64_t encodingHash(uint32_t baseTick, const uint64_t* relevant, const uint64_t* baseRelevant) {
+    uint64_t hash = baseTick;
+    for (size_t word = 0; word < INTEREST_SET_WORDS; ++word) {
+        hash = (hash ^ relevant[word]) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    for (size_t word = 0; baseRelevant != nullptr && word < INTEREST_SET_WORDS; ++word) {
+        hash = (hash ^ baseRelevant[word]) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+// Seconds between sweeps for timed-out sessions
+static const double EXPIRE_INTERVAL = 1.0;
+
+// Area around its ship a client draws, the range of its snapshots
+static const float VIEW_WIDTH = 800.0f;
+static const float VIEW_HEIGHT = 600.0f;
+
 // Server class to encapsulate server functionality
 class Server {
 public:
     Server() = default; // Default constructor
+    explicit Server(const ServerConfig& config) :
+        config(config),
+        world(SimConfig{ config.tickRate > 0 ? config.tickRate : 60,
+            static_cast<float>(config.worldWidth), static_cast<float>(config.worldHeight), 1,
+            config.maxRewindMs * std::max(config.tickRate, 0) / 1000 }),
+        interest(static_cast<float>(config.worldWidth), static_cast<float>(config.worldHeight),
+            static_cast<float>(config.interestCell), VIEW_WIDTH, VIEW_HEIGHT) {} // Constructor with runtime options
     ~Server() { cleanup(); } // Destructor to clean up resources
 
     // Initialize the server with the given port
@@ -71,9 +153,109 @@ public:
 
 private:
     SOCKET listenerSocket = INVALID_SOCKET; // Socket for listening to incoming connections
-    std::unordered_map<std::string, SOCKET> clients; // Map of client keys to their sockets
-    std::mutex clientsMutex; // Mutex to protect access to the clients map
     std::string port; // Port number the server listens on
+    ServerConfig config; // Runtime options
+    std::atomic<bool> running{ true }; // Cleared on shutdown to stop the shard threads
+
+    struct Shard;
+
+    // Where a client's replies go, copied out of its session so they can be sent without its lane's lock
+    struct SessionRoute {
+        Shard* shard = nullptr; // Shard of a UDP client, null for a TCP client
+        sockaddr_in addr{}; // Client address
+        SOCKET socket = INVALID_SOCKET; // Connected socket of a TCP client
+    };
+
+    // Per-client state, stored inline in its lane's session table
+    struct Session {
+        sockaddr_in addr{}; // Client address
+        SOCKET socket = INVALID_SOCKET; // Connected socket of a TCP client, INVALID_SOCKET for UDP
+        Shard* shard = nullptr; // Shard a UDP client's flow lands on
+        uint64_t packets = 0; // Datagrams received from the client
+        double lastSeen = 0.0; // NetClockSeconds of the client's last datagram
+        NetShipState ship{}; // Last ship state the client reported
+        uint16_t shipSequence = 0; // Sequence number of that report
+        bool hasShip = false; // Whether the client has reported its ship yet
+        uint16_t playerId = 0; // Player in the simulation, 0 until the client sends input
+        uint32_t ackTick = 0; // Newest snapshot the client has complete, the baseline of its deltas
+        int viewer = -1; // The player's viewer in the interest grid, assigned by simThread
+        std::unique_ptr<NetReliableChannel> reliable; // Created on the client's first reliable packet or standing
+        std::unique_ptr<NetRateController> rate; // Send budget of a UDP client, adapted to its round trip and loss
+        NetSendTracker snapshotsSent; // Snapshot ticks sent, matched against the client's acknowledgements
+        NetGameEvent standing{}; // Score and lives last queued to the client
+        bool hasStanding = false;
+
+        SessionRoute route() const { return SessionRoute{ shard, addr, socket }; }
+    };
+
+    // Sessions of the clients routed to one worker lane. Only that lane's worker creates, changes and removes
+    // them, so its mutex is uncontended but for cross-lane work: echo forwarding and simThread's pass each tick.
+    struct Lane {
+        std::mutex mutex; // Held by whoever touches the sessions; never together with another lane's
+        SessionTable<Session> sessions; // Sessions keyed by sessionKey(ip, port)
+    };
+
+    // One socket on the shared port with its own receive loop, workers and outbound stage.
+    // The kernel hashes each client's flow to one shard, so a client always lands on the same one.
+    struct Shard {
+        SOCKET socket = INVALID_SOCKET; // Socket bound to the server port
+        std::unique_ptr<PacketPool<UdpClientData>> pool; // Buffers the kernel receives into
+        NetIoStats recvStats; // Receive datagram/syscall counters
+        NetIoStats sendStats; // Send datagram/syscall counters
+        std::unique_ptr<SendQueue> outbound; // Replies waiting for the next flush, null when sending directly
+        std::vector<std::unique_ptr<Lane>> lanes; // One per worker, indexed by clientLane
+        std::thread receiveThread; // Runs receiveLoop for this shard
+        std::thread flushThread; // Flushes the outbound stage once per send tick
+    };
+    std::vector<std::unique_ptr<Shard>> shards; // shards[0] owns listenerSocket
+    UserListCache userList; // Encoded user list, updated as sessions come and go in any lane
+
+    // The authoritative world. Lock order: a lane's mutex before worldMutex.
+    SimWorld world;
+    std::mutex worldMutex; // Mutex to protect access to the world
+    std::thread simThread; // Steps the world at the tick rate and broadcasts it
+
+    // A player's standing and last command as of the newest tick, copied out after each step
+    // so simThread can serve the sessions without holding worldMutex
+    struct PlayerState {
+        bool active = false;
+        bool out = false; // Out of ships or at the winning score
+        uint32_t score = 0;
+        int lives = 0;
+        uint16_t inputSequence = 0; // Last command applied to the player's ship
+    };
+    std::vector<PlayerState> playerStates; // Indexed by player ID, owned by simThread
+
+    // Snapshot state, owned by simThread
+    struct EncodedSnapshot {
+        uint32_t baseTick = 0; // Baseline the deltas are against, 0 for a full snapshot
+        uint64_t relevant[INTEREST_SET_WORDS]; // Entities the encoding shows
+        uint64_t baseRelevant[INTEREST_SET_WORDS]; // Entities the baseline showed, all clear for a full snapshot
+        std::vector<char> data; // Parts, each in its own NET_SNAPSHOT_MTU slot
+        std::vector<int> parts; // Size of each part in data
+        std::vector<uint16_t> counts; // Entity deltas in each part
+    };
+    struct SnapshotTarget {
+        Lane* lane; // Lane holding the player's session
+        Shard* shard; // Shard the player's datagrams go out on
+        sockaddr_in addr; // Player address
+        uint32_t ackTick; // Player's baseline
+        uint16_t playerId; // Player whose ship the view follows
+        int viewer; // Player's viewer in the interest grid
+        uint16_t inputSequence; // Last command applied to the player's ship, for its reconciliation
+        NetAck reliableAck; // Player's reliable packets received, piggybacked on the snapshot
+        uint64_t key; // Player's session
+        double budget; // Bytes the player's send budget allowed when the tick started
+        bool budgetFull; // The budget was as full as it gets, so even an oversized snapshot may go
+        int sentBytes; // Bytes of this tick's snapshot sent to the player, 0 if it was held back
+    };
+    SimSnapshotRing history; // World snapshots of the last SIM_SNAPSHOT_HISTORY ticks
+    InterestGrid interest; // Which entities each player is sent
+    std::vector<uint16_t> playerShips; // Ship entity of each player ID this tick, SIM_ENTITY_NONE while respawning
+    std::vector<EncodedSnapshot> encoded; // This tick's encodings, one per baseline and view in use
+    size_t encodedCount = 0; // Entries of encoded used this tick
+    std::unordered_map<uint64_t, size_t> encodedIndex; // This tick's encodings by encodingHash
+    std::vector<SnapshotTarget> snapshotTargets; // Players to send this tick's snapshot to
 
     // Set up Winsock
     bool setupWinsock();
@@ -83,29 +265,148 @@ private:
     bool createListener();
     // Bind the listener socket to the server's address
     bool bindListener();
+    // Open the sockets of the remaining shards on the same port
+    bool openShards();
     // Start listening for incoming connections
     bool startListening();
     // Handle a connected client
     void handleClient(SOCKET clientSocket);
+    // Lane of a shard that holds the session with the given key
+    Lane& laneOf(Shard& shard, uint64_t key);
+    // Copy out the route of the session with the given key from whichever shard holds it; takes one lane at a time
+    bool findRoute(uint64_t key, SessionRoute& route);
+    // Receive loop of one shard, feeding that shard's workers
+    void receiveLoop(Shard& shard);
     //handling UDP client data.
-    void handleUdpClient(UdpClientData messsage);
+    void handleUdpClient(Shard& shard, UdpClientData& message);
+    // Handle a game message tied to the client's session, alone or from a bundle; its lane's mutex must be held.
+    // Sets listWanted for a user list to send once the lane is unlocked. Returns false for commands it does not handle.
+    bool handleSessionMessage(Shard& shard, Session& session, const char* data, int size, bool& listWanted);
+    // Join the client to the game if needed and apply its controls; its lane's mutex must be held
+    void handleInput(Session& session, const char* data, int size);
+    // Step the world at the configured tick rate and broadcast at the snapshot rate
+    void simulationLoop();
+    // Copy every player's standing out of the world into playerStates; worldMutex must be held
+    void capturePlayers();
+    // Drop the UDP sessions that have been silent for the session timeout, together with their ships
+    void expireSessions();
+    // Encode the relevant entities of a snapshot as deltas against a baseline, or in full without one,
+    // into parts of at most NET_SNAPSHOT_MTU bytes; out.relevant and out.baseRelevant must be set
+    void encodeSnapshot(const SimSnapshot& current, const SimSnapshot* baseline, EncodedSnapshot& out);
+    // Move the entities and the players' views of a new snapshot in the interest grid
+    void updateInterest(const SimSnapshot& current);
+    // Send every player the entities near its ship at a tick, delta-encoded against the player's baseline
+    void broadcastSnapshot(uint32_t tick);
+    // Take in a client's reliable packet and handle its messages in order; its lane's mutex must be held
+    void handleReliable(Session& session, const char* data, int size);
+    // The session's reliable channel, created on first use and tied to its send budget; its lane's mutex must be held
+    NetReliableChannel& reliableChannel(Session& session);
+    // Queue changed standings and send the reliable packets that are due, once per tick
+    void updateReliable();
+    // Store a client's ship report and acknowledge it until the client joins the game; its lane's mutex must be held
+    void handleShipState(Shard& shard, Session& session, const char* data, int size);
+    // Send a reply, through the shard's outbound stage when it is enabled
+    bool sendReply(Shard& shard, const sockaddr_in& clientAddr, const char* data, int size);
+    // Send data to a client over its TCP socket or its shard
+    bool sendToClient(const SessionRoute& route, const char* data, int size);
     // Forward an echo message to another client
-    void forwardEchoMessage(char* buffer, int length, const std::string& senderKey);
-    // Send the list of connected users to a client
-    void sendUserList(SOCKET clientSocket);
+    void forwardEchoMessage(char* buffer, int length, uint64_t senderKey);
+    // Queue the list of connected users on the client's reliable channel; its lane's mutex must be held.
+    // Returns false if the client has no reliable channel and needs sendUserList instead.
+    bool queueUserList(Session& session);
+    // Send the list of connected users to a client in one message; no lane's mutex may be held
+    void sendUserList(const SessionRoute& route);
+    // Print packets per syscall for every shard
+    void reportIoStats();
     // Handle server disconnection
     void onDisconnect();
     // Clean up resources
     void cleanup();
 };
 
+// Parse command line options into the server configuration
+static bool parseArgs(int argc, char* argv[], ServerConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--recv-batch" && i + 1 < argc) {
+            config.recvBatch = std::stoi(argv[++i]);
+        }
+        else if (arg == "--send-tick-ms" && i + 1 < argc) {
+            config.sendTickMs = std::stoi(argv[++i]);
+        }
+        else if (arg == "--no-gso") {
+            config.useGso = false;
+        }
+        else if (arg == "--mtu" && i + 1 < argc) {
+            // Past 1472 bytes a datagram no longer fits one Ethernet frame; the client receives up to 2048
+            const int mtu = std::stoi(argv[++i]);
+            config.mtu = mtu <= 0 ? 0 : std::clamp(mtu, 256, 1472);
+        }
+        else if (arg == "--shards" && i + 1 < argc) {
+            config.shards = std::stoi(argv[++i]);
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            config.workers = std::stoi(argv[++i]);
+        }
+        else if (arg == "--tick-rate" && i + 1 < argc) {
+            config.tickRate = std::stoi(argv[++i]);
+        }
+        else if (arg == "--snapshot-rate" && i + 1 < argc) {
+            config.snapshotRate = std::max(std::stoi(argv[++i]), 1);
+        }
+        else if (arg == "--world-width" && i + 1 < argc) {
+            config.worldWidth = std::clamp(std::stoi(argv[++i]), 200, 3000); // Positions must stay within NET_QUANT_POS
+        }
+        else if (arg == "--world-height" && i + 1 < argc) {
+            config.worldHeight = std::clamp(std::stoi(argv[++i]), 200, 3000);
+        }
+        else if (arg == "--interest-cell" && i + 1 < argc) {
+            config.interestCell = std::max(std::stoi(argv[++i]), 16);
+        }
+        else if (arg == "--max-rewind-ms" && i + 1 < argc) {
+            config.maxRewindMs = std::max(std::stoi(argv[++i]), 0);
+        }
+        else if (arg == "--max-client-kbps" && i + 1 < argc) {
+            config.maxClientKbps = std::max(std::stoi(argv[++i]), 32);
+        }
+        else if (arg == "--session-timeout-ms" && i + 1 < argc) {
+            config.sessionTimeoutMs = std::max(std::stoi(argv[++i]), 0);
+        }
+        else if (arg == "--log-level" && i + 1 < argc && Logger::parseLevel(argv[i + 1], config.logLevel)) {
+            ++i;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::cerr << "Usage: server [--recv-batch N] [--send-tick-ms N] [--no-gso] [--mtu N] [--shards N] [--workers N]"
+                << " [--tick-rate N] [--snapshot-rate N] [--world-width N] [--world-height N] [--interest-cell N]"
+                << " [--max-rewind-ms N] [--max-client-kbps N] [--session-timeout-ms N]"
+                << " [--log-level trace|debug|info|warn|error|off]" << std::endl;
+            std::cerr << "       server --bench NAME" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 // Main function
-int main() {
+int main(int argc, char* argv[]) {
+    // Benchmarks run standalone and never ask for a port
+    if (argc >= 3 && std::string(argv[1]) == "--bench") {
+        return runBenchmark(argv[2]) ? 0 : 1;
+    }
+
+    ServerConfig config;
+    if (!parseArgs(argc, argv, config)) return 1;
+
     std::string portNumber;
     std::cout << "Server Port Number: ";
     std::getline(std::cin, portNumber);
 
-    Server server;
+    // Workers log through per-thread rings; one background thread prints them
+    Logger::setLevel(config.logLevel);
+    Logger::start();
+
+    Server server(config);
     if (!server.initialize(portNumber)) {
         std::cerr << "Server initialization failed." << std::endl;
         return 1;
@@ -120,10 +421,21 @@ int main() {
 // Initialize the server
 bool Server::initialize(const std::string& port) {
     this->port = port; // Initialize the port member variable
+
+    // One shard per core unless told otherwise; sharding needs SO_REUSEPORT
+    if (config.shards <= 0) {
+        config.shards = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    if (config.shards > 1 && !NetReusePortSupported()) {
+        std::cerr << "SO_REUSEPORT is not available, running a single shard." << std::endl;
+        config.shards = 1;
+    }
+
     if (!setupWinsock()) return false; // Set up Winsock
     if (!resolveAddress(port)) return false; // Resolve the server's address
     if (!createListener()) return false; // Create the listener socket
     if (!bindListener()) return false; // Bind the listener socket
+    if (!openShards()) return false; // Open the sockets of the other shards
     //if (!startListening()) return false; // Start listening for connections
 
     return true; // Initialization successful
@@ -131,55 +443,152 @@ bool Server::initialize(const std::string& port) {
 
 // Run the server
 void Server::run() {
-    // Define the action lambda to handle UDP messages
-    auto action = [this](UdpClientData message) {
-        handleUdpClient(message); // Handle the UDP message
+    // The workers are split evenly across the shards, each owning the sessions of its lane
+    const size_t workerCount = std::max<size_t>(1, config.workers / shards.size());
+    for (auto& shard : shards) {
+        for (size_t lane = 0; lane < workerCount; ++lane) {
+            shard->lanes.push_back(std::make_unique<Lane>());
+        }
+    }
+
+    for (auto& shard : shards) {
+        // Start the outbound stage: replies from all of the shard's workers leave together once per tick,
+        // each client's packed into as few datagrams as the MTU allows
+        if (config.sendTickMs > 0) {
+            Shard* owner = shard.get();
+            owner->outbound = std::make_unique<SendQueue>(owner->socket, config.useGso, config.mtu, &owner->sendStats);
+            owner->flushThread = std::thread([this, owner]() {
+                while (running) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(config.sendTickMs));
+                    owner->outbound->flush();
+                }
+                });
+        }
+        shard->receiveThread = std::thread(&Server::receiveLoop, this, std::ref(*shard));
+    }
+
+    std::cout << "Running " << shards.size() << " receive shard(s)." << std::endl;
+
+    // The world advances on its own thread, independent of packet arrival
+    if (config.tickRate > 0) {
+        simThread = std::thread(&Server::simulationLoop, this);
+        std::cout << "Simulating at " << config.tickRate << " ticks per second, sending "
+            << std::min(config.snapshotRate, config.tickRate) << " snapshots per second." << std::endl;
+    }
+
+    // The main thread only reports counters from here on, and sweeps for timed-out sessions without a simulation
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::seconds(STATS_INTERVAL_SEC));
+        reportIoStats();
+        if (config.tickRate <= 0) expireSessions();
+    }
+}
+
+// Receive loop of one shard, feeding that shard's workers
+void Server::receiveLoop(Shard& shard) {
+    // Define the action lambda to handle a batch of UDP messages
+    auto action = [this, &shard](UdpBatch& batch) {
+        for (PacketRef<UdpClientData>& message : batch) {
+            handleUdpClient(shard, *message); // Handle the UDP message
+        }
         return true; // Ensure the lambda returns a boolean
         };
 
     // Define the onDisconnect lambda (though for UDP, disconnect isn't needed)
     const auto onDisconnect = [&]() {
-        closesocket(listenerSocket); // Close the listener socket
         return true;
         };
 
-    // Initialize TaskQueue with the correct parameters
-    auto tq = TaskQueue<UdpClientData, decltype(action), decltype(onDisconnect)>{
-        10, 20, action, onDisconnect
+    // Initialize TaskQueue with the correct parameters, one worker per lane of the shard.
+    // The last template argument picks the backend: LockedBuffer, the lock-free RingBuffer,
+    // WorkStealingBuffer, or AffinityBuffer, which pins every lane to one worker. Sessions are
+    // owned by lanes, so any backend but AffinityBuffer would have workers contend for them.
+    const size_t workerCount = shard.lanes.size();
+    auto tq = TaskQueue<UdpBatch, decltype(action), decltype(onDisconnect), AffinityBuffer>{
+        workerCount, QUEUE_SLOTS, action, onDisconnect
     };
 
-    // Main server loop: Use recvfrom() to receive UDP messages
-    while (true) {
-        sockaddr_in clientAddr{};
-        socklen_t clientAddrSize = sizeof(clientAddr);
-        char buffer[1024];  // Buffer to hold incoming data
+    // Each received batch is split into one batch per worker lane
+    std::vector<UdpBatch> laneBatches(workerCount);
+
+    const int batchSize = std::clamp(config.recvBatch, 1, NET_RECV_BATCH_MAX);
+    NetDatagram slots[NET_RECV_BATCH_MAX];
 
-        // Receive the UDP message from the client
-        int bytesReceived = recvfrom(listenerSocket, buffer, sizeof(buffer), 0,
-            (sockaddr*)&clientAddr, &clientAddrSize);
+    // Enough buffers for every batch that can be queued, in a worker, or being received
+    shard.pool = std::make_unique<PacketPool<UdpClientData>>((QUEUE_SLOTS + workerCount + 1) * batchSize);
 
-        if (bytesReceived == SOCKET_ERROR) {
+    // Shard loop: pull as many datagrams per syscall as are queued
+    while (running) {
+        UdpBatch batch;
+
+        // Point each receive slot at a pooled UdpClientData so the kernel writes the payload in place.
+        // One byte is held back for the terminator handleUdpClient appends.
+        int wanted = 0;
+        while (wanted < batchSize) {
+            PacketRef<UdpClientData> packet = shard.pool->acquire();
+            if (!packet) break;
+            slots[wanted].data = packet->data;
+            slots[wanted].capacity = sizeof(packet->data) - 1;
+            batch.packets[wanted++] = std::move(packet);
+        }
+        if (wanted == 0) {
+            std::this_thread::yield(); // Every buffer is in flight, wait for the workers
+            continue;
+        }
+
+        int received = NetRecvBatch(shard.socket, slots, wanted, &shard.recvStats);
+        if (received == SOCKET_ERROR) {
             //std::cerr << "Receive failed." << std::endl;
             continue;
         }
 
-        // Create the UdpClientData object with received data
-        UdpClientData clientData;
-        clientData.clientAddr = clientAddr;
-        memcpy(clientData.data, buffer, bytesReceived);
-        clientData.dataSize = bytesReceived;
+        for (int i = 0; i < received; ++i) {
+            batch.packets[i]->clientAddr = slots[i].addr;
+            batch.packets[i]->dataSize = slots[i].size;
+
+            // Route by source address: the client's session is only ever changed by one worker
+            const uint64_t key = sessionKey(slots[i].addr.sin_addr.s_addr, slots[i].addr.sin_port);
+            UdpBatch& lane = laneBatches[clientLane(key, workerCount)];
+            lane.packets[lane.count++] = std::move(batch.packets[i]);
+        }
+        for (int i = received; i < wanted; ++i) {
+            batch.packets[i].release(); // Unused buffers go straight back to the pool
+        }
+
+        // Hand each lane its share; only buffer handles move, never the payloads
+        for (size_t lane = 0; lane < workerCount; ++lane) {
+            if (laneBatches[lane].count == 0) continue;
+            tq.produce(std::move(laneBatches[lane]), lane);
+            laneBatches[lane].count = 0;
+        }
+    }
+}
 
-        // Add the client data to the task queue for processing by worker threads
-        tq.produce(clientData);
+// Print packets per syscall for every shard
+void Server::reportIoStats() {
+    for (size_t i = 0; i < shards.size(); ++i) {
+        Shard& shard = *shards[i];
+
+        uint64_t datagrams = shard.recvStats.datagrams.exchange(0);
+        uint64_t syscalls = shard.recvStats.syscalls.exchange(0);
+        std::cout << "Shard " << i << " receive: " << datagrams << " packets in " << syscalls << " syscalls ("
+            << (syscalls ? static_cast<double>(datagrams) / syscalls : 0.0) << " packets/syscall)" << std::endl;
+
+        datagrams = shard.sendStats.datagrams.exchange(0);
+        syscalls = shard.sendStats.syscalls.exchange(0);
+        uint64_t messages = shard.sendStats.messages.exchange(0);
+        std::cout << "Shard " << i << " send: " << messages << " messages in " << datagrams << " packets ("
+            << datagrams / STATS_INTERVAL_SEC << " packets/s, "
+            << (datagrams ? static_cast<double>(messages) / datagrams : 0.0) << " messages/packet) in "
+            << syscalls << " syscalls ("
+            << (syscalls ? static_cast<double>(datagrams) / syscalls : 0.0) << " packets/syscall)" << std::endl;
     }
 }
 
 
 // Set up Winsock
 bool Server::setupWinsock() {
-    WSADATA wsaData{};
-    int errorCode = WSAStartup(MAKEWORD(WINSOCK_VERSION, WINSOCK_SUBVERSION), &wsaData);
-    if (errorCode != NO_ERROR) {
+    if (!NetStartup()) {
         std::cerr << "WSAStartup() failed." << std::endl;
         return false;
     }
@@ -202,7 +611,7 @@ bool Server::resolveAddress(const std::string& port) {
     int errorCode = getaddrinfo(host, port.c_str(), &hints, &info);
     if (errorCode != NO_ERROR || info == nullptr) {
         std::cerr << "getaddrinfo() failed." << std::endl;
-        WSACleanup();
+        NetCleanup();
         return false;
     }
 
@@ -223,9 +632,18 @@ bool Server::createListener() {
     listenerSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP); // Changed to SOCK_DGRAM for UDP
     if (listenerSocket == INVALID_SOCKET) {
         std::cerr << "Socket creation failed." << std::endl;
-        WSACleanup();
+        NetCleanup();
+        return false;
+    }
+    if (config.shards > 1 && !NetSetReusePort(listenerSocket)) {
+        std::cerr << "setsockopt(SO_REUSEPORT) failed." << std::endl;
+        closesocket(listenerSocket);
+        NetCleanup();
         return false;
     }
+
+    shards.push_back(std::make_unique<Shard>());
+    shards[0]->socket = listenerSocket; // The listener is the first shard's socket
     return true;
 }
 
@@ -240,18 +658,40 @@ bool Server::bindListener() {
     if (bind(listenerSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
         std::cerr << "bind() failed." << std::endl;
         closesocket(listenerSocket);
-        WSACleanup();
+        NetCleanup();
         return false;
     }
     return true;
 }
 
+// Open the sockets of the remaining shards on the same port
+bool Server::openShards() {
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET; // Use IPv4
+    serverAddr.sin_addr.s_addr = INADDR_ANY; // Bind to any available interface
+    serverAddr.sin_port = htons(std::stoi(port)); // Convert port to network byte order
+
+    for (int i = 1; i < config.shards; ++i) {
+        SOCKET shardSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (shardSocket == INVALID_SOCKET || !NetSetReusePort(shardSocket) ||
+            bind(shardSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+            std::cerr << "Opening shard " << i << " failed." << std::endl;
+            if (shardSocket != INVALID_SOCKET) closesocket(shardSocket);
+            return false;
+        }
+
+        shards.push_back(std::make_unique<Shard>());
+        shards.back()->socket = shardSocket;
+    }
+    return true;
+}
+
 // Start listening for incoming connections
 bool Server::startListening() {
     if (listen(listenerSocket, SOMAXCONN) == SOCKET_ERROR) {
         std::cerr << "listen() failed." << std::endl;
         closesocket(listenerSocket);
-        WSACleanup();
+        NetCleanup();
         return false;
     }
     return true;
@@ -260,40 +700,56 @@ bool Server::startListening() {
 // Handle a connected client
 void Server::handleClient(SOCKET clientSocket) {
     sockaddr_in clientAddr{};
-    int addrSize = sizeof(clientAddr);
+    socklen_t addrSize = sizeof(clientAddr);
     getpeername(clientSocket, (sockaddr*)&clientAddr, &addrSize); // Get client's address
 
     char clientIP[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN); // Convert IP to string
     uint16_t clientPort = ntohs(clientAddr.sin_port); // Convert port to host byte order
-    std::string clientKey = std::string(clientIP) + ":" + std::to_string(clientPort); // Create client key
+    uint64_t clientKey = sessionKey(clientAddr.sin_addr.s_addr, clientAddr.sin_port); // Create client key
 
+    // TCP clients are kept in the first shard's lanes, beside the UDP clients that land there
+    Lane& lane = laneOf(*shards[0], clientKey);
     {
-        std::lock_guard<std::mutex> lock(clientsMutex); // Lock the clients map
-        clients[clientKey] = clientSocket; // Add the client to the map
+        std::lock_guard<std::mutex> lock(lane.mutex); // Lock the client's lane
+        bool inserted = false;
+        Session& session = lane.sessions.insert(clientKey, inserted); // Add the client to the table
+        session.addr = clientAddr;
+        session.socket = clientSocket;
+        if (inserted) userList.add(clientKey);
     }
 
-    std::cout << "Client connected: " << clientKey << std::endl;
+    std::cout << "Client connected: " << clientIP << ":" << clientPort << std::endl;
 
     char buffer[MAX_STR_LEN] = {};
     while (true) {
         int bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0); // Receive data from the client
         if (bytesRead <= 0) {
-            std::cout << "Client disconnected: " << clientKey << std::endl;
+            std::cout << "Client disconnected: " << clientIP << ":" << clientPort << std::endl;
             break;
         }
 
         CommandID commandID = static_cast<CommandID>(buffer[0]); // Extract the command ID
         switch (commandID) {
         case CommandID::REQ_QUIT:
-            std::cout << "Client requested to quit: " << clientKey << std::endl;
+            std::cout << "Client requested to quit: " << clientIP << ":" << clientPort << std::endl;
             break;
         case CommandID::REQ_ECHO:
             forwardEchoMessage(buffer, bytesRead, clientKey); // Forward the echo message
             break;
-        case CommandID::REQ_LISTUSERS:
-            sendUserList(clientSocket); // Send the list of users
+        case CommandID::REQ_LISTUSERS: {
+            SessionRoute route;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> lock(lane.mutex); // Lock the client's lane
+                if (Session* session = lane.sessions.find(clientKey)) {
+                    route = session->route();
+                    found = true;
+                }
+            }
+            if (found) sendUserList(route); // Send the list of users, with the lane unlocked
             break;
+        }
         default:
             std::cerr << "Unhandled command ID: " << static_cast<int>(commandID) << std::endl;
             break;
@@ -301,15 +757,35 @@ void Server::handleClient(SOCKET clientSocket) {
     }
 
     {
-        std::lock_guard<std::mutex> lock(clientsMutex); // Lock the clients map
-        clients.erase(clientKey); // Remove the client from the map
+        std::lock_guard<std::mutex> lock(lane.mutex); // Lock the client's lane
+        lane.sessions.erase(clientKey); // Remove the client from the table
+        userList.remove(clientKey);
     }
 
     shutdown(clientSocket, SD_BOTH); // Shutdown the client socket
     closesocket(clientSocket); // Close the client socket
 }
 
-void Server::handleUdpClient(UdpClientData message)
+// Lane of a shard that holds the session with the given key
+Server::Lane& Server::laneOf(Shard& shard, uint64_t key) {
+    return *shard.lanes[clientLane(key, shard.lanes.size())];
+}
+
+// Copy out the route of the session with the given key from whichever shard holds it
+bool Server::findRoute(uint64_t key, SessionRoute& route) {
+    // The kernel picked the client's shard, so look in its lane on each; shards are few
+    for (auto& shard : shards) {
+        Lane& lane = laneOf(*shard, key);
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        if (const Session* session = lane.sessions.find(key)) {
+            route = session->route();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::handleUdpClient(Shard& shard, UdpClientData& message)
 {
     // Unpack the message and client address from the incoming message
     const char* messageData = message.data; // Message content
@@ -318,27 +794,84 @@ void Server::handleUdpClient(UdpClientData message)
     // Null-terminate the message if it's not already null-terminated
     message.data[message.dataSize] = '\0';  // Ensure null-termination at the end
 
-    // Get client IP and port
-    char clientIp[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, sizeof(clientIp));
-    int clientPort = ntohs(clientAddr.sin_port);
+    // Register the client, or find its session, by its packed address
+    uint64_t clientKey = sessionKey(clientAddr.sin_addr.s_addr, clientAddr.sin_port);
+    if (message.dataSize > 0) {
+        CommandID commandID = static_cast<CommandID>(message.data[0]); // Extract the command ID
+        Lane& lane = laneOf(shard, clientKey); // This worker's own lane
+        std::unique_lock<std::mutex> lock(lane.mutex);
+        bool inserted = false;
+        Session& session = lane.sessions.insert(clientKey, inserted);
+        if (inserted) {
+            session.addr = clientAddr;
+            session.shard = &shard;
+            session.rate = std::make_unique<NetRateController>(config.maxClientKbps * 1000.0 / 8.0);
+            userList.add(clientKey);
+        }
+        ++session.packets;
+        session.lastSeen = NetClockSeconds();
+
+        // A user list for a client without the reliable channel goes out once the lane is unlocked, as an echo does
+        bool listWanted = false;
+        auto sendWantedList = [&]() {
+            if (!listWanted) return;
+            SessionRoute route = session.route();
+            lock.unlock();
+            sendUserList(route);
+        };
 
-    // Print the message along with client IP and port
-    std::cout << "Received message from client (" << clientIp << ":" << clientPort << "): "
-        << messageData << std::endl;
+        switch (commandID) {
+        case CommandID::REQ_QUIT:
+            if (session.playerId != 0) {
+                std::lock_guard<std::mutex> worldLock(worldMutex);
+                world.removePlayer(session.playerId); // Take the client's ship out of the world
+            }
+            lane.sessions.erase(clientKey); // Remove the client from the table
+            userList.remove(clientKey);
+            return;
+        case CommandID::REQ_ECHO:
+            lock.unlock(); // Forwarding looks up the other client in its own lane
+            forwardEchoMessage(message.data, message.dataSize, clientKey); // Forward the echo message
+            return;
+        case CommandID::BUNDLE: {
+            // Each message of the bundle is handled in place, in order, as if it had arrived alone
+            NetBundleReader reader{ message.data, message.dataSize };
+            const char* part;
+            int partSize;
+            while (reader.next(part, partSize)) {
+                if (!handleSessionMessage(shard, session, part, partSize, listWanted)) {
+                    LOG_DEBUG("Ignored bundled command {}", static_cast<int>(static_cast<uint8_t>(part[0])));
+                }
+            }
+            if (reader.malformed()) {
+                LOG_DEBUG("Dropped the rest of a malformed bundle ({} bytes)", message.dataSize);
+            }
+            sendWantedList();
+            return;
+        }
+        default:
+            if (handleSessionMessage(shard, session, message.data, message.dataSize, listWanted)) {
+                sendWantedList();
+                return;
+            }
+            break; // Anything else is echoed back as text
+        }
+    }
+
+    // Log the client's IP and port; formatted later by the logger thread
+    LOG_DEBUG("Received {} bytes from client ({}:{})",
+        message.dataSize, LogIpv4{ clientAddr.sin_addr.s_addr }, LogPort{ clientAddr.sin_port });
 
     // Create the message to send back, prepending "Message from server: "
     std::string serverMessage = "This is a Message from server:" + std::string(messageData);
 
     // Send the message back to the client (echoing it with the prefix)
-    int sendResult = sendto(listenerSocket, serverMessage.c_str(), serverMessage.length(), 0,
-        reinterpret_cast<sockaddr*>(&clientAddr), sizeof(clientAddr));
-
-    if (sendResult == SOCKET_ERROR) {
-        std::cerr << "Failed to send message to client." << std::endl;
+    if (!sendReply(shard, clientAddr, serverMessage.c_str(), static_cast<int>(serverMessage.length()))) {
+        LOG_WARN("Failed to send message to client ({}:{})",
+            LogIpv4{ clientAddr.sin_addr.s_addr }, LogPort{ clientAddr.sin_port });
     }
     else {
-        std::cout << "Echoed message to client: " << serverMessage << std::endl;
+        LOG_DEBUG("Echoed {} bytes to client", serverMessage.length());
     }
 
     // Free up the thread (the thread will exit when the task completes)
@@ -348,76 +881,540 @@ void Server::handleUdpClient(UdpClientData message)
 
 
 
+// Handle a game message tied to the client's session, alone or from a bundle
+bool Server::handleSessionMessage(Shard& shard, Session& session, const char* data, int size, bool& listWanted) {
+    switch (static_cast<CommandID>(data[0])) {
+    case CommandID::REQ_LISTUSERS:
+        if (!queueUserList(session)) listWanted = true; // Sent by the caller, once it lets go of the lane
+        return true;
+    case CommandID::REQ_SHIP_STATE:
+        handleShipState(shard, session, data, size); // Binary ship update
+        return true;
+    case CommandID::REQ_INPUT:
+        handleInput(session, data, size); // Controls for the simulation
+        return true;
+    case CommandID::RELIABLE:
+        handleReliable(session, data, size); // Messages that must arrive
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Join the client to the game if needed and apply its controls
+void Server::handleInput(Session& session, const char* data, int size) {
+    NetHeader header{};
+    NetInput input{};
+    if (config.tickRate <= 0 || !NetReadHeader(data, size, header) ||
+        !NetReadInput(data + NET_HEADER_SIZE, size - NET_HEADER_SIZE, input)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> worldLock(worldMutex);
+    if (session.playerId == 0) {
+        session.playerId = world.addPlayer();
+        if (session.playerId == 0) return; // No player IDs left
+
+        // Tell the client which ship is its own
+        char reply[NET_HEADER_SIZE + NET_WELCOME_SIZE];
+        int replySize = NetWriteHeader(reply, sizeof(reply),
+            NetHeader{ static_cast<uint8_t>(CommandID::RSP_WELCOME), NET_PROTOCOL_VERSION, header.sequence });
+        replySize += NetWriteWelcome(reply + replySize, sizeof(reply) - replySize,
+            NetWelcome{ session.playerId, static_cast<uint16_t>(config.tickRate),
+                static_cast<uint16_t>(config.worldWidth), static_cast<uint16_t>(config.worldHeight) });
+        sendToClient(session.route(), reply, replySize);
+        LOG_INFO("Player {} joined from {}:{}", session.playerId,
+            LogIpv4{ session.addr.sin_addr.s_addr }, LogPort{ session.addr.sin_port });
+    }
+    // Oldest command first; copies the world already has are skipped. Each older command was
+    // issued a tick earlier, when the client's view was a tick further back.
+    for (int i = NET_INPUT_REDUNDANCY - 1; i >= 0; --i) {
+        const uint32_t viewBack = input.viewLag + static_cast<uint32_t>(i);
+        const uint32_t viewTick = input.ackTick > viewBack ? input.ackTick - viewBack : 0;
+        world.queueInput(session.playerId,
+            SimInput{ static_cast<uint16_t>(header.sequence - i), input.buttons[i], viewTick });
+    }
+
+    // Acknowledgements can arrive out of order; keep the newest as the baseline
+    const double now = NetClockSeconds();
+    if (input.ackTick > session.ackTick && input.ackTick <= world.tick()) {
+        session.ackTick = input.ackTick;
+
+        // Snapshots sent since the previous acknowledgement that the client's bitfield does not list were lost;
+        // it acknowledges at its own send rate, which may be slower than the snapshot rate
+        double rtt = 0.0;
+        int delivered = 0;
+        int lost = 0;
+        const bool tracked = session.snapshotsSent.acked(input.ackTick, input.ackTickBits, now, rtt, delivered, lost);
+        if (session.rate) {
+            if (tracked) session.rate->onRoundTrip(now, rtt);
+            session.rate->onDelivery(now, delivered, lost);
+        }
+    }
+    if (session.reliable) session.reliable->readAck(now, input.reliableAck);
+}
+
+// Step the world at the configured tick rate and broadcast at the snapshot rate
+void Server::simulationLoop() {
+    using Clock = std::chrono::steady_clock;
+    const auto tickDuration = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / config.tickRate));
+    const uint32_t snapshotInterval = static_cast<uint32_t>(std::max(1, config.tickRate / config.snapshotRate));
+    uint32_t lastSnapshot = 0;
+    auto nextTick = Clock::now();
+    double lastExpiry = NetClockSeconds();
+
+    while (running) {
+        std::this_thread::sleep_until(nextTick);
+
+        // Catch up on missed ticks, but give up rather than spiral when the world is too slow
+        int steps = 0;
+        const int maxSteps = 5;
+        while (Clock::now() >= nextTick && steps < maxSteps) {
+            {
+                std::lock_guard<std::mutex> worldLock(worldMutex);
+                world.step();
+            }
+            nextTick += tickDuration;
+            ++steps;
+        }
+        if (steps == maxSteps) {
+            LOG_WARN("Simulation fell behind, skipping to the current tick");
+            nextTick = Clock::now() + tickDuration;
+        }
+
+        // Copy out what the sessions are served from, so the passes over the lanes never wait on the world.
+        // Only the newest state goes out, even after catching up on several ticks.
+        uint32_t tick;
+        bool snapshotDue;
+        {
+            std::lock_guard<std::mutex> worldLock(worldMutex);
+            tick = world.tick();
+            capturePlayers();
+            snapshotDue = tick - lastSnapshot >= snapshotInterval;
+            if (snapshotDue) SimSnapshotCapture(world, history.push(tick));
+        }
+        updateReliable();
+        if (NetClockSeconds() - lastExpiry >= EXPIRE_INTERVAL) {
+            expireSessions();
+            lastExpiry = NetClockSeconds();
+        }
+        if (!snapshotDue) continue;
+        lastSnapshot = tick;
+        broadcastSnapshot(tick);
+    }
+}
+
+// Copy every player's standing out of the world into playerStates
+void Server::capturePlayers() {
+    playerStates.resize(world.playerSlots() + 1);
+    for (uint16_t id = 1; id < playerStates.size(); ++id) {
+        const SimPlayer* player = world.player(id);
+        playerStates[id] = player != nullptr
+            ? PlayerState{ true, SimPlayerOut(*player), player->score, player->lives, player->input.sequence }
+            : PlayerState{};
+    }
+}
+
+// Drop the UDP sessions that have been silent for the session timeout, together with their ships
+void Server::expireSessions() {
+    if (config.sessionTimeoutMs <= 0) return;
+    const double cutoff = NetClockSeconds() - config.sessionTimeoutMs / 1000.0;
+    std::vector<uint64_t> expired;
+    for (auto& shard : shards) {
+        for (auto& lane : shard->lanes) {
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            expired.clear();
+            lane->sessions.forEach([&](uint64_t key, Session& session) {
+                // TCP sessions end when their socket closes
+                if (session.shard != nullptr && session.lastSeen < cutoff) expired.push_back(key);
+                });
+            for (uint64_t key : expired) {
+                Session* session = lane->sessions.find(key);
+                if (session->playerId != 0) {
+                    std::lock_guard<std::mutex> worldLock(worldMutex);
+                    world.removePlayer(session->playerId); // Closed games rarely say goodbye
+                    LOG_INFO("Player {} timed out", session->playerId);
+                }
+                LOG_DEBUG("Session {}:{} timed out", LogIpv4{ sessionKeyIp(key) }, LogPort{ sessionKeyPort(key) });
+                lane->sessions.erase(key);
+                userList.remove(key);
+            }
+        }
+    }
+}
+
+// Encode the relevant entities of a snapshot as deltas against a baseline, or in full without one
+void Server::encodeSnapshot(const SimSnapshot& current, const SimSnapshot* baseline, EncodedSnapshot& out) {
+    // Against no baseline every relevant entity is new, and one that left the view is as good as gone
+    static const SimSnapshotEntity none{};
+    const uint32_t ticks = baseline != nullptr ? current.tick - baseline->tick : 0;
+    out.baseTick = baseline != nullptr ? baseline->tick : 0;
+    out.parts.clear();
+    out.counts.clear();
+
+    // Header and info go in once the part count is known; the deltas are bit-packed after them
+    const int first = NET_HEADER_SIZE + NET_SNAPSHOT_INFO_SIZE;
+    const int64_t capacityBits = static_cast<int64_t>(NET_SNAPSHOT_MTU - first) * 8;
+    NetBitWriter writer{ nullptr, 0 };
+    auto startPart = [&]() {
+        size_t needed = (out.parts.size() + 1) * NET_SNAPSHOT_MTU;
+        if (out.data.size() < needed) out.data.resize(needed); // Grows to the largest tick, then reused
+        writer = NetBitWriter{ out.data.data() + out.parts.size() * NET_SNAPSHOT_MTU + first, NET_SNAPSHOT_MTU - first };
+        out.counts.push_back(0);
+    };
+
+    // Visit only the entities shown now or at the baseline, in id order
+    startPart();
+    for (size_t word = 0; word < INTEREST_SET_WORDS; ++word) {
+        const uint64_t shownNow = out.relevant[word];
+        const uint64_t shownBefore = baseline != nullptr ? out.baseRelevant[word] : 0;
+        for (uint64_t bits = shownNow | shownBefore; bits != 0; bits &= bits - 1) {
+            const int bit = std::countr_zero(bits);
+            const size_t id = word * 64 + bit;
+            const SimSnapshotEntity& now = current.entities[id];
+            const SimSnapshotEntity predicted = (shownBefore >> bit) & 1
+                ? SimSnapshotPredictEntity(baseline->entities[id], ticks, world.settings()) : none;
+            uint8_t mask = SimSnapshotDiff(predicted, (shownNow >> bit) & 1 ? now : none);
+            if (mask == 0) continue;
+
+            if (writer.bitsWritten() + NET_ENTITY_DELTA_MAX_BITS > capacityBits) {
+                out.parts.push_back(first + writer.flush());
+                startPart();
+            }
+            NetWriteEntityDelta(writer, mask, now.state);
+            ++out.counts.back();
+        }
+    }
+    out.parts.push_back(first + writer.flush()); // Sent even when empty, so the client can acknowledge the tick
+
+    // The info goes in per player, as it carries the player's input acknowledgement
+    for (size_t part = 0; part < out.parts.size(); ++part) {
+        NetWriteHeader(out.data.data() + part * NET_SNAPSHOT_MTU, NET_HEADER_SIZE, NetHeader{
+            static_cast<uint8_t>(CommandID::RSP_SNAPSHOT), NET_PROTOCOL_VERSION, static_cast<uint16_t>(current.tick) });
+    }
+}
+
+// Move the entities and the players' views of a new snapshot in the interest grid
+void Server::updateInterest(const SimSnapshot& current) {
+    // One pass over the world for all players; only entities that change cells cost more than a compare
+    std::fill(playerShips.begin(), playerShips.end(), SIM_ENTITY_NONE);
+    for (size_t id = 0; id < current.entities.size(); ++id) {
+        const SimSnapshotEntity& entity = current.entities[id];
+        interest.moveEntity(static_cast<uint16_t>(id), entity.active, entity.state.posX, entity.state.posY);
+        if (entity.active && entity.state.type == SIM_SHIP) {
+            if (entity.state.owner >= playerShips.size()) playerShips.resize(entity.state.owner + 1, SIM_ENTITY_NONE);
+            playerShips[entity.state.owner] = static_cast<uint16_t>(id);
+        }
+    }
+
+    // A view follows its ship and stays put while the ship respawns; views of departed players go
+    for (const SnapshotTarget& target : snapshotTargets) {
+        uint16_t ship = target.playerId < playerShips.size() ? playerShips[target.playerId] : SIM_ENTITY_NONE;
+        if (ship != SIM_ENTITY_NONE) {
+            const NetEntityState& state = current.entities[ship].state;
+            interest.updateViewer(target.viewer, state.posX, state.posY, current.tick);
+        }
+        else {
+            interest.keepViewer(target.viewer, current.tick);
+        }
+    }
+    interest.removeStaleViewers(current.tick);
+}
+
+// Send every player the entities near its ship at a tick, delta-encoded against the player's baseline
+void Server::broadcastSnapshot(uint32_t tick) {
+    const SimSnapshot* current = history.find(tick);
+    if (current == nullptr) return;
+
+    // Copy out who to send to, one lane at a time, so encoding does not hold up the workers.
+    // playerStates was captured with the snapshot, so the input acknowledgements match its tick.
+    snapshotTargets.clear();
+    const double now = NetClockSeconds();
+    for (auto& shard : shards) {
+        for (auto& lane : shard->lanes) {
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            lane->sessions.forEach([&](uint64_t key, Session& session) {
+                if (session.playerId == 0 || session.shard == nullptr || !session.rate) return;
+                if (!interest.isViewer(session.viewer)) session.viewer = interest.addViewer();
+                const uint16_t inputSequence = session.playerId < playerStates.size()
+                    ? playerStates[session.playerId].inputSequence : uint16_t{ 0 };
+                const double budget = session.rate->available(now);
+                snapshotTargets.push_back(SnapshotTarget{ lane.get(), session.shard, session.addr, session.ackTick,
+                    session.playerId, session.viewer, inputSequence,
+                    session.reliable ? session.reliable->writeAck() : NetAck{ 0, 0 },
+                    key, budget, budget >= session.rate->burst(), 0 });
+                });
+        }
+    }
+    updateInterest(*current);
+
+    // Players that acknowledged the same tick and see the same entities share one encoding,
+    // found by hash so the lookup costs the same however many encodings the tick has
+    const size_t setBytes = INTEREST_SET_WORDS * sizeof(uint64_t);
+    encodedCount = 0;
+    encodedIndex.clear();
+    size_t bytes = 0;
+    size_t heldBack = 0;
+    for (SnapshotTarget& target : snapshotTargets) {
+        const SimSnapshot* baseline = nullptr;
+        const uint64_t* baseRelevant = nullptr;
+        if (target.ackTick != 0 && tick - target.ackTick < SIM_SNAPSHOT_HISTORY) {
+            baseline = history.find(target.ackTick); // An older baseline has left the ring; send in full
+            baseRelevant = interest.sentAt(target.viewer, target.ackTick);
+            if (baseRelevant == nullptr) baseline = nullptr; // Acknowledged before this view existed
+        }
+        uint32_t baseTick = baseline != nullptr ? baseline->tick : 0;
+        const uint64_t* relevant = interest.relevant(target.viewer);
+
+        EncodedSnapshot* snapshot = nullptr;
+        const uint64_t hash = encodingHash(baseTick, relevant, baseline != nullptr ? baseRelevant : nullptr);
+        auto found = encodedIndex.find(hash);
+        if (found != encodedIndex.end()) {
+            // A colliding hash gets an encoding of its own, not listed in the index
+            EncodedSnapshot& candidate = encoded[found->second];
+            if (candidate.baseTick == baseTick && std::memcmp(candidate.relevant, relevant, setBytes) == 0 &&
+                (baseline == nullptr || std::memcmp(candidate.baseRelevant, baseRelevant, setBytes) == 0)) {
+                snapshot = &candidate;
+            }
+        }
+        if (snapshot == nullptr) {
+            if (encodedCount == encoded.size()) encoded.emplace_back();
+            if (found == encodedIndex.end()) encodedIndex.emplace(hash, encodedCount);
+            snapshot = &encoded[encodedCount++];
+            std::memcpy(snapshot->relevant, relevant, setBytes);
+            if (baseline != nullptr) std::memcpy(snapshot->baseRelevant, baseRelevant, setBytes);
+            else std::memset(snapshot->baseRelevant, 0, setBytes);
+            encodeSnapshot(*current, baseline, *snapshot);
+        }
+
+        // A player whose link cannot take the tick skips it; the next one it gets is a delta against
+        // what it last acknowledged, so nothing is lost but the skipped tick's motion
+        int size = 0;
+        for (int part : snapshot->parts) size += part;
+        if (size > target.budget && !target.budgetFull) {
+            LOG_DEBUG("Snapshot {} held back from player {}: {} bytes over a budget of {}", tick,
+                target.playerId, size, static_cast<int>(target.budget));
+            ++heldBack;
+            continue;
+        }
+        interest.recordSent(target.viewer, tick);
+        target.sentBytes = size;
+
+        // Sending copies the datagram, so the shared parts can take each player's info in turn
+        const uint8_t partCount = static_cast<uint8_t>(snapshot->parts.size());
+        for (uint8_t part = 0; part < partCount; ++part) {
+            char* data = snapshot->data.data() + static_cast<size_t>(part) * NET_SNAPSHOT_MTU;
+            NetWriteSnapshotInfo(data + NET_HEADER_SIZE, NET_SNAPSHOT_INFO_SIZE, NetSnapshotInfo{
+                tick, snapshot->baseTick, part, partCount, snapshot->counts[part], target.inputSequence,
+                target.reliableAck });
+            sendReply(*target.shard, target.addr, data, snapshot->parts[part]);
+            bytes += snapshot->parts[part];
+        }
+    }
+
+    // Charge each player's budget and remember the tick, to measure its round trip and loss once acknowledged.
+    // Targets were gathered lane by lane, so each lane is locked once for its run of them.
+    for (size_t first = 0, last; first < snapshotTargets.size(); first = last) {
+        Lane* lane = snapshotTargets[first].lane;
+        for (last = first; last < snapshotTargets.size() && snapshotTargets[last].lane == lane; ++last) {}
+        std::lock_guard<std::mutex> lock(lane->mutex);
+        for (size_t i = first; i < last; ++i) {
+            const SnapshotTarget& target = snapshotTargets[i];
+            if (target.sentBytes == 0) continue;
+            Session* session = lane->sessions.find(target.key);
+            if (session == nullptr || !session->rate) continue; // Left while the tick was sent
+            session->rate->spend(target.sentBytes);
+            session->snapshotsSent.sent(tick, now);
+        }
+    }
+    LOG_TRACE("Snapshot {}: {} bytes to {} players, {} held back", tick, bytes,
+        snapshotTargets.size() - heldBack, heldBack);
+}
+
+// Take in a client's reliable packet and handle its messages in order
+void Server::handleReliable(Session& session, const char* data, int size) {
+    if (!reliableChannel(session).readPacket(NetClockSeconds(), data, size)) {
+        LOG_DEBUG("Dropped malformed reliable packet ({} bytes)", size);
+        return;
+    }
+
+    // Replies are queued on the channel too and leave with the next tick's packets
+    std::vector<char> message;
+    while (session.reliable->receive(message)) {
+        if (message.empty()) continue;
+        switch (static_cast<CommandID>(message[0])) {
+        case CommandID::REQ_LISTUSERS:
+            queueUserList(session); // The channel exists by now, so this never needs the raw send
+            break;
+        default:
+            LOG_DEBUG("Ignored reliable command {}", static_cast<int>(static_cast<uint8_t>(message[0])));
+            break;
+        }
+    }
+}
+
+// The session's reliable channel, created on first use and tied to its send budget
+NetReliableChannel& Server::reliableChannel(Session& session) {
+    if (!session.reliable) {
+        session.reliable = std::make_unique<NetReliableChannel>();
+        session.reliable->setRateController(session.rate.get()); // Heap-allocated, so it survives the table moving
+    }
+    return *session.reliable;
+}
+
+// Queue changed standings and send the reliable packets that are due, once per tick
+void Server::updateReliable() {
+    const double now = NetClockSeconds();
+    for (auto& shard : shards) {
+        for (auto& lane : shard->lanes) {
+            std::lock_guard<std::mutex> lock(lane->mutex); // One lane at a time; the rest keep working
+            lane->sessions.forEach([&](uint64_t, Session& session) {
+                if (session.shard == nullptr) return;
+
+                // A player's score and lives go out whenever they change, and once when the player joins
+                const PlayerState* player = session.playerId != 0 && session.playerId < playerStates.size() &&
+                    playerStates[session.playerId].active ? &playerStates[session.playerId] : nullptr;
+                if (player != nullptr && (!session.hasStanding || player->score != session.standing.score ||
+                    player->lives != session.standing.lives)) {
+                    NetGameEvent standing{ player->score, static_cast<int16_t>(player->lives),
+                        static_cast<uint8_t>(player->out ? 1 : 0) };
+                    char message[1 + NET_GAME_EVENT_SIZE];
+                    message[0] = static_cast<char>(CommandID::RSP_GAME_EVENT);
+                    NetWriteGameEvent(message + 1, NET_GAME_EVENT_SIZE, standing);
+                    if (reliableChannel(session).queue(message, sizeof(message))) { // Retried next tick while the window is full
+                        session.standing = standing;
+                        session.hasStanding = true;
+                    }
+                }
+
+                if (!session.reliable) return;
+                char packet[NET_RELIABLE_PACKET_MAX];
+                int size;
+                // What the budget has no room for waits for a later tick
+                while ((!session.rate || session.rate->available(now) > 0) &&
+                    (size = session.reliable->writePacket(now, packet, sizeof(packet))) > 0) {
+                    if (session.rate) session.rate->spend(size);
+                    sendReply(*session.shard, session.addr, packet, size);
+                }
+                });
+        }
+    }
+}
+
+// Store a client's ship report and acknowledge it until the client joins the game
+void Server::handleShipState(Shard& shard, Session& session, const char* data, int size) {
+    NetHeader header{};
+    NetShipState ship{};
+    if (!NetReadHeader(data, size, header) ||
+        !NetReadShipState(data + NET_HEADER_SIZE, size - NET_HEADER_SIZE, ship)) {
+        LOG_DEBUG("Dropped malformed ship state ({} bytes)", size);
+        return;
+    }
+
+    // Reports can arrive out of order; only a newer one replaces the stored state
+    if (session.hasShip && !NetSequenceNewer(header.sequence, session.shipSequence)) return;
+    session.ship = ship;
+    session.shipSequence = header.sequence;
+    session.hasShip = true;
+
+    // A player is acknowledged by the snapshots, which are charged to its budget; an unbudgeted
+    // echo every send tick on top of them would get around the rate limit
+    if (session.playerId != 0) return;
+
+    // Acknowledge with the state as stored, encoded on the stack
+    char reply[NET_HEADER_SIZE + NET_SHIP_STATE_SIZE];
+    int replySize = NetEncodeShipMessage(reply, sizeof(reply),
+        static_cast<uint8_t>(CommandID::RSP_SHIP_STATE), header.sequence, ship);
+    sendReply(shard, session.addr, reply, replySize);
+}
+
+// Send a reply, through the shard's outbound stage when it is enabled
+bool Server::sendReply(Shard& shard, const sockaddr_in& clientAddr, const char* data, int size) {
+    if (shard.outbound) {
+        shard.outbound->enqueue(clientAddr, data, size); // Leaves with the next flush
+        return true;
+    }
+
+    int sendResult = sendto(shard.socket, data, size, 0,
+        reinterpret_cast<const sockaddr*>(&clientAddr), sizeof(clientAddr));
+    shard.sendStats.datagrams.fetch_add(sendResult == SOCKET_ERROR ? 0 : 1, std::memory_order_relaxed);
+    shard.sendStats.syscalls.fetch_add(1, std::memory_order_relaxed);
+    shard.sendStats.messages.fetch_add(1, std::memory_order_relaxed);
+    return sendResult != SOCKET_ERROR;
+}
+
+// Send data to a client over its TCP socket or its shard
+bool Server::sendToClient(const SessionRoute& route, const char* data, int size) {
+    if (route.shard != nullptr) {
+        return sendReply(*route.shard, route.addr, data, size);
+    }
+    return send(route.socket, data, size, 0) != SOCKET_ERROR;
+}
+
 // Forward an echo message to another client
-void Server::forwardEchoMessage(char* buffer, int length, const std::string& senderKey) {
+void Server::forwardEchoMessage(char* buffer, int length, uint64_t senderKey) {
+    if (length < 11) return; // Command ID, address, port and message length
+
     uint32_t destIPAddress;
     uint16_t destPort;
 
-    // Extract destination IP and port from the buffer
+    // Extract destination IP and port from the buffer; both stay in network byte order
     memcpy(&destIPAddress, buffer + 1, 4);
     memcpy(&destPort, buffer + 5, 2);
-    destPort = ntohs(destPort); // Convert port to host byte order
-
-    char destIP[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &destIPAddress, destIP, INET_ADDRSTRLEN); // Convert IP to string
-    std::string destKey = std::string(destIP) + ":" + std::to_string(destPort); // Create destination key
+    uint64_t destKey = sessionKey(destIPAddress, destPort); // Create destination key
 
-    std::lock_guard<std::mutex> lock(clientsMutex); // Lock the clients map
+    // The two clients may be in different lanes; each is looked up under its own lane's lock in turn
+    SessionRoute sender;
+    if (!findRoute(senderKey, sender)) return;
 
     // Check if the destination client exists
-    if (clients.find(destKey) == clients.end()) {
-        std::cerr << "Client not found: " << destKey << std::endl;
+    SessionRoute dest;
+    if (!findRoute(destKey, dest)) {
+        LOG_WARN("Client not found: {}:{}", LogIpv4{ destIPAddress }, LogPort{ destPort });
         char errorMessage[1] = { static_cast<char>(CommandID::ECHO_ERROR) };
-        send(clients[senderKey], errorMessage, 1, 0); // Send an error message to the sender
+        sendToClient(sender, errorMessage, 1); // Send an error message to the sender
         return;
     }
 
     buffer[0] = static_cast<char>(CommandID::RSP_ECHO); // Change the command ID to RSP_ECHO
-    send(clients[destKey], buffer, length, 0); // Send the message to the destination client
-
-    uint32_t senderIP;
-    uint16_t senderPort;
-
-    // Extract sender IP and port from the sender key
-    inet_pton(AF_INET, senderKey.substr(0, senderKey.find(':')).c_str(), &senderIP);
-    senderPort = htons(std::stoi(senderKey.substr(senderKey.find(':') + 1)));
+    sendToClient(dest, buffer, length); // Send the message to the destination client
 
     // Update the buffer with the sender's IP and port
+    uint32_t senderIP = sessionKeyIp(senderKey);
+    uint16_t senderPort = sessionKeyPort(senderKey);
     memcpy(buffer + 1, &senderIP, 4);
     memcpy(buffer + 5, &senderPort, 2);
 
-    send(clients[senderKey], buffer, length, 0); // Send the updated message back to the sender
+    sendToClient(sender, buffer, length); // Send the updated message back to the sender
 
     // Log the forwarded message
-    std::cout << "==========FORWARDED MESSAGE==========\n"
-        << "From: " << senderKey << "\n"
-        << "To: " << destKey << "\n"
-        << "Message: " << std::string(buffer + 11, length - 11) << "\n"
-        << "======================================\n";
+    LOG_DEBUG("Forwarded {} bytes from {}:{} to {}",
+        length - 11, LogIpv4{ senderIP }, LogPort{ senderPort }, LogIpv4{ destIPAddress });
 }
 
-// Send the list of connected users to a client
-void Server::sendUserList(SOCKET clientSocket) {
-    std::lock_guard<std::mutex> lock(clientsMutex); // Lock the clients map
+// Queue the list of connected users on a client's reliable channel, if it has one
+bool Server::queueUserList(Session& session) {
+    if (!session.reliable) return false;
 
-    uint16_t userCount = htons(clients.size()); // Convert user count to network byte order
-    std::vector<char> message;
-    message.push_back(static_cast<char>(CommandID::RSP_LISTUSERS)); // Add the command ID
-    message.insert(message.end(), reinterpret_cast<char*>(&userCount), reinterpret_cast<char*>(&userCount) + 2); // Add the user count
+    // Encoded when a client last joined or left; this only takes a reference to that version
+    std::shared_ptr<const UserListVersion> list = userList.current();
 
-    // Add each client's IP and port to the message
-    for (const auto& [key, socket] : clients) {
-        uint32_t ip;
-        uint16_t port;
-        std::string ipStr = key.substr(0, key.find(':'));
-        inet_pton(AF_INET, ipStr.c_str(), &ip); // Convert IP to binary
-        port = htons(std::stoi(key.substr(key.find(':') + 1))); // Convert port to network byte order
-
-        message.insert(message.end(), reinterpret_cast<char*>(&ip), reinterpret_cast<char*>(&ip) + 4); // Add IP
-        message.insert(message.end(), reinterpret_cast<char*>(&port), reinterpret_cast<char*>(&port) + 2); // Add port
+    // Ordered parts that each fit a packet
+    for (const UserListPart& part : list->parts) {
+        if (!session.reliable->queue(part->data(), static_cast<int>(part->size()))) {
+            LOG_WARN("Reliable window full, user list cut short");
+            break;
+        }
     }
+    return true;
+}
 
-    send(clientSocket, message.data(), message.size(), 0); // Send the message to the client
+// Send the list of connected users to a client in one message
+void Server::sendUserList(const SessionRoute& route) {
+    std::shared_ptr<const UserListVersion> list = userList.current();
+    const std::vector<char>& whole = list->whole(); // Joined from the parts once per version, on first use
+    sendToClient(route, whole.data(), static_cast<int>(whole.size())); // Send the message to the client
 }
 
 // Handle server disconnection
@@ -427,8 +1424,17 @@ void Server::onDisconnect() {
 
 // Clean up resources
 void Server::cleanup() {
+    running = false; // Stop the shard threads
+    if (simThread.joinable()) simThread.join();
+    for (auto& shard : shards) {
+        shutdown(shard->socket, SD_BOTH); // Wake the receive loop
+        if (shard->receiveThread.joinable()) shard->receiveThread.join();
+        if (shard->flushThread.joinable()) shard->flushThread.join();
+        if (shard->socket != listenerSocket) closesocket(shard->socket);
+    }
+    Logger::stop(); // Print what the workers logged before they stopped
     if (listenerSocket != INVALID_SOCKET) {
         closesocket(listenerSocket); // Close the listener socket
     }
-    WSACleanup(); // Clean up Winsock
+    NetCleanup(); // Clean up Winsock
 }
\ No newline at end of file
@@ -0,0 +1,742 @@
+/*******************************************************************************
+ * Standalone micro-benchmarks, run with: server --bench NAME
+ ******************************************************************************/
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <unordered_set>
+#include "NetSocket.h"
+#include "Protocol.h"
+#include "NetBundle.h"
+#include "NetStream.h"
+#include "NetReliable.h"
+#include "sessiontable.h"
+#include "userlist.h"
+#include "sendqueue.h"
+#include "taskqueue.h"
+#include "ringbuffer.h"
+#include "lanebuffer.h"
+#include "bench.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+// Loopback send throughput: one reply per sendto, against the outbound stage
+// flushed every tick with sendmmsg, with UDP_SEGMENT trains to one peer, and
+// with the tick's replies packed into MTU-sized bundles. The sender waits while
+// more datagrams are in flight than the receive buffer holds, so the rate is
+// of replies delivered, and a run that still loses any fails the benchmark.
+static bool benchSend()
+{
+	const int packetCount = 200000;
+	const int packetsPerTick = 256;
+	const int payloadSize = 64;
+	const uint64_t inFlightMax = 1024;	// Datagrams sent and not yet received
+
+	if (!NetStartup()) return false;
+
+	SOCKET receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	SOCKET sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	addr.sin_port = 0;
+	bind(receiver, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+	socklen_t addrSize = sizeof(addr);
+	getsockname(receiver, reinterpret_cast<sockaddr*>(&addr), &addrSize);
+
+	int bufferSize = 16 * 1024 * 1024;
+	setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+#ifdef _WIN32
+	DWORD timeout = 200;
+#else
+	timeval timeout{ 0, 200000 };
+#endif
+	setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+	// Drain the receiver so the kernel queue does not throttle the sender.
+	std::atomic<bool> stay{ true };
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> receivedDatagrams{ 0 };
+	std::thread drain([&]() {
+		static char buffers[NET_RECV_BATCH_MAX][2048];
+		NetDatagram slots[NET_RECV_BATCH_MAX];
+		for (int i = 0; i < NET_RECV_BATCH_MAX; ++i)
+		{
+			slots[i].data = buffers[i];
+			slots[i].capacity = sizeof(buffers[i]);
+		}
+		while (stay)
+		{
+			int count = NetRecvBatch(receiver, slots, NET_RECV_BATCH_MAX);
+			for (int i = 0; i < count; ++i)
+			{
+				// Count the replies a bundle carries, walking them in place as the client does
+				uint64_t messages = 1;
+				if (slots[i].size > 0 && static_cast<uint8_t>(slots[i].data[0]) == NET_CMD_BUNDLE)
+				{
+					messages = 0;
+					const char* message;
+					int length;
+					for (NetBundleReader reader{ slots[i].data, slots[i].size }; reader.next(message, length);) ++messages;
+				}
+				received += messages;
+				++receivedDatagrams;
+			}
+		}
+	});
+
+	// Hold the sender back until the receiver has caught up to within inFlightMax datagrams
+	auto pace = [&](const NetIoStats& stats) {
+		auto stalled = BenchClock::now();
+		uint64_t seen = receivedDatagrams.load();
+		while (stats.datagrams.load() - receivedDatagrams.load() > inFlightMax)
+		{
+			if (receivedDatagrams.load() != seen)
+			{
+				seen = receivedDatagrams.load();
+				stalled = BenchClock::now();
+			}
+			else if (BenchClock::now() - stalled > std::chrono::milliseconds(300))
+			{
+				return; // Lost on the way; the count at the end reports it
+			}
+			std::this_thread::yield();
+		}
+	};
+
+	char payload[payloadSize] = {};
+	bool lossless = true;
+
+	auto run = [&](const char* label, const std::function<void(NetIoStats&)>& send) {
+		NetIoStats stats;
+		received = 0;
+		receivedDatagrams = 0;
+		auto start = BenchClock::now();
+		send(stats);
+
+		// Timed until the last reply arrives, or until none has for a while
+		auto last = BenchClock::now();
+		uint64_t seen = received.load();
+		while (seen < static_cast<uint64_t>(packetCount) && BenchClock::now() - last < std::chrono::milliseconds(300))
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			if (received.load() != seen)
+			{
+				seen = received.load();
+				last = BenchClock::now();
+			}
+		}
+		double seconds = std::chrono::duration<double>(last - start).count();
+
+		uint64_t syscalls = stats.syscalls.load();
+		std::cout << label << ": "
+			<< static_cast<uint64_t>(seen / seconds) << " replies/s received in "
+			<< receivedDatagrams.load() << " packets, "
+			<< syscalls << " syscalls ("
+			<< (syscalls ? static_cast<double>(packetCount) / syscalls : 0.0) << " replies/syscall), "
+			<< seen << "/" << packetCount << " received";
+		if (seen < static_cast<uint64_t>(packetCount))
+		{
+			std::cout << " (FAILED: " << packetCount - seen << " lost)";
+			lossless = false;
+		}
+		std::cout << std::endl;
+	};
+
+	run("sendto per packet", [&](NetIoStats& stats) {
+		for (int i = 0; i < packetCount; ++i)
+		{
+			if (i % packetsPerTick == 0) pace(stats);
+			int sent = sendto(sender, payload, payloadSize, 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+			stats.datagrams.fetch_add(sent == SOCKET_ERROR ? 0 : 1, std::memory_order_relaxed);
+			stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	// Bundling is left out of the first two so they measure the syscall path alone
+	for (int mode = 0; mode < 3; ++mode)
+	{
+		const char* labels[] = { "send queue, sendmmsg", "send queue, UDP_SEGMENT", "send queue, bundled" };
+		run(labels[mode], [&](NetIoStats& stats) {
+			SendQueue queue{ sender, mode > 0, mode == 2 ? NET_BUNDLE_MTU : 0, &stats };
+			for (int i = 0; i < packetCount; ++i)
+			{
+				queue.enqueue(addr, payload, payloadSize);
+				if ((i + 1) % packetsPerTick == 0)
+				{
+					pace(stats);
+					queue.flush();
+				}
+			}
+			queue.flush();
+		});
+	}
+
+	stay = false;
+	drain.join();
+	closesocket(sender);
+	closesocket(receiver);
+	NetCleanup();
+	return lossless;
+}
+
+// One producer feeding workerCount workers through a TaskQueue backend. Drives
+// the backend directly so the TaskQueue's per-task console output stays out of
+// the numbers. Each task does a little hashing, roughly one small packet's work.
+template <template <typename> class TBuffer>
+static void benchBackend(const char* label)
+{
+	const size_t taskCount = 200000;
+	const size_t slotCount = 256;
+
+	std::cout << label << ":" << std::endl;
+	for (size_t workerCount = 1; workerCount <= 32; workerCount *= 2)
+	{
+		TBuffer<uint64_t> buffer{ slotCount, workerCount };
+		std::atomic<size_t> done{ 0 };
+		std::atomic<uint64_t> checksum{ 0 };
+
+		auto start = BenchClock::now();
+		std::vector<std::thread> workers;
+		for (size_t w = 0; w < workerCount; ++w)
+		{
+			workers.emplace_back([&, w]() {
+				uint64_t local = 0;
+				while (std::optional<uint64_t> item = buffer.pop(w))
+				{
+					uint64_t h = *item;
+					for (int i = 0; i < 64; ++i)
+					{
+						h = h * 6364136223846793005ull + 1442695040888963407ull;
+					}
+					local += h;
+					done.fetch_add(1, std::memory_order_relaxed);
+				}
+				checksum += local;
+			});
+		}
+
+		for (uint64_t i = 0; i < taskCount; ++i)
+		{
+			buffer.push(i);
+		}
+		while (done.load() < taskCount)
+		{
+			std::this_thread::yield();
+		}
+		double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+		buffer.close();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+
+		std::cout << "  " << workerCount << " workers: "
+			<< static_cast<uint64_t>(taskCount / seconds) << " tasks/s" << std::endl;
+	}
+}
+
+// TaskQueue backends scaling from 1 to 32 workers.
+static bool benchTaskQueue()
+{
+	std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+	benchBackend<LockedBuffer>("LockedBuffer");
+	benchBackend<RingBuffer>("RingBuffer");
+	benchBackend<WorkStealingBuffer>("WorkStealingBuffer");
+	benchBackend<AffinityBuffer>("AffinityBuffer");
+	return true;
+}
+
+// Round trip of every quantized field and of whole entity deltas through the
+// bit stream, then encode/decode throughput. Fails if a value comes back with
+// more than its quantizer's error, or if quantizing twice changes a value
+// (delta snapshots rely on the world's state surviving the wire exactly).
+static bool benchBitStream()
+{
+	std::mt19937 random{ 1 };
+	bool ok = true;
+
+	struct Field { const char* name; const NetQuantizer& quantizer; float low; float high; };
+	const Field fields[] = {
+		{ "position", NET_QUANT_POS, -2000.0f, 2000.0f },
+		{ "velocity", NET_QUANT_VEL, -1000.0f, 1000.0f },
+		{ "direction", NET_QUANT_DIR, -3.14159265f, 3.14159265f },
+	};
+	for (const Field& field : fields)
+	{
+		std::uniform_real_distribution<float> value{ field.low, field.high };
+		float worst = 0.0f;
+		int unstable = 0;
+		for (int i = 0; i < 1000000; ++i)
+		{
+			float v = value(random);
+			float q = field.quantizer.quantize(v);
+			float error = std::fabs(q - v);
+			if (field.quantizer.wraps) error = std::min(error, 2.0f * 3.14159265f - error);
+			worst = std::max(worst, error);
+			if (field.quantizer.quantize(q) != q) ++unstable;
+		}
+		bool fieldOk = worst <= field.quantizer.maxError() * 1.001f && unstable == 0;
+		ok = ok && fieldOk;
+		std::cout << field.name << ": " << field.quantizer.bits << " bits, max error " << worst
+			<< " (bound " << field.quantizer.maxError() << "), " << unstable << " unstable"
+			<< (fieldOk ? "" : "  FAILED") << std::endl;
+	}
+
+	// Random deltas with random masks; decoded fields must equal the quantized originals
+	const int entityCount = 40;
+	std::vector<char> buffer((entityCount * NET_ENTITY_DELTA_MAX_BITS + 7) / 8);
+	std::vector<NetEntityState> states(entityCount);
+	std::vector<uint8_t> masks(entityCount);
+	std::uniform_real_distribution<float> pos{ -2000.0f, 2000.0f }, vel{ -1000.0f, 1000.0f }, dir{ -3.14159265f, 3.14159265f };
+	int mismatches = 0;
+	for (int round = 0; round < 20000; ++round)
+	{
+		NetBitWriter writer{ buffer.data(), static_cast<int>(buffer.size()) };
+		for (int i = 0; i < entityCount; ++i)
+		{
+			NetEntityState& state = states[i];
+			state = NetEntityState{ static_cast<uint16_t>(random() & 0x7FF), static_cast<uint8_t>(random() & 3),
+				static_cast<uint16_t>(random()), static_cast<uint8_t>(random()),
+				pos(random), pos(random), vel(random), vel(random), dir(random) };
+			masks[i] = static_cast<uint8_t>(random() & 0x1F);
+			NetWriteEntityDelta(writer, masks[i], state);
+		}
+		int size = writer.flush();
+
+		NetBitReader reader{ buffer.data(), size };
+		for (int i = 0; i < entityCount; ++i)
+		{
+			const NetEntityState& in = states[i];
+			NetEntityState out{};
+			uint8_t mask = 0;
+			bool same = NetReadEntityDelta(reader, mask, out) && mask == masks[i] && out.id == in.id;
+			if (mask & NET_ENTITY_CREATE)
+			{
+				same = same && out.type == in.type && out.owner == in.owner && out.scaleClass == in.scaleClass;
+			}
+			if (mask & NET_ENTITY_POS)
+			{
+				same = same && out.posX == NET_QUANT_POS.quantize(in.posX) && out.posY == NET_QUANT_POS.quantize(in.posY);
+			}
+			if (mask & NET_ENTITY_VEL)
+			{
+				same = same && out.velX == NET_QUANT_VEL.quantize(in.velX) && out.velY == NET_QUANT_VEL.quantize(in.velY);
+			}
+			if (mask & NET_ENTITY_DIR)
+			{
+				same = same && out.dir == NET_QUANT_DIR.quantize(in.dir);
+			}
+			if (!same) ++mismatches;
+		}
+	}
+	ok = ok && mismatches == 0;
+	std::cout << "entity deltas: " << mismatches << " mismatches" << (mismatches == 0 ? "" : "  FAILED") << std::endl;
+
+	// Throughput of whole entities, every field present
+	const int iterations = 200000;
+	const uint8_t full = NET_ENTITY_CREATE | NET_ENTITY_POS | NET_ENTITY_VEL | NET_ENTITY_DIR;
+	int bytes = 0;
+	auto start = BenchClock::now();
+	for (int round = 0; round < iterations; ++round)
+	{
+		NetBitWriter writer{ buffer.data(), static_cast<int>(buffer.size()) };
+		for (const NetEntityState& state : states)
+		{
+			NetWriteEntityDelta(writer, full, state);
+		}
+		bytes = writer.flush();
+	}
+	double encodeSeconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+	uint64_t checksum = 0;
+	start = BenchClock::now();
+	for (int round = 0; round < iterations; ++round)
+	{
+		NetBitReader reader{ buffer.data(), bytes };
+		for (int i = 0; i < entityCount; ++i)
+		{
+			NetEntityState out{};
+			uint8_t mask = 0;
+			NetReadEntityDelta(reader, mask, out);
+			checksum += out.id;
+		}
+	}
+	double decodeSeconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+	double entities = static_cast<double>(iterations) * entityCount;
+	std::cout << "full entity: " << NET_ENTITY_DELTA_MAX_BITS << " bits ("
+		<< static_cast<double>(bytes) / entityCount << " bytes packed)" << std::endl;
+	std::cout << "encode: " << static_cast<uint64_t>(entities / encodeSeconds) << " entities/s" << std::endl;
+	std::cout << "decode: " << static_cast<uint64_t>(entities / decodeSeconds) << " entities/s"
+		<< " (checksum " << checksum << ")" << std::endl;
+	return ok;
+}
+
+// The console parser as it was: a byte vector erased from the front after
+// every message and one byte at a time past unknown ones. Kept as the baseline.
+static void parseErasing(std::vector<uint8_t>& queue, uint64_t& messages, uint64_t& checksum)
+{
+	while (!queue.empty())
+	{
+		uint8_t commandId = queue[0];
+		size_t size = 0;
+		if (commandId == NET_CMD_REQ_ECHO || commandId == NET_CMD_RSP_ECHO)
+		{
+			if (queue.size() < NET_STREAM_ECHO_FIXED_SIZE) break;
+			size = NET_STREAM_ECHO_FIXED_SIZE + NetReadU32(reinterpret_cast<const char*>(&queue[7]));
+		}
+		else if (commandId == NET_CMD_RSP_LISTUSERS)
+		{
+			if (queue.size() < NET_STREAM_LIST_FIXED_SIZE) break;
+			size = NET_STREAM_LIST_FIXED_SIZE +
+				NetReadU16(reinterpret_cast<const char*>(&queue[1])) * size_t{ NET_STREAM_LIST_ENTRY_SIZE };
+		}
+		else if (commandId == NET_CMD_ECHO_ERROR)
+		{
+			size = 1;
+		}
+		else
+		{
+			queue.erase(queue.begin(), queue.begin() + 1);
+			continue;
+		}
+		if (queue.size() < size) break;
+		++messages;
+		checksum = checksum * 31 + commandId + size;
+		queue.erase(queue.begin(), queue.begin() + size);
+	}
+}
+
+// Megabytes of pipelined console messages, with a little garbage between them,
+// fed in datagram-sized and stream-read-sized pieces to the erasing baseline and
+// to NetStreamParser. Fails if the two disagree on a single message.
+static bool benchStream()
+{
+	const size_t streamBytes = 8 << 20;
+	std::mt19937 random{ 1 };
+	std::vector<char> stream;
+	stream.reserve(streamBytes + 4096);
+	uint64_t written = 0;
+	while (stream.size() < streamBytes)
+	{
+		char message[NET_STREAM_ECHO_FIXED_SIZE + 256];
+		size_t size = 0;
+		switch (random() % 8)
+		{
+		case 0:
+		{
+			const uint16_t users = static_cast<uint16_t>(random() % 40);
+			message[0] = static_cast<char>(NET_CMD_RSP_LISTUSERS);
+			NetWriteU16(message + 1, users);
+			size = NET_STREAM_LIST_FIXED_SIZE + users * size_t{ NET_STREAM_LIST_ENTRY_SIZE };
+			for (size_t i = NET_STREAM_LIST_FIXED_SIZE; i < size; ++i) message[i] = static_cast<char>(random());
+			break;
+		}
+		case 1:
+			message[0] = static_cast<char>(NET_CMD_ECHO_ERROR);
+			size = 1;
+			break;
+		case 2:
+			// A stray byte that starts no message
+			message[0] = static_cast<char>(0x7F);
+			size = 1;
+			--written;
+			break;
+		default:
+		{
+			const uint32_t textSize = static_cast<uint32_t>(random() % 64);
+			message[0] = static_cast<char>(random() % 2 ? NET_CMD_REQ_ECHO : NET_CMD_RSP_ECHO);
+			NetWriteU32(message + 1, static_cast<uint32_t>(random()));
+			NetWriteU16(message + 5, static_cast<uint16_t>(random()));
+			NetWriteU32(message + 7, textSize);
+			size = NET_STREAM_ECHO_FIXED_SIZE + textSize;
+			for (size_t i = NET_STREAM_ECHO_FIXED_SIZE; i < size; ++i) message[i] = static_cast<char>('a' + random() % 26);
+			break;
+		}
+		}
+		stream.insert(stream.end(), message, message + size);
+		++written;
+	}
+	std::cout << "stream: " << stream.size() / 1024 << " KB, " << written << " messages" << std::endl;
+
+	bool ok = true;
+	for (size_t chunk : { size_t{ 1400 }, size_t{ 65536 } })
+	{
+		uint64_t erasingMessages = 0;
+		uint64_t erasingChecksum = 0;
+		auto start = BenchClock::now();
+		std::vector<uint8_t> queue;
+		for (size_t offset = 0; offset < stream.size(); offset += chunk)
+		{
+			const size_t size = std::min(chunk, stream.size() - offset);
+			queue.insert(queue.end(), stream.begin() + offset, stream.begin() + offset + size);
+			parseErasing(queue, erasingMessages, erasingChecksum);
+		}
+		double erasingSeconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+		uint64_t parserMessages = 0;
+		uint64_t parserChecksum = 0;
+		start = BenchClock::now();
+		NetStreamParser parser;
+		NetStreamMessage message;
+		for (size_t offset = 0; offset < stream.size(); offset += chunk)
+		{
+			const size_t size = std::min(chunk, stream.size() - offset);
+			parser.append(stream.data() + offset, size);
+			while (parser.next(message))
+			{
+				++parserMessages;
+				parserChecksum = parserChecksum * 31 + message.commandId + message.size;
+			}
+		}
+		double parserSeconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+		const bool chunkOk = erasingMessages == written && parserMessages == written &&
+			erasingChecksum == parserChecksum && parser.pending() == 0;
+		ok = ok && chunkOk;
+		const double megabytes = stream.size() / 1048576.0;
+		std::cout << "  " << chunk << "-byte reads: erasing " << static_cast<uint64_t>(megabytes / erasingSeconds)
+			<< " MB/s, ring parser " << static_cast<uint64_t>(megabytes / parserSeconds) << " MB/s ("
+			<< parserMessages << " messages, " << parser.skipped() << " bytes skipped)"
+			<< (chunkOk ? "" : "  FAILED") << std::endl;
+	}
+	return ok;
+}
+
+// Two reliable channels talking over a simulated link that loses, reorders
+// and duplicates packets, in both directions, for long enough that message ids
+// and packet sequences wrap around 16 bits. Fails unless each side receives
+// every message the other queued, once, in order and intact.
+static bool benchReliable()
+{
+	const uint32_t messageCount = 250000;	// Each way; ids wrap three times, packet sequences at least once
+	const double tick = 1.0 / 60.0;
+	const double loss = 0.25;
+	const double duplicate = 0.1;
+	const double delayMin = 0.02;			// One-way delay, drawn per packet so packets overtake each other
+	const double delayMax = 0.12;
+
+	std::mt19937 random{ 1 };
+	std::uniform_real_distribution<double> chance{ 0.0, 1.0 };
+	std::uniform_real_distribution<double> delay{ delayMin, delayMax };
+
+	// Message n holds n and filler derived from it, 4 to 403 bytes in all, so a packet carries
+	// only a few and the packet sequence wraps too
+	auto makeMessage = [](uint32_t n, std::vector<char>& out) {
+		out.resize(4 + n * 37 % 400);
+		NetWriteU32(out.data(), n);
+		for (size_t i = 4; i < out.size(); ++i) out[i] = static_cast<char>(n * 7 + i);
+	};
+
+	struct InFlight
+	{
+		double arrival;
+		bool isAck;						// A NetAck piggybacked on another message, not a reliable packet
+		NetAck ack;
+		std::vector<char> data;
+	};
+	struct Side
+	{
+		NetReliableChannel channel;
+		std::vector<InFlight> link;		// Packets on their way to the other side
+		uint32_t queued = 0;
+		uint32_t expected = 0;			// Next message this side should receive
+		uint64_t packets = 0;
+		uint64_t bad = 0;				// Received out of order, twice, or corrupted
+	};
+	Side sides[2];
+
+	auto transmit = [&](Side& from, double now, InFlight packet) {
+		if (chance(random) < loss) return;
+		packet.arrival = now + delay(random);
+		if (chance(random) < duplicate)
+		{
+			InFlight copy = packet;
+			copy.arrival = now + delay(random);
+			from.link.push_back(std::move(copy));
+		}
+		from.link.push_back(std::move(packet));
+	};
+
+	double now = 0.0;
+	const double timeLimit = 3600.0;
+	std::vector<char> message;
+	char packet[NET_RELIABLE_PACKET_MAX];
+	auto start = BenchClock::now();
+	while ((sides[0].expected < messageCount || sides[1].expected < messageCount) && now < timeLimit)
+	{
+		now += tick;
+		for (int s = 0; s < 2; ++s)
+		{
+			Side& self = sides[s];
+			Side& peer = sides[1 - s];
+
+			// Take in what has arrived, in arrival order
+			std::sort(peer.link.begin(), peer.link.end(),
+				[](const InFlight& a, const InFlight& b) { return a.arrival < b.arrival; });
+			size_t arrived = 0;
+			while (arrived < peer.link.size() && peer.link[arrived].arrival <= now)
+			{
+				const InFlight& in = peer.link[arrived++];
+				if (in.isAck) self.channel.readAck(now, in.ack);
+				else if (!self.channel.readPacket(now, in.data.data(), static_cast<int>(in.data.size()))) ++self.bad;
+			}
+			peer.link.erase(peer.link.begin(), peer.link.begin() + arrived);
+
+			while (self.channel.receive(message))
+			{
+				std::vector<char> wanted;
+				makeMessage(self.expected, wanted);
+				if (message != wanted) ++self.bad;
+				else ++self.expected;
+			}
+
+			// Queue as much as the window takes, then send what is due and an ack riding on an unreliable message
+			while (self.queued < messageCount)
+			{
+				makeMessage(self.queued, message);
+				if (!self.channel.queue(message.data(), static_cast<int>(message.size()))) break;
+				++self.queued;
+			}
+			int size;
+			while ((size = self.channel.writePacket(now, packet, sizeof(packet))) > 0)
+			{
+				++self.packets;
+				transmit(self, now, InFlight{ 0.0, false, NetAck{ 0, 0 }, std::vector<char>(packet, packet + size) });
+			}
+			transmit(self, now, InFlight{ 0.0, true, self.channel.writeAck(), {} });
+		}
+	}
+	double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+	bool ok = true;
+	for (int s = 0; s < 2; ++s)
+	{
+		const Side& side = sides[s];
+		const Side& peer = sides[1 - s];
+		// Sequences wrap past 65535 packets, skipping 0
+		const bool sideOk = side.expected == messageCount && side.bad == 0 && peer.packets > 65535;
+		ok = ok && sideOk;
+		std::cout << (s == 0 ? "a" : "b") << " received " << side.expected << "/" << messageCount << " messages in order, "
+			<< side.bad << " bad, from " << peer.packets << " packets"
+			<< (sideOk ? "" : "  FAILED") << std::endl;
+	}
+	std::cout << "reliable: " << loss * 100.0 << "% loss, " << duplicate * 100.0 << "% duplicated, "
+		<< delayMin * 1000.0 << "-" << delayMax * 1000.0 << " ms delay, " << now << " s simulated in "
+		<< seconds << " s, round trip " << sides[0].channel.roundTrip() * 1000.0 << " ms"
+		<< (ok ? "" : "  FAILED") << std::endl;
+	return ok;
+}
+
+// Random joins and leaves against UserListCache, checked against a plain set
+// of users. Fails if a version's parts or whole list miss a user, hold one
+// twice or overflow a reliable message, or if a change re-encodes more than
+// the two parts it may touch instead of sharing the rest.
+static bool benchUserList()
+{
+	const int changes = 200000;
+	const size_t keyPool = 8000;			// Enough users at once for dozens of parts
+	const int checkEvery = 97;				// A full check walks every user, so only some versions get one
+
+	std::mt19937 random{ 1 };
+	UserListCache cache;
+	std::unordered_set<uint64_t> users;
+	std::vector<uint64_t> pool(keyPool);
+	for (size_t i = 0; i < keyPool; ++i)
+	{
+		pool[i] = sessionKey(static_cast<uint32_t>(random()), static_cast<uint16_t>(random()));
+	}
+
+	// Every user of a version, from its parts, and the same from its whole list
+	auto decode = [](const char* message, size_t size, std::vector<uint64_t>& out) {
+		if (size < 3) return false;
+		const size_t count = NetReadU16(message + 1);
+		if (static_cast<uint8_t>(message[0]) != NET_CMD_RSP_LISTUSERS || size != 3 + count * 6) return false;
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint32_t ip;
+			uint16_t port;
+			std::memcpy(&ip, message + 3 + i * 6, 4);
+			std::memcpy(&port, message + 7 + i * 6, 2);
+			out.push_back(sessionKey(ip, port));
+		}
+		return true;
+	};
+
+	uint64_t bad = 0;
+	uint64_t checked = 0;
+	uint64_t encodedParts = 0;
+	std::shared_ptr<const UserListVersion> previous = cache.current();
+	std::vector<uint64_t> fromParts;
+	std::vector<uint64_t> fromWhole;
+	double seconds = 0.0;
+	for (int change = 0; change < changes; ++change)
+	{
+		// Each change flips a random user of the pool, so the list settles at about half the pool
+		const uint64_t key = pool[random() % keyPool];
+		const bool join = users.count(key) == 0;
+		auto start = BenchClock::now();
+		if (join) cache.add(key);
+		else cache.remove(key);
+		seconds += std::chrono::duration<double>(BenchClock::now() - start).count();
+		if (join) users.insert(key);
+		else users.erase(key);
+
+		std::shared_ptr<const UserListVersion> current = cache.current();
+		size_t fresh = 0;
+		for (size_t part = 0; part < current->parts.size(); ++part)
+		{
+			if (part >= previous->parts.size() || current->parts[part] != previous->parts[part]) ++fresh;
+		}
+		encodedParts += fresh;
+		if (fresh > 2 || current->count != users.size()) ++bad;
+		previous = current;
+
+		if (change % checkEvery != 0) continue;
+		++checked;
+		fromParts.clear();
+		fromWhole.clear();
+		bool ok = true;
+		for (const UserListPart& part : current->parts)
+		{
+			ok = ok && part->size() <= NET_RELIABLE_MESSAGE_MAX && decode(part->data(), part->size(), fromParts);
+		}
+		ok = ok && decode(current->whole().data(), current->whole().size(), fromWhole) && fromWhole == fromParts;
+		std::sort(fromParts.begin(), fromParts.end());
+		ok = ok && std::adjacent_find(fromParts.begin(), fromParts.end()) == fromParts.end() &&
+			fromParts.size() == users.size();
+		for (uint64_t user : fromParts) ok = ok && users.count(user) != 0;
+		if (!ok) ++bad;
+	}
+
+	const bool ok = bad == 0;
+	std::cout << "userlist: " << changes << " joins and leaves, " << users.size() << " users at the end in "
+		<< previous->parts.size() << " parts, " << static_cast<double>(encodedParts) / changes
+		<< " parts encoded per change, " << seconds * 1e9 / changes << " ns per change, "
+		<< checked << " versions checked, " << bad << " bad" << (ok ? "" : "  FAILED") << std::endl;
+	return ok;
+}
+
+// Run the named benchmark and print its results
+bool runBenchmark(const std::string& name)
+{
+	if (name == "send") return benchSend();
+	if (name == "taskqueue") return benchTaskQueue();
+	if (name == "bitstream") return benchBitStream();
+	if (name == "stream") return benchStream();
+	if (name == "reliable") return benchReliable();
+	if (name == "userlist") return benchUserList();
+
+	std::cerr << "Unknown benchmark: " << name << " (available: send, taskqueue, bitstream, stream, reliable, userlist)" << std::endl;
+	return false;
+}
@@ -0,0 +1,13 @@
+/*******************************************************************************
+ * Standalone micro-benchmarks, run with: server --bench NAME
+ ******************************************************************************/
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <string>
+
+// Run the named benchmark and print its results. Returns false for an unknown name.
+bool runBenchmark(const std::string& name);
+
+#endif
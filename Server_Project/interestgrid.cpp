@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * Area-of-interest filtering on a uniform grid over world space.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "interestgrid.h"
+
+// Entities wrap this far outside the field, as the largest asteroid.
+static const float GRID_MARGIN = SIM_SCALE_STEP * SIM_SCALE_STEPS_MAX;
+
+InterestGrid::InterestGrid(float worldWidth, float worldHeight, float cellSize, float viewWidth, float viewHeight) :
+	_minX{ -worldWidth / 2.0f - GRID_MARGIN },
+	_minY{ -worldHeight / 2.0f - GRID_MARGIN },
+	_cellSize{ std::max(cellSize, 1.0f) },
+	_entityCell(SIM_ENTITY_MAX, -1),
+	_entitySlot(SIM_ENTITY_MAX, 0)
+{
+	_cols = std::max(1, static_cast<int>(std::ceil((worldWidth + 2.0f * GRID_MARGIN) / _cellSize)));
+	_rows = std::max(1, static_cast<int>(std::ceil((worldHeight + 2.0f * GRID_MARGIN) / _cellSize)));
+	// An entity is bucketed by its centre, so reach a margin past the view's edges
+	_reachCols = static_cast<int>(std::ceil((viewWidth / 2.0f + GRID_MARGIN) / _cellSize));
+	_reachRows = static_cast<int>(std::ceil((viewHeight / 2.0f + GRID_MARGIN) / _cellSize));
+	_cells.resize(static_cast<size_t>(_cols) * _rows);
+}
+
+int InterestGrid::cellOf(float x, float y) const
+{
+	int col = std::clamp(static_cast<int>(std::floor((x - _minX) / _cellSize)), 0, _cols - 1);
+	int row = std::clamp(static_cast<int>(std::floor((y - _minY) / _cellSize)), 0, _rows - 1);
+	return row * _cols + col;
+}
+
+void InterestGrid::moveEntity(uint16_t id, bool active, float x, float y)
+{
+	int cell = active ? cellOf(x, y) : -1;
+	int old = _entityCell[id];
+	if (cell == old)
+	{
+		return;
+	}
+
+	const size_t word = id / 64;
+	const uint64_t bit = uint64_t{ 1 } << (id % 64);
+	if (old >= 0)
+	{
+		Cell& from = _cells[old];
+		uint32_t slot = _entitySlot[id];
+		from.entities[slot] = from.entities.back();
+		_entitySlot[from.entities[slot]] = slot;
+		from.entities.pop_back();
+		for (int viewer : from.watchers)
+		{
+			_viewers[viewer].relevant[word] &= ~bit;
+		}
+	}
+	if (cell >= 0)
+	{
+		Cell& to = _cells[cell];
+		_entitySlot[id] = static_cast<uint32_t>(to.entities.size());
+		to.entities.push_back(id);
+		for (int viewer : to.watchers)
+		{
+			_viewers[viewer].relevant[word] |= bit;
+		}
+	}
+	_entityCell[id] = cell;
+}
+
+int InterestGrid::addViewer()
+{
+	int id;
+	if (!_freeViewers.empty())
+	{
+		id = _freeViewers.back();
+		_freeViewers.pop_back();
+	}
+	else
+	{
+		id = static_cast<int>(_viewers.size());
+		_viewers.emplace_back();
+		_viewers.back().relevant.assign(INTEREST_SET_WORDS, 0);
+		_viewers.back().sentSets.assign(static_cast<size_t>(SIM_SNAPSHOT_HISTORY) * INTEREST_SET_WORDS, 0);
+	}
+
+	Viewer& viewer = _viewers[id];
+	viewer.active = true;
+	viewer.center = -1;
+	viewer.lastSeen = 0;
+	std::fill(std::begin(viewer.sentTicks), std::end(viewer.sentTicks), 0);
+	return id;
+}
+
+void InterestGrid::updateViewer(int viewer, float x, float y, uint32_t tick)
+{
+	Viewer& v = _viewers[viewer];
+	v.lastSeen = tick;
+	int center = cellOf(x, y);
+	if (center == v.center)
+	{
+		return;
+	}
+	v.center = center;
+
+	// Cells of the new area, wrapping around the field like the entities do
+	_area.clear();
+	int centerCol = center % _cols;
+	int centerRow = center / _cols;
+	int colSpan = std::min(2 * _reachCols + 1, _cols);
+	int rowSpan = std::min(2 * _reachRows + 1, _rows);
+	int firstCol = colSpan == _cols ? 0 : centerCol - _reachCols;
+	int firstRow = rowSpan == _rows ? 0 : centerRow - _reachRows;
+	for (int r = 0; r < rowSpan; ++r)
+	{
+		int row = ((firstRow + r) % _rows + _rows) % _rows;
+		for (int c = 0; c < colSpan; ++c)
+		{
+			int col = ((firstCol + c) % _cols + _cols) % _cols;
+			_area.push_back(row * _cols + col);
+		}
+	}
+
+	// Only the cells that left or joined the area change the relevant set
+	uint32_t inNew = ++_stamp;
+	for (int cell : _area)
+	{
+		_cells[cell].stamp = inNew;
+	}
+	for (int cell : v.cells)
+	{
+		if (_cells[cell].stamp != inNew) unwatch(viewer, cell);
+	}
+	uint32_t inOld = ++_stamp;
+	for (int cell : v.cells)
+	{
+		_cells[cell].stamp = inOld;
+	}
+	for (int cell : _area)
+	{
+		if (_cells[cell].stamp != inOld) watch(viewer, cell);
+	}
+	v.cells.swap(_area);
+}
+
+void InterestGrid::keepViewer(int viewer, uint32_t tick)
+{
+	_viewers[viewer].lastSeen = tick;
+}
+
+void InterestGrid::removeStaleViewers(uint32_t tick)
+{
+	for (size_t id = 0; id < _viewers.size(); ++id)
+	{
+		Viewer& v = _viewers[id];
+		if (!v.active || v.lastSeen == tick)
+		{
+			continue;
+		}
+		for (int cell : v.cells)
+		{
+			unwatch(static_cast<int>(id), cell);
+		}
+		v.cells.clear();
+		v.active = false;
+		_freeViewers.push_back(static_cast<int>(id));
+	}
+}
+
+bool InterestGrid::isViewer(int viewer) const
+{
+	return viewer >= 0 && viewer < static_cast<int>(_viewers.size()) && _viewers[viewer].active;
+}
+
+void InterestGrid::watch(int viewer, int cell)
+{
+	Cell& c = _cells[cell];
+	c.watchers.push_back(viewer);
+	std::vector<uint64_t>& relevant = _viewers[viewer].relevant;
+	for (uint16_t id : c.entities)
+	{
+		relevant[id / 64] |= uint64_t{ 1 } << (id % 64);
+	}
+}
+
+void InterestGrid::unwatch(int viewer, int cell)
+{
+	Cell& c = _cells[cell];
+	auto it = std::find(c.watchers.begin(), c.watchers.end(), viewer);
+	if (it != c.watchers.end())
+	{
+		*it = c.watchers.back();
+		c.watchers.pop_back();
+	}
+	std::vector<uint64_t>& relevant = _viewers[viewer].relevant;
+	for (uint16_t id : c.entities)
+	{
+		relevant[id / 64] &= ~(uint64_t{ 1 } << (id % 64));
+	}
+}
+
+const uint64_t* InterestGrid::relevant(int viewer) const
+{
+	return _viewers[viewer].relevant.data();
+}
+
+void InterestGrid::recordSent(int viewer, uint32_t tick)
+{
+	Viewer& v = _viewers[viewer];
+	size_t slot = tick % SIM_SNAPSHOT_HISTORY;
+	v.sentTicks[slot] = tick;
+	std::memcpy(v.sentSets.data() + slot * INTEREST_SET_WORDS, v.relevant.data(), INTEREST_SET_WORDS * sizeof(uint64_t));
+}
+
+const uint64_t* InterestGrid::sentAt(int viewer, uint32_t tick) const
+{
+	const Viewer& v = _viewers[viewer];
+	size_t slot = tick % SIM_SNAPSHOT_HISTORY;
+	if (tick == 0 || v.sentTicks[slot] != tick)
+	{
+		return nullptr;
+	}
+	return v.sentSets.data() + slot * INTEREST_SET_WORDS;
+}
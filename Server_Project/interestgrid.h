@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Area-of-interest filtering on a uniform grid over world space.
+ *
+ * Entities are bucketed into cells by position; each viewer (a player's
+ * client) watches the cells its screen covers around its ship, and each cell
+ * knows its watchers. A viewer's relevant set is a bitset over entity ids that
+ * only changes when an entity crosses a cell border or the viewer's ship
+ * does, so keeping every viewer current costs the membership changes, not
+ * players x entities. Owned by the simulation thread; not thread-safe.
+ ******************************************************************************/
+
+#ifndef _INTERESTGRID_H_
+#define _INTERESTGRID_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "SimWorld.h"
+#include "SimSnapshot.h"
+
+// Words of an entity bitset.
+#define INTEREST_SET_WORDS (SIM_ENTITY_MAX / 64)
+
+class InterestGrid
+{
+public:
+	// worldWidth/Height as in SimConfig; viewWidth/Height is what one client shows around its ship.
+	InterestGrid(float worldWidth, float worldHeight, float cellSize, float viewWidth, float viewHeight);
+
+	// Put an entity in the cell of its position, or take it out of the grid if it is inactive.
+	// Constant time unless the entity changes cells.
+	void moveEntity(uint16_t id, bool active, float x, float y);
+
+	// Add a viewer that sees nothing until it is centred. Returns its id.
+	int addViewer();
+	// Centre a viewer's area on a position and mark it alive for this tick.
+	void updateViewer(int viewer, float x, float y, uint32_t tick);
+	// Mark a viewer alive for this tick without moving it, e.g. while its ship respawns.
+	void keepViewer(int viewer, uint32_t tick);
+	// Remove the viewers that were not updated or kept this tick.
+	void removeStaleViewers(uint32_t tick);
+	bool isViewer(int viewer) const;
+
+	// Bitset of the entities a viewer currently sees.
+	const uint64_t* relevant(int viewer) const;
+
+	// Remember what a viewer was sent at a tick, the baseline set if the client acknowledges it.
+	void recordSent(int viewer, uint32_t tick);
+	// Set a viewer was sent at a tick, or nullptr if it has left the viewer's ring.
+	const uint64_t* sentAt(int viewer, uint32_t tick) const;
+
+	InterestGrid() = delete;
+
+private:
+
+	struct Cell
+	{
+		std::vector<uint16_t> entities;
+		std::vector<int> watchers;	// Viewers whose area covers the cell
+		uint32_t stamp = 0;			// Scratch mark for area differences
+	};
+
+	struct Viewer
+	{
+		bool active = false;
+		int center = -1;			// Cell the area is centred on, -1 before the first update
+		uint32_t lastSeen = 0;
+		std::vector<int> cells;		// Cells of the area
+		std::vector<uint64_t> relevant;
+		uint32_t sentTicks[SIM_SNAPSHOT_HISTORY] = {};
+		std::vector<uint64_t> sentSets;	// SIM_SNAPSHOT_HISTORY sets, one per sentTicks entry
+	};
+
+	int cellOf(float x, float y) const;
+	void watch(int viewer, int cell);
+	void unwatch(int viewer, int cell);
+
+	float _minX;
+	float _minY;
+	float _cellSize;
+	int _cols;
+	int _rows;
+	int _reachCols;	// Cells the view reaches either side of its centre
+	int _reachRows;
+	uint32_t _stamp = 0;
+
+	std::vector<Cell> _cells;
+	std::vector<int> _entityCell;		// Cell of each entity, -1 if not in the grid
+	std::vector<uint32_t> _entitySlot;	// Index of each entity in its cell's list
+	std::vector<Viewer> _viewers;
+	std::vector<int> _freeViewers;
+	std::vector<int> _area;				// Scratch for updateViewer
+};
+
+#endif
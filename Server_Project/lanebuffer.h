@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * Per-worker lanes for TaskQueue. Each worker owns one lock-free ring; the
+ * producer spreads items across the lanes round-robin or by hint.
+ *
+ *   WorkStealingBuffer - idle workers steal from their peers' lanes
+ *   AffinityBuffer     - items stay on the lane they were hinted to, so items
+ *                        with the same hint are handled by one worker, in order
+ ******************************************************************************/
+
+#ifndef _LANEBUFFER_H_
+#define _LANEBUFFER_H_
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "ringbuffer.h"
+
+template <typename TItem, bool Steal>
+class LaneBuffer
+{
+public:
+	LaneBuffer(size_t slotCount, size_t workerCount);
+
+	// Store the item on the next lane, round-robin.
+	void push(TItem item);
+	// Store the item on lane (hint % lanes).
+	void push(TItem item, size_t hint);
+	// Take an item for the given worker; std::nullopt once closed and drained.
+	std::optional<TItem> pop(size_t worker);
+	// Release every parked worker.
+	void close();
+
+	LaneBuffer() = delete;
+	LaneBuffer(const LaneBuffer&) = delete;
+	LaneBuffer& operator=(const LaneBuffer&) = delete;
+
+private:
+
+	// Spins before a thread parks.
+	static constexpr int SPIN_COUNT = 256;
+
+	struct alignas(CACHE_LINE_SIZE) Lane
+	{
+		std::unique_ptr<RingBuffer<TItem>> items;
+		// Parking for the owner; only used when workers cannot steal.
+		std::atomic<uint32_t> event{ 0 };
+		std::atomic<uint32_t> waiters{ 0 };
+	};
+
+	bool tryPush(TItem& item, size_t lane);
+	bool tryPop(TItem& item, size_t worker);
+	// Where the given worker parks: its own lane, or the shared event when stealing.
+	std::atomic<uint32_t>& itemEvent(size_t worker);
+	std::atomic<uint32_t>& itemWaiters(size_t worker);
+	static void signal(std::atomic<uint32_t>& event, std::atomic<uint32_t>& waiters);
+
+	std::vector<Lane> _lanes;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _nextLane;
+
+	// Shared parking for stealing workers and for a producer waiting on a slot.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _itemEvent;
+	std::atomic<uint32_t> _itemWaiters;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _slotEvent;
+	std::atomic<uint32_t> _slotWaiters;
+
+	std::atomic<bool> _stay;
+};
+
+template <typename TItem>
+using WorkStealingBuffer = LaneBuffer<TItem, true>;
+
+template <typename TItem>
+using AffinityBuffer = LaneBuffer<TItem, false>;
+
+#include "lanebuffer.hpp"
+
+#endif
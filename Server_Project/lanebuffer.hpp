@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * Per-worker lanes for TaskQueue. Each worker owns one lock-free ring; the
+ * producer spreads items across the lanes round-robin or by hint.
+ ******************************************************************************/
+
+#ifndef _LANEBUFFER_HPP_
+#define _LANEBUFFER_HPP_
+#include "lanebuffer.h"
+
+template <typename TItem, bool Steal>
+LaneBuffer<TItem, Steal>::LaneBuffer(size_t slotCount, size_t workerCount) :
+	_lanes(workerCount > 0 ? workerCount : 1),
+	_nextLane{ 0 },
+	_itemEvent{ 0 },
+	_itemWaiters{ 0 },
+	_slotEvent{ 0 },
+	_slotWaiters{ 0 },
+	_stay{ true }
+{
+	// Split the slots evenly; every lane holds at least two.
+	size_t laneSlots = (slotCount + _lanes.size() - 1) / _lanes.size();
+	for (Lane& lane : _lanes)
+	{
+		lane.items = std::make_unique<RingBuffer<TItem>>(laneSlots, 1);
+	}
+}
+
+template <typename TItem, bool Steal>
+std::atomic<uint32_t>& LaneBuffer<TItem, Steal>::itemEvent(size_t worker)
+{
+	return Steal ? _itemEvent : _lanes[worker].event;
+}
+
+template <typename TItem, bool Steal>
+std::atomic<uint32_t>& LaneBuffer<TItem, Steal>::itemWaiters(size_t worker)
+{
+	return Steal ? _itemWaiters : _lanes[worker].waiters;
+}
+
+template <typename TItem, bool Steal>
+void LaneBuffer<TItem, Steal>::signal(std::atomic<uint32_t>& event, std::atomic<uint32_t>& waiters)
+{
+	// Pairs with the fence before parking: either the waiter sees our change, or we see the waiter.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) > 0)
+	{
+		event.fetch_add(1, std::memory_order_release);
+		event.notify_one();
+	}
+}
+
+template <typename TItem, bool Steal>
+bool LaneBuffer<TItem, Steal>::tryPush(TItem& item, size_t lane)
+{
+	if (_lanes[lane].items->tryPush(item))
+	{
+		signal(itemEvent(lane), itemWaiters(lane));
+		return true;
+	}
+	if (!Steal)
+	{
+		return false;
+	}
+
+	// The preferred lane is full; any lane will do since its items can be stolen.
+	for (size_t i = 1; i < _lanes.size(); ++i)
+	{
+		size_t other = (lane + i) % _lanes.size();
+		if (_lanes[other].items->tryPush(item))
+		{
+			signal(itemEvent(other), itemWaiters(other));
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename TItem, bool Steal>
+bool LaneBuffer<TItem, Steal>::tryPop(TItem& item, size_t worker)
+{
+	if (_lanes[worker].items->tryPop(item))
+	{
+		return true;
+	}
+	if (!Steal)
+	{
+		return false;
+	}
+
+	// Own lane is empty: steal from the peers, starting with the next one.
+	for (size_t i = 1; i < _lanes.size(); ++i)
+	{
+		if (_lanes[(worker + i) % _lanes.size()].items->tryPop(item))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename TItem, bool Steal>
+void LaneBuffer<TItem, Steal>::push(TItem item)
+{
+	push(std::move(item), _nextLane.fetch_add(1, std::memory_order_relaxed));
+}
+
+template <typename TItem, bool Steal>
+void LaneBuffer<TItem, Steal>::push(TItem item, size_t hint)
+{
+	size_t lane = hint % _lanes.size();
+	for (int spin = 0; !tryPush(item, lane); ++spin)
+	{
+		if (spin < SPIN_COUNT)
+		{
+			cpuRelax();
+			continue;
+		}
+
+		// Park until a worker frees a slot.
+		_slotWaiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t event = _slotEvent.load(std::memory_order_acquire);
+		if (!tryPush(item, lane))
+		{
+			_slotEvent.wait(event, std::memory_order_acquire);
+			_slotWaiters.fetch_sub(1, std::memory_order_relaxed);
+			spin = 0;
+			continue;
+		}
+		_slotWaiters.fetch_sub(1, std::memory_order_relaxed);
+		break;
+	}
+}
+
+template <typename TItem, bool Steal>
+std::optional<TItem> LaneBuffer<TItem, Steal>::pop(size_t worker)
+{
+	worker %= _lanes.size();
+	std::atomic<uint32_t>& event = itemEvent(worker);
+	std::atomic<uint32_t>& waiters = itemWaiters(worker);
+
+	TItem item{};
+	for (int spin = 0; !tryPop(item, worker); ++spin)
+	{
+		if (!_stay.load(std::memory_order_acquire))
+		{
+			return std::nullopt;
+		}
+		if (spin < SPIN_COUNT)
+		{
+			cpuRelax();
+			continue;
+		}
+
+		// Park until an item arrives or the buffer is closed.
+		waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t seen = event.load(std::memory_order_acquire);
+		if (!tryPop(item, worker))
+		{
+			if (_stay.load(std::memory_order_acquire))
+			{
+				event.wait(seen, std::memory_order_acquire);
+			}
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+			spin = 0;
+			continue;
+		}
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+		break;
+	}
+	signal(_slotEvent, _slotWaiters);
+	return std::optional<TItem>{ std::move(item) };
+}
+
+template <typename TItem, bool Steal>
+void LaneBuffer<TItem, Steal>::close()
+{
+	_stay.store(false, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_itemEvent.fetch_add(1, std::memory_order_release);
+	_itemEvent.notify_all();
+	for (Lane& lane : _lanes)
+	{
+		lane.event.fetch_add(1, std::memory_order_release);
+		lane.event.notify_all();
+	}
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*******************************************************************************
+ * Asynchronous binary logger for the server and its workers.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "NetSocket.h"
+#include "logger.h"
+
+std::atomic<LogLevel> Logger::_level{ LogLevel::Info };
+std::atomic<uint64_t> Logger::_dropped{ 0 };
+std::atomic<bool> Logger::_running{ false };
+std::thread Logger::_drainThread;
+std::mutex Logger::_ringsMutex;
+std::vector<std::unique_ptr<Logger::ThreadRing>> Logger::_rings;
+
+static const char* levelName(LogLevel level)
+{
+	switch (level)
+	{
+	case LogLevel::Trace: return "TRACE";
+	case LogLevel::Debug: return "DEBUG";
+	case LogLevel::Info: return "INFO";
+	case LogLevel::Warn: return "WARN";
+	case LogLevel::Error: return "ERROR";
+	default: return "";
+	}
+}
+
+bool Logger::parseLevel(const char* name, LogLevel& level)
+{
+	static const char* const names[] = { "trace", "debug", "info", "warn", "error", "off" };
+	for (int i = 0; i <= LOG_LEVEL_OFF; ++i)
+	{
+		if (std::strcmp(name, names[i]) == 0)
+		{
+			level = static_cast<LogLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+Logger::ThreadRing& Logger::threadRing()
+{
+	// Registered once per thread; after that appending touches only this ring.
+	thread_local ThreadRing* ring = nullptr;
+	if (ring == nullptr)
+	{
+		std::lock_guard<std::mutex> lock{ _ringsMutex };
+		_rings.push_back(std::make_unique<ThreadRing>());
+		ring = _rings.back().get();
+		ring->thread = static_cast<uint16_t>(_rings.size());
+	}
+	return *ring;
+}
+
+void Logger::append(LogLevel level, const char* format, const LogArg* args, size_t argCount)
+{
+	ThreadRing& ring = threadRing();
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_RECORDS)
+	{
+		// Never block a worker on the log: drop the record and count it.
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Record& record = ring.records[head & (LOG_RING_RECORDS - 1)];
+	record.time = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+	record.format = format;
+	record.argCount = static_cast<uint8_t>(argCount);
+	record.level = level;
+	record.thread = ring.thread;
+	for (size_t i = 0; i < argCount; ++i)
+	{
+		record.args[i] = args[i].bits;
+		record.types[i] = args[i].type;
+	}
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+// Append one formatted argument to line.
+static void formatArg(std::string& line, uint64_t bits, LogArgType type)
+{
+	char text[64];
+	switch (type)
+	{
+	case LogArgType::Int:
+		std::snprintf(text, sizeof(text), "%lld", static_cast<long long>(static_cast<int64_t>(bits)));
+		break;
+	case LogArgType::Uint:
+		std::snprintf(text, sizeof(text), "%llu", static_cast<unsigned long long>(bits));
+		break;
+	case LogArgType::Double:
+	{
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		std::snprintf(text, sizeof(text), "%g", value);
+		break;
+	}
+	case LogArgType::Str:
+		line += reinterpret_cast<const char*>(static_cast<uintptr_t>(bits));
+		return;
+	case LogArgType::Ipv4:
+	{
+		uint32_t ip = static_cast<uint32_t>(bits);
+		inet_ntop(AF_INET, &ip, text, sizeof(text));
+		break;
+	}
+	case LogArgType::Port:
+		std::snprintf(text, sizeof(text), "%u", static_cast<unsigned>(ntohs(static_cast<uint16_t>(bits))));
+		break;
+	}
+	line += text;
+}
+
+void Logger::drain()
+{
+	static std::vector<Record> pending;
+	static std::string out;
+
+	{
+		std::lock_guard<std::mutex> lock{ _ringsMutex };
+		for (const std::unique_ptr<ThreadRing>& ring : _rings)
+		{
+			uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			for (; tail != head; ++tail)
+			{
+				pending.push_back(ring->records[tail & (LOG_RING_RECORDS - 1)]);
+			}
+			ring->tail.store(tail, std::memory_order_release);
+		}
+	}
+	if (pending.empty())
+	{
+		return;
+	}
+
+	// Interleave the threads' records in the order they were written.
+	std::stable_sort(pending.begin(), pending.end(), [](const Record& a, const Record& b) {
+		return a.time < b.time;
+	});
+
+	out.clear();
+	for (const Record& record : pending)
+	{
+		out += '[';
+		out += levelName(record.level);
+		out += "] [";
+		out += std::to_string(record.thread);
+		out += "] ";
+		size_t arg = 0;
+		for (const char* c = record.format; *c != '\0'; ++c)
+		{
+			if (c[0] == '{' && c[1] == '}' && arg < record.argCount)
+			{
+				formatArg(out, record.args[arg], record.types[arg]);
+				++arg;
+				++c;
+			}
+			else
+			{
+				out += *c;
+			}
+		}
+		out += '\n';
+	}
+	std::fwrite(out.data(), 1, out.size(), stdout);
+	std::fflush(stdout);
+	pending.clear();
+}
+
+void Logger::drainLoop()
+{
+	while (_running.load(std::memory_order_acquire))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_MS));
+		drain();
+	}
+	drain();
+}
+
+void Logger::start()
+{
+	if (_running.exchange(true))
+	{
+		return;
+	}
+	_drainThread = std::thread(&Logger::drainLoop);
+}
+
+void Logger::stop()
+{
+	if (!_running.exchange(false))
+	{
+		return;
+	}
+	_drainThread.join();
+}
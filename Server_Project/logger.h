@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * Asynchronous binary logger for the server and its workers.
+ *
+ * Each thread appends fixed-size records (a static format string plus a few
+ * raw argument words) to its own lock-free single-producer ring. A background
+ * thread drains the rings, orders the records by time and formats them, so
+ * the packet path never formats a string, takes a lock or touches stdout.
+ *
+ * Levels below LOG_COMPILE_LEVEL are compiled out; the rest are filtered at
+ * run time with Logger::setLevel.
+ ******************************************************************************/
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+// Lowest level that is compiled in at all.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// Records each thread can hold before the drain thread catches up; must be a power of two.
+#define LOG_RING_RECORDS 4096
+// Interval at which the drain thread empties the rings.
+#define LOG_DRAIN_MS 20
+// Arguments one record can carry.
+#define LOG_MAX_ARGS 4
+
+enum class LogLevel : uint8_t
+{
+	Trace = LOG_LEVEL_TRACE,
+	Debug = LOG_LEVEL_DEBUG,
+	Info = LOG_LEVEL_INFO,
+	Warn = LOG_LEVEL_WARN,
+	Error = LOG_LEVEL_ERROR,
+	Off = LOG_LEVEL_OFF
+};
+
+// Whether a level is compiled in. The level is compared against a constant
+// variable rather than the macro, so LOG_COMPILE_LEVEL 0 does not warn that
+// every level is compiled in.
+constexpr int logCompileLevel = LOG_COMPILE_LEVEL;
+constexpr bool logCompiled(LogLevel level)
+{
+	return static_cast<int>(level) >= logCompileLevel;
+}
+
+// How the drain thread formats an argument word.
+enum class LogArgType : uint8_t
+{
+	Int,
+	Uint,
+	Double,
+	Str,	// Pointer to a string that outlives the logger, e.g. a literal
+	Ipv4,	// IPv4 address in network byte order
+	Port	// Port in network byte order
+};
+
+struct LogArg
+{
+	uint64_t bits;
+	LogArgType type;
+};
+
+// Wrappers for arguments that are stored raw and converted only when formatted.
+struct LogIpv4 { uint32_t ipNet; };
+struct LogPort { uint16_t portNet; };
+
+inline LogArg logArg(LogIpv4 ip) { return LogArg{ ip.ipNet, LogArgType::Ipv4 }; }
+inline LogArg logArg(LogPort port) { return LogArg{ port.portNet, LogArgType::Port }; }
+inline LogArg logArg(const char* str) { return LogArg{ reinterpret_cast<uintptr_t>(str), LogArgType::Str }; }
+inline LogArg logArg(double value)
+{
+	uint64_t bits;
+	static_assert(sizeof(bits) == sizeof(value));
+	std::memcpy(&bits, &value, sizeof(bits));
+	return LogArg{ bits, LogArgType::Double };
+}
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+inline LogArg logArg(T value)
+{
+	if constexpr (std::is_signed_v<T>)
+	{
+		return LogArg{ static_cast<uint64_t>(static_cast<int64_t>(value)), LogArgType::Int };
+	}
+	else
+	{
+		return LogArg{ static_cast<uint64_t>(value), LogArgType::Uint };
+	}
+}
+
+class Logger
+{
+public:
+	// Start the drain thread.
+	static void start();
+	// Drain what is left and stop the drain thread.
+	static void stop();
+
+	static void setLevel(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+	static bool enabled(LogLevel level) { return level >= _level.load(std::memory_order_relaxed); }
+	// Parse "trace", "debug", "info", "warn", "error" or "off".
+	static bool parseLevel(const char* name, LogLevel& level);
+
+	// Append a record to the calling thread's ring. format is a string literal
+	// with one {} per argument; it is only read by the drain thread.
+	template <typename... TArgs>
+	static void write(LogLevel level, const char* format, TArgs... args)
+	{
+		static_assert(sizeof...(TArgs) <= LOG_MAX_ARGS, "too many log arguments");
+		LogArg packed[LOG_MAX_ARGS] = { logArg(args)... };
+		append(level, format, packed, sizeof...(TArgs));
+	}
+
+	// Records dropped because a thread's ring was full.
+	static uint64_t dropped() { return _dropped.load(std::memory_order_relaxed); }
+
+	Logger() = delete;
+
+private:
+
+	struct Record
+	{
+		uint64_t time;
+		const char* format;
+		uint64_t args[LOG_MAX_ARGS];
+		LogArgType types[LOG_MAX_ARGS];
+		uint8_t argCount;
+		LogLevel level;
+		uint16_t thread;
+	};
+
+	// Single-producer single-consumer ring owned by one logging thread.
+	struct ThreadRing
+	{
+		alignas(64) std::atomic<uint64_t> head{ 0 };	// Written by the owning thread
+		alignas(64) std::atomic<uint64_t> tail{ 0 };	// Written by the drain thread
+		uint16_t thread = 0;
+		Record records[LOG_RING_RECORDS];
+	};
+
+	static void append(LogLevel level, const char* format, const LogArg* args, size_t argCount);
+	static ThreadRing& threadRing();
+	static void drain();
+	static void drainLoop();
+
+	static std::atomic<LogLevel> _level;
+	static std::atomic<uint64_t> _dropped;
+	static std::atomic<bool> _running;
+	static std::thread _drainThread;
+
+	// Rings of every thread that has logged; rings live as long as the process.
+	static std::mutex _ringsMutex;
+	static std::vector<std::unique_ptr<ThreadRing>> _rings;
+};
+
+// Logging macros; disabled levels compile to nothing.
+#define LOG_AT(level, ...) \
+	do { \
+		if constexpr (logCompiled(level)) { \
+			if (Logger::enabled(level)) Logger::write(level, __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define LOG_TRACE(...) LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+#endif
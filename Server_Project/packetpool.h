@@ -0,0 +1,91 @@
+/*******************************************************************************
+ * Fixed-size pool of packet buffers with owning handles, so a datagram is
+ * received straight into its final buffer and never copied afterwards.
+ ******************************************************************************/
+
+#ifndef _PACKETPOOL_H_
+#define _PACKETPOOL_H_
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+template <typename TPacket>
+class PacketPool;
+
+// Move-only handle to one pooled packet. Returns the packet to its pool when
+// released or destroyed.
+template <typename TPacket>
+class PacketRef
+{
+public:
+	PacketRef() = default;
+	PacketRef(PacketRef&& other) noexcept;
+	PacketRef& operator=(PacketRef&& other) noexcept;
+	~PacketRef();
+
+	PacketRef(const PacketRef&) = delete;
+	PacketRef& operator=(const PacketRef&) = delete;
+
+	TPacket& operator*() const { return *_packet; }
+	TPacket* operator->() const { return _packet; }
+	explicit operator bool() const { return _packet != nullptr; }
+
+	// Hand the packet back to the pool early.
+	void release();
+
+private:
+	friend class PacketPool<TPacket>;
+	PacketRef(PacketPool<TPacket>* pool, TPacket* packet) : _pool{ pool }, _packet{ packet } {}
+
+	PacketPool<TPacket>* _pool = nullptr;
+	TPacket* _packet = nullptr;
+};
+
+// Preallocated packets behind a lock-free free list. One thread usually
+// acquires (the receive loop) while any worker may release.
+template <typename TPacket>
+class PacketPool
+{
+public:
+	explicit PacketPool(size_t capacity);
+
+	// Take a free packet, or an empty handle when the pool is exhausted.
+	PacketRef<TPacket> acquire();
+
+	size_t capacity() const { return _capacity; }
+
+	PacketPool() = delete;
+	PacketPool(const PacketPool&) = delete;
+	PacketPool& operator=(const PacketPool&) = delete;
+
+private:
+	friend class PacketRef<TPacket>;
+	void release(TPacket* packet);
+
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	size_t _capacity;
+	std::unique_ptr<TPacket[]> _packets;
+	// Free list link of each packet, by index.
+	std::unique_ptr<std::atomic<uint32_t>[]> _next;
+	// Free list head: ABA tag in the upper half, packet index in the lower half.
+	std::atomic<uint64_t> _head;
+};
+
+// Packets pulled from the socket by one receive call, handed to a worker as one task.
+template <typename TPacket, size_t Capacity>
+struct PacketBatch
+{
+	std::array<PacketRef<TPacket>, Capacity> packets;
+	size_t count = 0;
+
+	PacketRef<TPacket>* begin() { return packets.data(); }
+	PacketRef<TPacket>* end() { return packets.data() + count; }
+};
+
+#include "packetpool.hpp"
+
+#endif
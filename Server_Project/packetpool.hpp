@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * Fixed-size pool of packet buffers with owning handles, so a datagram is
+ * received straight into its final buffer and never copied afterwards.
+ ******************************************************************************/
+
+#ifndef _PACKETPOOL_HPP_
+#define _PACKETPOOL_HPP_
+#include "packetpool.h"
+
+template <typename TPacket>
+PacketRef<TPacket>::PacketRef(PacketRef&& other) noexcept :
+	_pool{ other._pool },
+	_packet{ other._packet }
+{
+	other._pool = nullptr;
+	other._packet = nullptr;
+}
+
+template <typename TPacket>
+PacketRef<TPacket>& PacketRef<TPacket>::operator=(PacketRef&& other) noexcept
+{
+	if (this != &other)
+	{
+		release();
+		_pool = other._pool;
+		_packet = other._packet;
+		other._pool = nullptr;
+		other._packet = nullptr;
+	}
+	return *this;
+}
+
+template <typename TPacket>
+PacketRef<TPacket>::~PacketRef()
+{
+	release();
+}
+
+template <typename TPacket>
+void PacketRef<TPacket>::release()
+{
+	if (_packet != nullptr)
+	{
+		_pool->release(_packet);
+		_pool = nullptr;
+		_packet = nullptr;
+	}
+}
+
+template <typename TPacket>
+PacketPool<TPacket>::PacketPool(size_t capacity) :
+	_capacity{ capacity },
+	_packets{ new TPacket[capacity] },
+	_next{ new std::atomic<uint32_t>[capacity] },
+	_head{ capacity > 0 ? 0 : NIL }
+{
+	// Chain every packet into the free list.
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		_next[i].store(i + 1 < capacity ? static_cast<uint32_t>(i + 1) : NIL, std::memory_order_relaxed);
+	}
+}
+
+template <typename TPacket>
+PacketRef<TPacket> PacketPool<TPacket>::acquire()
+{
+	uint64_t head = _head.load(std::memory_order_acquire);
+	while (true)
+	{
+		uint32_t index = static_cast<uint32_t>(head);
+		if (index == NIL)
+		{
+			return PacketRef<TPacket>{};
+		}
+		uint64_t next = ((head >> 32) + 1) << 32 | _next[index].load(std::memory_order_relaxed);
+		if (_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			return PacketRef<TPacket>{ this, &_packets[index] };
+		}
+	}
+}
+
+template <typename TPacket>
+void PacketPool<TPacket>::release(TPacket* packet)
+{
+	uint32_t index = static_cast<uint32_t>(packet - _packets.get());
+	uint64_t head = _head.load(std::memory_order_relaxed);
+	while (true)
+	{
+		_next[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+		uint64_t next = ((head >> 32) + 1) << 32 | index;
+		if (_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed))
+		{
+			return;
+		}
+	}
+}
+
+#endif
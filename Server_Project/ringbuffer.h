@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Lock-free bounded multi-producer/multi-consumer ring, usable as a TaskQueue
+ * backend: TaskQueue<TItem, TAction, TOnDisconnect, RingBuffer>
+ ******************************************************************************/
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+// Size of a cache line, used to keep hot counters from sharing one.
+#define CACHE_LINE_SIZE 64
+
+// Tell the core this thread is spinning: it backs off for a few cycles and
+// frees its resources for the sibling hyperthread, without a syscall.
+inline void cpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Preallocated ring with one sequence number per slot. Producers and
+// consumers claim slots with a single CAS each and never take a lock.
+// Idle threads spin briefly on a pause hint, then park on an atomic wait.
+// TItem must be default-constructible and move-assignable.
+template <typename TItem>
+class RingBuffer
+{
+public:
+	RingBuffer(size_t slotCount, size_t workerCount);
+
+	// Block until a slot is free, then store the item. There is one shared
+	// ring, so the lane hint is ignored.
+	void push(TItem item);
+	void push(TItem item, size_t) { push(std::move(item)); }
+	// Block until an item is available for any worker; std::nullopt once closed and drained.
+	std::optional<TItem> pop(size_t worker = 0);
+	// Release every parked consumer.
+	void close();
+
+	// Non-blocking variants; return false when the ring is full/empty.
+	bool tryPush(TItem& item);
+	bool tryPop(TItem& item);
+
+	RingBuffer() = delete;
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+private:
+
+	// Spins before a thread parks.
+	static constexpr int SPIN_COUNT = 256;
+
+	struct alignas(CACHE_LINE_SIZE) Cell
+	{
+		std::atomic<size_t> sequence;
+		TItem item;
+	};
+
+	// Bump an event counter and wake one (or all) threads parked on it.
+	static void signal(std::atomic<uint32_t>& event, std::atomic<uint32_t>& waiters, bool all);
+
+	std::unique_ptr<Cell[]> _cells;
+	size_t _mask;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _enqueuePos;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _dequeuePos;
+
+	// Parking for consumers waiting on items and producers waiting on slots.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _itemEvent;
+	std::atomic<uint32_t> _itemWaiters;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _slotEvent;
+	std::atomic<uint32_t> _slotWaiters;
+
+	std::atomic<bool> _stay;
+};
+
+#include "ringbuffer.hpp"
+
+#endif
@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Lock-free bounded multi-producer/multi-consumer ring, usable as a TaskQueue
+ * backend: TaskQueue<TItem, TAction, TOnDisconnect, RingBuffer>
+ ******************************************************************************/
+
+#ifndef _RINGBUFFER_HPP_
+#define _RINGBUFFER_HPP_
+#include "ringbuffer.h"
+
+template <typename TItem>
+RingBuffer<TItem>::RingBuffer(size_t slotCount, size_t) :
+	_enqueuePos{ 0 },
+	_dequeuePos{ 0 },
+	_itemEvent{ 0 },
+	_itemWaiters{ 0 },
+	_slotEvent{ 0 },
+	_slotWaiters{ 0 },
+	_stay{ true }
+{
+	// Round up to a power of two so positions map to cells with a mask.
+	size_t capacity = 2;
+	while (capacity < slotCount)
+	{
+		capacity <<= 1;
+	}
+	_mask = capacity - 1;
+	_cells.reset(new Cell[capacity]);
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+template <typename TItem>
+bool RingBuffer<TItem>::tryPush(TItem& item)
+{
+	size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell& cell = _cells[pos & _mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if (diff == 0)
+		{
+			// The cell is free for this lap; claim it.
+			if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.item = std::move(item);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Still holds last lap's item: full.
+			return false;
+		}
+		else
+		{
+			pos = _enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename TItem>
+bool RingBuffer<TItem>::tryPop(TItem& item)
+{
+	size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell& cell = _cells[pos & _mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+		if (diff == 0)
+		{
+			// The cell holds this lap's item; claim it.
+			if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				item = std::move(cell.item);
+				cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Not written yet: empty.
+			return false;
+		}
+		else
+		{
+			pos = _dequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename TItem>
+void RingBuffer<TItem>::signal(std::atomic<uint32_t>& event, std::atomic<uint32_t>& waiters, bool all)
+{
+	// Pairs with the fence in push/pop: either the waiter sees our item, or we see the waiter.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) > 0)
+	{
+		event.fetch_add(1, std::memory_order_release);
+		if (all)
+		{
+			event.notify_all();
+		}
+		else
+		{
+			event.notify_one();
+		}
+	}
+}
+
+template <typename TItem>
+void RingBuffer<TItem>::push(TItem item)
+{
+	for (int spin = 0; !tryPush(item); ++spin)
+	{
+		if (spin < SPIN_COUNT)
+		{
+			cpuRelax();
+			continue;
+		}
+
+		// Park until a consumer frees a slot.
+		_slotWaiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t event = _slotEvent.load(std::memory_order_acquire);
+		if (!tryPush(item))
+		{
+			_slotEvent.wait(event, std::memory_order_acquire);
+			_slotWaiters.fetch_sub(1, std::memory_order_relaxed);
+			spin = 0;
+			continue;
+		}
+		_slotWaiters.fetch_sub(1, std::memory_order_relaxed);
+		break;
+	}
+	signal(_itemEvent, _itemWaiters, false);
+}
+
+template <typename TItem>
+std::optional<TItem> RingBuffer<TItem>::pop(size_t)
+{
+	TItem item{};
+	for (int spin = 0; !tryPop(item); ++spin)
+	{
+		if (!_stay.load(std::memory_order_acquire))
+		{
+			return std::nullopt;
+		}
+		if (spin < SPIN_COUNT)
+		{
+			cpuRelax();
+			continue;
+		}
+
+		// Park until a producer stores an item or the ring is closed.
+		_itemWaiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t event = _itemEvent.load(std::memory_order_acquire);
+		if (!tryPop(item))
+		{
+			if (_stay.load(std::memory_order_acquire))
+			{
+				_itemEvent.wait(event, std::memory_order_acquire);
+			}
+			_itemWaiters.fetch_sub(1, std::memory_order_relaxed);
+			spin = 0;
+			continue;
+		}
+		_itemWaiters.fetch_sub(1, std::memory_order_relaxed);
+		break;
+	}
+	signal(_slotEvent, _slotWaiters, false);
+	return std::optional<TItem>{ std::move(item) };
+}
+
+template <typename TItem>
+void RingBuffer<TItem>::close()
+{
+	_stay.store(false, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_itemEvent.fetch_add(1, std::memory_order_release);
+	_itemEvent.notify_all();
+}
+
+#endif
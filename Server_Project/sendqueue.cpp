@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * Outbound stage that collects replies from all workers during a tick and
+ * hands them to the kernel in as few syscalls as possible.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include "sendqueue.h"
+#include "NetBundle.h"
+
+// Packs an address into one sortable key.
+static uint64_t peerKey(const sockaddr_in& addr)
+{
+	return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+SendQueue::SendQueue(SOCKET socket, bool useGso, int mtu, NetIoStats* stats) :
+	_socket{ socket },
+	_useGso{ useGso },
+	_mtu{ mtu },
+	_stats{ stats }
+{
+}
+
+void SendQueue::enqueue(const sockaddr_in& to, const char* data, int size)
+{
+	std::lock_guard<std::mutex> lock{ _mutex };
+	size_t offset = _bytes.size();
+	_bytes.insert(_bytes.end(), data, data + size);
+	_entries.push_back(Entry{ to, offset, size });
+}
+
+void SendQueue::flush()
+{
+	{
+		// Take this tick's replies; workers continue filling the (now empty) other buffers.
+		std::lock_guard<std::mutex> lock{ _mutex };
+		_bytes.swap(_sendBytes);
+		_entries.swap(_sendEntries);
+	}
+
+	if (!_sendEntries.empty())
+	{
+		_stats->messages.fetch_add(_sendEntries.size(), std::memory_order_relaxed);
+
+		// A bundle is never larger than the replies it holds plus a header, and a lone reply is not copied
+		_bundleBytes.clear();
+		_bundleBytes.reserve(_sendBytes.size() + _sendEntries.size() * (NET_HEADER_SIZE + NET_BUNDLE_PREFIX_SIZE));
+
+		// Group by peer, keeping each peer's replies in the order they were produced.
+		_sendOrder.resize(_sendEntries.size());
+		for (uint32_t i = 0; i < _sendOrder.size(); ++i)
+		{
+			_sendOrder[i] = i;
+		}
+		std::stable_sort(_sendOrder.begin(), _sendOrder.end(), [&](uint32_t a, uint32_t b) {
+			return peerKey(_sendEntries[a].to) < peerKey(_sendEntries[b].to);
+		});
+
+		_batch.clear();
+		size_t first = 0;
+		for (size_t i = 1; i <= _sendOrder.size(); ++i)
+		{
+			if (i == _sendOrder.size() ||
+				peerKey(_sendEntries[_sendOrder[i]].to) != peerKey(_sendEntries[_sendOrder[first]].to))
+			{
+				packPeerRun(first, i);
+				sendPeerDatagrams();
+				first = i;
+			}
+		}
+
+		// Everything that did not go out as a GSO train, or ahead of one, goes out through sendmmsg.
+		if (!_batch.empty())
+		{
+			NetSendBatch(_socket, _batch.data(), static_cast<int>(_batch.size()), _stats);
+		}
+	}
+
+	_sendBytes.clear();
+	_sendEntries.clear();
+}
+
+void SendQueue::packPeerRun(size_t first, size_t last)
+{
+	_peerDatagrams.clear();
+	const sockaddr_in& to = _sendEntries[_sendOrder[first]].to;
+
+	// Greedily fill bundles in order. A bundle that ends up with one reply goes out as that reply,
+	// and a reply too big to share a datagram always goes alone.
+	char* bundleStart = nullptr;
+	NetBundleWriter bundle{ nullptr, 0 };
+	size_t bundleFirst = first;
+	auto closeBundle = [&]() {
+		if (bundleStart == nullptr) return;
+		if (bundle.count() == 1)
+		{
+			const Entry& entry = _sendEntries[_sendOrder[bundleFirst]];
+			_peerDatagrams.push_back(NetDatagram{ to, _sendBytes.data() + entry.offset, 0, entry.size });
+			_bundleBytes.resize(bundleStart - _bundleBytes.data());	// Give back the unused space
+		}
+		else
+		{
+			_bundleBytes.resize(bundleStart - _bundleBytes.data() + bundle.size());
+			_peerDatagrams.push_back(NetDatagram{ to, bundleStart, 0, bundle.size() });
+		}
+		bundleStart = nullptr;
+	};
+
+	for (size_t i = first; i < last; ++i)
+	{
+		const Entry& entry = _sendEntries[_sendOrder[i]];
+		char* data = _sendBytes.data() + entry.offset;
+		if (_mtu <= 0 || last - first == 1 || entry.size + NET_HEADER_SIZE + NET_BUNDLE_PREFIX_SIZE > _mtu)
+		{
+			closeBundle();
+			_peerDatagrams.push_back(NetDatagram{ to, data, 0, entry.size });
+			continue;
+		}
+		if (bundleStart != nullptr && !bundle.fits(entry.size))
+		{
+			closeBundle();
+		}
+		if (bundleStart == nullptr)
+		{
+			// Room for a whole bundle was reserved in flush, so this never reallocates
+			size_t offset = _bundleBytes.size();
+			_bundleBytes.resize(offset + std::min<size_t>(_mtu, _bundleBytes.capacity() - offset));
+			bundleStart = _bundleBytes.data() + offset;
+			bundle = NetBundleWriter{ bundleStart, static_cast<int>(_bundleBytes.size() - offset) };
+			bundleFirst = i;
+		}
+		bundle.add(data, entry.size);
+	}
+	closeBundle();
+}
+
+void SendQueue::sendPeerDatagrams()
+{
+	const size_t last = _peerDatagrams.size();
+	size_t i = 0;
+	bool batched = false;	// Some of this peer's datagrams are waiting in _batch
+	while (i < last)
+	{
+		// Collect a train of equal-sized datagrams; GSO lets only the last one be shorter.
+		const NetDatagram& head = _peerDatagrams[i];
+		int count = 0;
+		int total = 0;
+		while (_useGso && i + count < last && count < NET_GSO_SEGMENTS_MAX)
+		{
+			const NetDatagram& datagram = _peerDatagrams[i + count];
+			if (datagram.size > head.size || total + datagram.size > NET_GSO_BYTES_MAX) break;
+			total += datagram.size;
+			++count;
+			if (datagram.size < head.size) break;
+		}
+
+		// A train leaves at once, so the peer's earlier datagrams must leave before it, e.g. a welcome
+		// ahead of the snapshot parts that need it
+		if (count > 1 && batched)
+		{
+			NetSendBatch(_socket, _batch.data(), static_cast<int>(_batch.size()), _stats);
+			_batch.clear();
+			batched = false;
+		}
+		if (count > 1 && NetSendSegmented(_socket, head.addr, &_peerDatagrams[i], count, head.size, _stats))
+		{
+			i += count;
+			continue;
+		}
+
+		// No train, or GSO refused it: these go out through sendmmsg instead.
+		count = std::max(count, 1);
+		_batch.insert(_batch.end(), _peerDatagrams.begin() + i, _peerDatagrams.begin() + i + count);
+		batched = true;
+		i += count;
+	}
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Outbound stage that collects replies from all workers during a tick and
+ * hands them to the kernel in as few syscalls as possible. A peer's replies
+ * are packed into bundles of up to the MTU budget first (NetBundle.h), so
+ * a tick's worth of small messages leaves as one or two datagrams.
+ ******************************************************************************/
+
+#ifndef _SENDQUEUE_H_
+#define _SENDQUEUE_H_
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include "NetSocket.h"
+
+class SendQueue
+{
+public:
+	// mtu is the largest bundle of replies to one peer, 0 to send every reply alone.
+	SendQueue(SOCKET socket, bool useGso, int mtu, NetIoStats* stats);
+
+	// Queue a datagram for the next flush. Called from any worker thread.
+	void enqueue(const sockaddr_in& to, const char* data, int size);
+	// Send everything queued since the last flush. Called from one thread per tick.
+	void flush();
+
+	SendQueue() = delete;
+	SendQueue(const SendQueue&) = delete;
+	SendQueue& operator=(const SendQueue&) = delete;
+
+private:
+
+	struct Entry
+	{
+		sockaddr_in to;
+		size_t offset;	// Offset of the payload in the byte arena
+		int size;
+	};
+
+	// Pack the run [first, last) of _sendOrder, all addressed to one peer, into _peerDatagrams.
+	void packPeerRun(size_t first, size_t last);
+	// Send _peerDatagrams, as GSO trains where possible.
+	void sendPeerDatagrams();
+
+	SOCKET _socket;
+	bool _useGso;
+	int _mtu;
+	NetIoStats* _stats;
+
+	// Filled by workers under _mutex.
+	std::mutex _mutex;
+	std::vector<char> _bytes;
+	std::vector<Entry> _entries;
+
+	// Owned by the flushing thread; swapped with the above once per tick so
+	// workers never wait on a syscall.
+	std::vector<char> _sendBytes;
+	std::vector<Entry> _sendEntries;
+	std::vector<uint32_t> _sendOrder;
+	std::vector<char> _bundleBytes;	// Bundles built this flush; reserved up front so pointers into it stay valid
+	std::vector<NetDatagram> _peerDatagrams;
+	std::vector<NetDatagram> _batch;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*******************************************************************************
+ * Flat open-addressing hash of client sessions keyed by the packed 48-bit
+ * IPv4 address and port. Session state lives inline in the slots, so a lookup
+ * on the packet path never allocates or formats a string.
+ ******************************************************************************/
+
+#ifndef _SESSIONTABLE_H_
+#define _SESSIONTABLE_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Pack an IPv4 address and port, both in network byte order, into a session key.
+inline uint64_t sessionKey(uint32_t ipNet, uint16_t portNet)
+{
+	return (static_cast<uint64_t>(ipNet) << 16) | portNet;
+}
+
+// Address (network byte order) of a session key.
+inline uint32_t sessionKeyIp(uint64_t key)
+{
+	return static_cast<uint32_t>(key >> 16);
+}
+
+// Port (network byte order) of a session key.
+inline uint16_t sessionKeyPort(uint64_t key)
+{
+	return static_cast<uint16_t>(key);
+}
+
+// Linear probing with backward-shift deletion, so there are no tombstones and
+// probe chains stay short. Grows (and only then allocates) past half load.
+// Not thread-safe; pointers returned by find/insert stay valid until the next
+// insert or erase.
+template <typename TSession>
+class SessionTable
+{
+public:
+	explicit SessionTable(size_t capacity = 1024);
+
+	// Session stored under key, or nullptr.
+	TSession* find(uint64_t key);
+	// Session stored under key; a default-constructed one is added if missing.
+	TSession& insert(uint64_t key, bool& inserted);
+	// Remove the session stored under key. Returns false if there was none.
+	bool erase(uint64_t key);
+
+	size_t size() const { return _size; }
+
+	// Call func(key, session) for every session.
+	template <typename TFunc>
+	void forEach(TFunc func);
+
+private:
+
+	struct Slot
+	{
+		uint64_t key = 0;
+		bool used = false;
+		TSession session{};
+	};
+
+	size_t home(uint64_t key) const;
+	void grow();
+
+	std::vector<Slot> _slots;
+	size_t _mask;
+	size_t _size;
+};
+
+#include "sessiontable.hpp"
+
+#endif
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * Flat open-addressing hash of client sessions keyed by the packed 48-bit
+ * IPv4 address and port.
+ ******************************************************************************/
+
+#ifndef _SESSIONTABLE_HPP_
+#define _SESSIONTABLE_HPP_
+#include <utility>
+#include "sessiontable.h"
+
+template <typename TSession>
+SessionTable<TSession>::SessionTable(size_t capacity) :
+	_size{ 0 }
+{
+	size_t slots = 16;
+	while (slots < capacity)
+	{
+		slots <<= 1;
+	}
+	_slots.resize(slots);
+	_mask = slots - 1;
+}
+
+template <typename TSession>
+size_t SessionTable<TSession>::home(uint64_t key) const
+{
+	// Fibonacci hashing spreads the packed address across the table.
+	return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & _mask;
+}
+
+template <typename TSession>
+TSession* SessionTable<TSession>::find(uint64_t key)
+{
+	for (size_t i = home(key); _slots[i].used; i = (i + 1) & _mask)
+	{
+		if (_slots[i].key == key)
+		{
+			return &_slots[i].session;
+		}
+	}
+	return nullptr;
+}
+
+template <typename TSession>
+TSession& SessionTable<TSession>::insert(uint64_t key, bool& inserted)
+{
+	if ((_size + 1) * 2 > _slots.size())
+	{
+		grow();
+	}
+
+	size_t i = home(key);
+	for (; _slots[i].used; i = (i + 1) & _mask)
+	{
+		if (_slots[i].key == key)
+		{
+			inserted = false;
+			return _slots[i].session;
+		}
+	}
+
+	_slots[i].used = true;
+	_slots[i].key = key;
+	_slots[i].session = TSession{};
+	++_size;
+	inserted = true;
+	return _slots[i].session;
+}
+
+template <typename TSession>
+bool SessionTable<TSession>::erase(uint64_t key)
+{
+	size_t i = home(key);
+	while (true)
+	{
+		if (!_slots[i].used)
+		{
+			return false;
+		}
+		if (_slots[i].key == key)
+		{
+			break;
+		}
+		i = (i + 1) & _mask;
+	}
+
+	// Shift later members of the probe chain back into the hole.
+	size_t hole = i;
+	for (size_t j = (hole + 1) & _mask; _slots[j].used; j = (j + 1) & _mask)
+	{
+		size_t want = home(_slots[j].key);
+		// Move j into the hole unless its home lies cyclically in (hole, j].
+		bool stays = (hole <= j) ? (hole < want && want <= j) : (hole < want || want <= j);
+		if (!stays)
+		{
+			_slots[hole] = std::move(_slots[j]);
+			hole = j;
+		}
+	}
+	_slots[hole].used = false;
+	_slots[hole].session = TSession{};
+	--_size;
+	return true;
+}
+
+template <typename TSession>
+template <typename TFunc>
+void SessionTable<TSession>::forEach(TFunc func)
+{
+	for (Slot& slot : _slots)
+	{
+		if (slot.used)
+		{
+			func(slot.key, slot.session);
+		}
+	}
+}
+
+template <typename TSession>
+void SessionTable<TSession>::grow()
+{
+	std::vector<Slot> old;
+	old.swap(_slots);
+	_slots.resize(old.size() * 2);
+	_mask = _slots.size() - 1;
+
+	for (Slot& slot : old)
+	{
+		if (!slot.used)
+		{
+			continue;
+		}
+		size_t i = home(slot.key);
+		while (_slots[i].used)
+		{
+			i = (i + 1) & _mask;
+		}
+		_slots[i] = std::move(slot);
+	}
+}
+
+#endif
@@ -8,33 +8,31 @@
 #include <vector>
 #include <queue>
 #include <mutex>
+#include <condition_variable>
 #include <optional>
 #include <thread>
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-class TaskQueue
+// Default TaskQueue backend: a std::queue guarded by counting semaphores made
+// of mutexes and condition variables.
+//
+// A backend is constructed from (slotCount, workerCount) and provides
+// push(item), push(item, hint), pop(worker) and close().
+template <typename TItem>
+class LockedBuffer
 {
 public:
-	TaskQueue(size_t workerCount, size_t slotCount, TAction& action, TOnDisconnect& disconnect);
-	~TaskQueue();
-
-	std::optional<TItem> consume();
-	void produce(TItem item);
+	LockedBuffer(size_t slotCount, size_t workerCount);
 
-	TaskQueue() = delete;
-	TaskQueue(const TaskQueue&) = delete;
-	TaskQueue(TaskQueue&&) = delete;
-	TaskQueue& operator=(const TaskQueue&) = delete;
-	TaskQueue& operator=(TaskQueue&&) = delete;
+	// Block until a slot is free, then store the item. There is one shared
+	// queue, so the lane hint is ignored.
+	void push(TItem item);
+	void push(TItem item, size_t) { push(std::move(item)); }
+	// Block until an item is available for any worker; std::nullopt once closed and drained.
+	std::optional<TItem> pop(size_t worker = 0);
+	// Release every blocked consumer.
+	void close();
 
 private:
-
-	static void work(TaskQueue<TItem, TAction, TOnDisconnect>& tq, TAction& action);
-	void disconnect();
-
-	// Pool of worker threads.
-	std::vector<std::thread> _workers;
-
 	// Buffer of slots for items.
 	std::mutex _bufferMutex;
 	std::queue<TItem> _buffer;
@@ -51,7 +49,39 @@ private:
 	// Critical section condition for decreasing items.
 	std::condition_variable _consumers;
 
-	volatile bool _stay;
+	bool _stay;
+};
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer = LockedBuffer>
+class TaskQueue
+{
+public:
+	TaskQueue(size_t workerCount, size_t slotCount, TAction& action, TOnDisconnect& disconnect);
+	~TaskQueue();
+
+	// Take the next item for the given worker; std::nullopt on termination.
+	std::optional<TItem> consume(size_t worker = 0);
+	// Hand an item to the workers; the backend picks the lane.
+	void produce(TItem item);
+	// Hand an item to the workers, preferring lane (hint % workerCount).
+	void produce(TItem item, size_t hint);
+
+	TaskQueue() = delete;
+	TaskQueue(const TaskQueue&) = delete;
+	TaskQueue(TaskQueue&&) = delete;
+	TaskQueue& operator=(const TaskQueue&) = delete;
+	TaskQueue& operator=(TaskQueue&&) = delete;
+
+private:
+
+	static void work(TaskQueue& tq, TAction& action, size_t worker);
+	void disconnect();
+
+	// Storage for items between the producer and the workers.
+	TBuffer<TItem> _buffer;
+
+	// Pool of worker threads.
+	std::vector<std::thread> _workers;
 
 	TOnDisconnect& _onDisconnect;
 };
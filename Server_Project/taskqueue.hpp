@@ -6,23 +6,18 @@
 #define _TASKQUEUE_HPP_
 #include <optional>
 #include "taskqueue.h"
-//use for synch on stdout
-static std::mutex _stdoutMutex;
-template <typename TItem, typename TAction, typename TOnDisconnect>
-TaskQueue<TItem, TAction, TOnDisconnect>::TaskQueue(size_t workerCount, size_t slotCount, TAction& action, TOnDisconnect& onDisconnect) :
+#include "logger.h"
+
+template <typename TItem>
+LockedBuffer<TItem>::LockedBuffer(size_t slotCount, size_t) :
 	_slotCount{ slotCount },
 	_itemCount{ 0 },
-	_onDisconnect{ onDisconnect },
 	_stay{ true }
 {
-	for (size_t i = 0; i < workerCount; ++i)
-	{
-		_workers.emplace_back(&work, std::ref(*this), std::ref(action));
-	}
 }
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-void TaskQueue<TItem, TAction, TOnDisconnect>::produce(TItem item)
+template <typename TItem>
+void LockedBuffer<TItem>::push(TItem item)
 {
 	// Non-RAII unique_lock to be blocked by a producer who needs a slot.
 	{
@@ -35,7 +30,7 @@ void TaskQueue<TItem, TAction, TOnDisconnect>::produce(TItem item)
 	{
 		// Lock the buffer.
 		std::lock_guard<std::mutex> bufferLock{ _bufferMutex };
-		_buffer.push(item);
+		_buffer.push(std::move(item));
 	}
 	// RAII lock_guard locked for itemCount.
 	{
@@ -46,8 +41,8 @@ void TaskQueue<TItem, TAction, TOnDisconnect>::produce(TItem item)
 	}
 }
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-std::optional<TItem> TaskQueue<TItem, TAction, TOnDisconnect>::consume()
+template <typename TItem>
+std::optional<TItem> LockedBuffer<TItem>::pop(size_t)
 {
 	std::optional<TItem> result = std::nullopt;
 	// Non-RAII unique_lock to be blocked by a consumer who needs an item.
@@ -66,7 +61,7 @@ std::optional<TItem> TaskQueue<TItem, TAction, TOnDisconnect>::consume()
 	{
 		// Lock the buffer.
 		std::lock_guard<std::mutex> bufferLock{ _bufferMutex };
-		result = _buffer.front();
+		result = std::move(_buffer.front());
 		_buffer.pop();
 	}
 	// RAII lock_guard locked for slots.
@@ -79,34 +74,58 @@ std::optional<TItem> TaskQueue<TItem, TAction, TOnDisconnect>::consume()
 	return result;
 }
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-void TaskQueue<TItem, TAction, TOnDisconnect>::work(TaskQueue<TItem, TAction, TOnDisconnect>& tq, TAction& action)
+template <typename TItem>
+void LockedBuffer<TItem>::close()
+{
+	// Wake every idle worker so it can see the termination.
+	std::lock_guard<std::mutex> itemCountLock(_itemCountMutex);
+	_stay = false;
+	_consumers.notify_all();
+}
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::TaskQueue(size_t workerCount, size_t slotCount, TAction& action, TOnDisconnect& onDisconnect) :
+	_buffer{ slotCount, workerCount },
+	_onDisconnect{ onDisconnect }
+{
+	for (size_t i = 0; i < workerCount; ++i)
+	{
+		_workers.emplace_back(&work, std::ref(*this), std::ref(action), i);
+	}
+}
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+void TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::produce(TItem item)
+{
+	_buffer.push(std::move(item));
+}
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+void TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::produce(TItem item, size_t hint)
+{
+	_buffer.push(std::move(item), hint);
+}
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+std::optional<TItem> TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::consume(size_t worker)
+{
+	return _buffer.pop(worker);
+}
+
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+void TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::work(TaskQueue& tq, TAction& action, size_t worker)
 {
 	while (true)
 	{
-		{
-			std::lock_guard<std::mutex> usersLock{ _stdoutMutex };
-			std::cout
-				<< "Thread ["
-				<< std::this_thread::get_id()
-				<< "] is waiting for a task."
-				<< std::endl;
-		}
-		std::optional<TItem> item = tq.consume();
+		LOG_TRACE("Worker [{}] is waiting for a task.", worker);
+		std::optional<TItem> item = tq.consume(worker);
 		if (!item)
 		{
 			// Termination of idle threads.
 			break;
 		}
 
-		{
-			std::lock_guard<std::mutex> usersLock{ _stdoutMutex };
-			std::cout
-				<< "Thread ["
-				<< std::this_thread::get_id()
-				<< "] is executing a task."
-				<< std::endl;
-		}
+		LOG_TRACE("Worker [{}] is executing a task.", worker);
 
 		if (!action(*item))
 		{
@@ -115,25 +134,18 @@ void TaskQueue<TItem, TAction, TOnDisconnect>::work(TaskQueue<TItem, TAction, TO
 		}
 	}
 
-	{
-		std::lock_guard<std::mutex> usersLock{ _stdoutMutex };
-		std::cout
-			<< "Thread ["
-			<< std::this_thread::get_id()
-			<< "] is exiting."
-			<< std::endl;
-	}
+	LOG_TRACE("Worker [{}] is exiting.", worker);
 }
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-void TaskQueue<TItem, TAction, TOnDisconnect>::disconnect()
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+void TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::disconnect()
 {
-	_stay = false;
+	_buffer.close();
 	_onDisconnect();
 }
 
-template <typename TItem, typename TAction, typename TOnDisconnect>
-TaskQueue<TItem, TAction, TOnDisconnect>::~TaskQueue()
+template <typename TItem, typename TAction, typename TOnDisconnect, template <typename> class TBuffer>
+TaskQueue<TItem, TAction, TOnDisconnect, TBuffer>::~TaskQueue()
 {
 	disconnect();
 	for (std::thread& worker : _workers)
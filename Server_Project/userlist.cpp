@@ -0,0 +1,120 @@
+/*******************************************************************************
+ * RSP_LISTUSERS replies encoded once per change to the set of users.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include "userlist.h"
+#include "sessiontable.h"
+#include "Protocol.h"
+#include "NetReliable.h"
+
+// Bytes of one user's entry, and of the command ID and user count before the entries.
+static const size_t ENTRY_SIZE = 6;
+static const size_t PREFIX_SIZE = 3;
+// Users per reliable message, so every part fits one reliable packet.
+static const size_t USERS_PER_PART = (NET_RELIABLE_MESSAGE_MAX - PREFIX_SIZE) / ENTRY_SIZE;
+
+// Encode count entries as one RSP_LISTUSERS message.
+static void encodeList(const char* entries, size_t count, std::vector<char>& out)
+{
+	out.resize(PREFIX_SIZE + count * ENTRY_SIZE);
+	out[0] = static_cast<char>(NET_CMD_RSP_LISTUSERS);
+	NetWriteU16(out.data() + 1, static_cast<uint16_t>(count));
+	if (count > 0)
+	{
+		std::memcpy(out.data() + PREFIX_SIZE, entries, count * ENTRY_SIZE);
+	}
+}
+
+const std::vector<char>& UserListVersion::whole() const
+{
+	std::call_once(_wholeOnce, [this]() {
+		_whole.resize(PREFIX_SIZE + count * ENTRY_SIZE);
+		_whole[0] = static_cast<char>(NET_CMD_RSP_LISTUSERS);
+		NetWriteU16(_whole.data() + 1, static_cast<uint16_t>(count));
+		size_t offset = PREFIX_SIZE;
+		for (const UserListPart& part : parts)
+		{
+			std::memcpy(_whole.data() + offset, part->data() + PREFIX_SIZE, part->size() - PREFIX_SIZE);
+			offset += part->size() - PREFIX_SIZE;
+		}
+	});
+	return _whole;
+}
+
+UserListCache::UserListCache()
+{
+	publish(0);
+}
+
+void UserListCache::add(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock{ _mutex };
+	if (_index.count(key) != 0) return;
+
+	// The key packs the address and port in network byte order, exactly as the entry holds them
+	uint32_t ip = sessionKeyIp(key);
+	uint16_t port = sessionKeyPort(key);
+	size_t offset = _entries.size();
+	_entries.resize(offset + ENTRY_SIZE);
+	std::memcpy(&_entries[offset], &ip, 4);
+	std::memcpy(&_entries[offset + 4], &port, 2);
+	_index[key] = _keys.size();
+	_keys.push_back(key);
+	publish((_keys.size() - 1) / USERS_PER_PART);
+}
+
+void UserListCache::remove(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock{ _mutex };
+	auto found = _index.find(key);
+	if (found == _index.end()) return;
+
+	// Move the last entry into the gap, so removal costs one entry and not a shift of the rest
+	size_t slot = found->second;
+	size_t last = _keys.size() - 1;
+	if (slot != last)
+	{
+		std::memcpy(&_entries[slot * ENTRY_SIZE], &_entries[last * ENTRY_SIZE], ENTRY_SIZE);
+		_keys[slot] = _keys[last];
+		_index[_keys[slot]] = slot;
+	}
+	_entries.resize(last * ENTRY_SIZE);
+	_keys.pop_back();
+	_index.erase(found);
+	publish(slot / USERS_PER_PART);
+}
+
+std::shared_ptr<const UserListVersion> UserListCache::current() const
+{
+	return _current.load(std::memory_order_acquire);
+}
+
+void UserListCache::publish(size_t changedPart)
+{
+	// Only add and remove store versions, and they hold _mutex, so this is the version being replaced
+	std::shared_ptr<const UserListVersion> previous = _current.load(std::memory_order_acquire);
+
+	auto next = std::make_shared<UserListVersion>();
+	next->version = ++_version;
+	next->count = _keys.size();
+	const size_t partCount = (next->count + USERS_PER_PART - 1) / USERS_PER_PART;
+	next->parts.reserve(partCount);
+	for (size_t part = 0; part < partCount; ++part)
+	{
+		// A join only grows the last part; a leave also refills the gap from it
+		if (previous && part < previous->parts.size() && part != changedPart && part + 1 != partCount)
+		{
+			next->parts.push_back(previous->parts[part]);
+			continue;
+		}
+		const size_t first = part * USERS_PER_PART;
+		auto encoded = std::make_shared<std::vector<char>>();
+		encodeList(_entries.data() + first * ENTRY_SIZE, std::min(USERS_PER_PART, next->count - first), *encoded);
+		next->parts.push_back(std::move(encoded));
+	}
+
+	// Readers holding the previous version keep it alive until they are done with it
+	_current.store(std::move(next), std::memory_order_release);
+}
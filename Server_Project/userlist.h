@@ -0,0 +1,75 @@
+/*******************************************************************************
+ * RSP_LISTUSERS replies encoded once per change to the set of users rather
+ * than once per request. Joins and leaves patch a flat array of addresses in
+ * place and publish a new immutable version through an atomic shared_ptr, so
+ * a list request only takes a reference to the newest version and sends it:
+ * no walk of the session table, no allocation, and no lock of its own.
+ *
+ * A version is a list of parts that each fit a reliable packet. A change
+ * re-encodes only the parts it touched, at most two, and shares the rest with
+ * the version before; the single-message list is joined from the parts the
+ * first time a version is asked for it.
+ ******************************************************************************/
+
+#ifndef _USERLIST_H_
+#define _USERLIST_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// One RSP_LISTUSERS message, shared by every version it did not change in.
+using UserListPart = std::shared_ptr<const std::vector<char>>;
+
+// One published version of the user list, never modified once published.
+struct UserListVersion
+{
+	uint64_t version = 0;
+	size_t count = 0;						// Users in the list
+	std::vector<UserListPart> parts;		// The users in RSP_LISTUSERS messages that each fit a reliable packet
+
+	// Every user in one RSP_LISTUSERS message. Joined from the parts on the
+	// first call, so versions nobody asks for this way never pay for it.
+	const std::vector<char>& whole() const;
+
+private:
+	mutable std::once_flag _wholeOnce;
+	mutable std::vector<char> _whole;
+};
+
+class UserListCache
+{
+public:
+	UserListCache();
+
+	// Add a user by session key and publish the new version. Safe from any
+	// thread; sessions come and go in every worker lane.
+	void add(uint64_t key);
+	// Remove a user by session key, if present, and publish the new version.
+	void remove(uint64_t key);
+
+	// Newest published version. Safe from any thread.
+	std::shared_ptr<const UserListVersion> current() const;
+
+	UserListCache(const UserListCache&) = delete;
+	UserListCache& operator=(const UserListCache&) = delete;
+
+private:
+
+	// Swap in a new version in which the given part and the last part are
+	// encoded from _entries, and every other part is the current version's.
+	void publish(size_t changedPart);
+
+	std::mutex _mutex;								// Serializes add and remove; readers never take it
+	std::vector<char> _entries;						// 6 bytes per user: IPv4 and port, both in network byte order
+	std::vector<uint64_t> _keys;					// Session key of each entry
+	std::unordered_map<uint64_t, size_t> _index;	// Entry of each session key
+	uint64_t _version = 0;
+	std::atomic<std::shared_ptr<const UserListVersion>> _current;
+};
+
+#endif